@@ -117,14 +117,15 @@ void compile_ocl_program(cl_kernel & kernel, cl_vars_t &cv,
 
 void compile_ocl_program(std::map<std::string, cl_kernel> &kernels, 
 			 cl_vars_t &cv, const char * cl_src, 
-			 std::list<std::string> knames)
+			 std::list<std::string> knames,
+			 const char * options)
 {
   cl_int err;
   cv.main_program = clCreateProgramWithSource(cv.context, 1, (const char **) &cl_src, 
 					      NULL, &err);
   CHK_ERR(err);
 
-  err = clBuildProgram(cv.main_program, 0, NULL, NULL, NULL, NULL);
+  err = clBuildProgram(cv.main_program, 0, NULL, options, NULL, NULL);
 
   if (err != CL_SUCCESS)
     {
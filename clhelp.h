@@ -55,7 +55,8 @@ void compile_ocl_program(cl_kernel & kernel, cl_vars_t &cv, const char * cl_src,
 
 void compile_ocl_program(std::map<std::string, cl_kernel> &kernels, 
 			 cl_vars_t &cv, const char * cl_src, 
-			 std::list<std::string> knames);
+			 std::list<std::string> knames,
+			 const char * options = NULL);
 
 void readFile(std::string& fileName, std::string &out); 
 double timestamp();
@@ -1,6 +1,10 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <string>
 #include <cmath>
+#include <cstdlib>
+#include <vector>
 
 #define EPSILON 0.01
 
@@ -8,41 +12,69 @@ using namespace std;
 
 int main(int argc, char const *argv[])
 {
-	if (argc != 3) {
-    cout << "Usage: ./compare_outputs <file1.out> <file2.out>\n";
+  // values match when they differ by at most EPSILON or, for engines that
+  // store U, V and M in reduced precision, by at most the given relative
+  // tolerance of the largest value of the first (reference) file: their
+  // rounding error scales with the outputs, not with each value.
+  double tolerance = 0;
+  if (argc == 4) {
+    tolerance = atof(argv[3]);
+  }
+	if ((argc != 3 && argc != 4) || tolerance < 0) {
+    cout << "Usage: ./compare_outputs <file1.out> <file2.out> [relative tolerance]\n";
     return 1;
   }
   ifstream output1, output2;
   output1.open(argv[1]);
   output2.open(argv[2]);
   
-  int K1, C1, H1, W1,
-      K2, C2, H2, W2;
-  output1 >> K1 >> C1 >> H1 >> W1;
-  output2 >> K2 >> C2 >> H2 >> W2;
+  // the header is "K C H W", or "K C H W N" for a batch of N images.
+  int K1, C1, H1, W1, N1 = 1,
+      K2, C2, H2, W2, N2 = 1;
+  string header1, header2;
+  getline(output1, header1);
+  getline(output2, header2);
+  istringstream fields1(header1), fields2(header2);
+  fields1 >> K1 >> C1 >> H1 >> W1;
+  fields2 >> K2 >> C2 >> H2 >> W2;
+  if (!(fields1 >> N1)) {
+    N1 = 1;
+  }
+  if (!(fields2 >> N2)) {
+    N2 = 1;
+  }
   
-  if (K1 != K2 || C1 != C2 || H1 != H2 || W1 != W2) {
+  if (K1 != K2 || C1 != C2 || H1 != H2 || W1 != W2 || N1 != N2) {
    cout << "Output files were not created from the same dimensions." << endl;
    return 1;
   }
 
-  float val1, val2;
-
-  for (int k = 0; k < K1; k++) {
-    for (int h = 0; h < H1 - 2; h++) {
-       for (int w = 0; w < W1 - 2; w++) {
-          output1 >> val1;
-          output2 >> val2;
-          if (abs(val1 - val2) > EPSILON) {
-            printf("Values %f and %f at [%d][%d][%d] do not match up.\n",
-              val1, val2, k, h, w);
-            return 1;
-          }
-       }
-    }
+  // padded outputs are not (H - 2) x (W - 2), so every value in the two
+  // files is compared, and they must hold the same number of values.
+  vector<float> values1, values2;
+  float val;
+  float largest = 0;
+  while (output1 >> val) {
+    values1.push_back(val);
+    largest = max(largest, abs(val));
+  }
+  while (output2 >> val) {
+    values2.push_back(val);
   }
   output1.close();
   output2.close();
+  if (values1.size() != values2.size()) {
+    cout << "Output files hold different numbers of values." << endl;
+    return 1;
+  }
+  for (size_t index = 0; index < values1.size(); index++) {
+    float error = abs(values1[index] - values2[index]);
+    if (error > EPSILON && error > tolerance * largest) {
+      printf("Values %f and %f at index %ld do not match up.\n", values1[index],
+             values2[index], (long) index);
+      return 1;
+    }
+  }
   cout << "Values match up!" << endl;
   return 0;
 }
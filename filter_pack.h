@@ -0,0 +1,179 @@
+#ifndef __FILTER_PACK_H
+#define __FILTER_PACK_H
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gemm.h"
+#include "tensor.h"
+
+// A filter pack holds the transformed filters U of one F(m x m, r x r) at
+// one stride so that runs with fixed weights skip the filter transform. It
+// is written by
+// `winograd --pack-filters` and is a FilterPackHeader followed, at
+// data_offset, by the raw contents of U in BatchedGemm's panel layout
+// (padding included), in float or double, the working precision it was
+// written in. The CPU engines mmap it and multiply straight out of the page
+// cache when they run in the same precision; the GPU engine unpacks either
+// on upload.
+#define FILTER_PACK_MAGIC "WINOPACK"
+#define FILTER_PACK_VERSION 3
+
+struct FilterPackHeader {
+  char magic[8];
+  int version;
+  int m, r, conv_stride, groups, K, C;
+  // sizeof the scalar and BatchedGemm::MR the panels were built with.
+  int elem_size, mr;
+  int dim[4];
+  long stride[4];
+  // start of U, a multiple of TENSOR_ALIGNMENT so the mapped panels keep
+  // their alignment.
+  long data_offset;
+};
+
+// Writes U, packed for F(m x m, r x r) at the given stride with K filters
+// over C channels in the given number of groups, to path. A strided U holds
+// the polyphase sub-filters, C / groups * stride^2 of them per filter.
+template <typename T>
+bool write_filter_pack(const char* path, int m, int r, int stride, int groups, int K, int C,
+                       const Tensor<T>& U) {
+  FilterPackHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, FILTER_PACK_MAGIC, sizeof(header.magic));
+  header.version = FILTER_PACK_VERSION;
+  header.m = m;
+  header.r = r;
+  header.conv_stride = stride;
+  header.groups = groups;
+  header.K = K;
+  header.C = C;
+  header.elem_size = sizeof(T);
+  header.mr = BatchedGemm<T>::MR;
+  for (int i = 0; i < 4; i++) {
+    header.dim[i] = U.dim[i];
+    header.stride[i] = U.stride[i];
+  }
+  header.data_offset = (sizeof(header) + TENSOR_ALIGNMENT - 1) / TENSOR_ALIGNMENT * TENSOR_ALIGNMENT;
+
+  FILE* f = fopen(path, "wb");
+  if (f == NULL) {
+    return false;
+  }
+  char pad[TENSOR_ALIGNMENT] = {};
+  size_t count = U.stride[0] * U.dim[0];
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+            fwrite(pad, header.data_offset - sizeof(header), 1, f) == 1 &&
+            fwrite(U.data, sizeof(T), count, f) == count;
+  return fclose(f) == 0 && ok;
+}
+
+// A filter pack mapped read-only into memory.
+struct FilterPack {
+  FilterPackHeader header;
+  void* map;
+  size_t size;
+
+  FilterPack() : map(MAP_FAILED), size(0) {}
+
+  ~FilterPack() {
+    if (map != MAP_FAILED) {
+      munmap(map, size);
+    }
+  }
+
+  // Maps path and checks that it holds U for F(m x m, r x r) at the given
+  // stride in the panel layout of this build. Prints the reason and returns
+  // false otherwise.
+  bool open(const char* path, int m, int r, int stride) {
+    int fd = ::open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(header)) {
+      std::cout << "Error: Cannot read filter pack " << path << "." << std::endl;
+      if (fd >= 0) {
+        close(fd);
+      }
+      return false;
+    }
+    size = st.st_size;
+    map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      std::cout << "Error: Cannot map filter pack " << path << "." << std::endl;
+      return false;
+    }
+    memcpy(&header, map, sizeof(header));
+
+    if (memcmp(header.magic, FILTER_PACK_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != FILTER_PACK_VERSION) {
+      std::cout << "Error: " << path << " is not a filter pack." << std::endl;
+      return false;
+    }
+    if (header.m != m || header.r != r) {
+      std::cout << "Error: Filter pack is for F(" << header.m << "x" << header.m << ", "
+                << header.r << "x" << header.r << "), not F(" << m << "x" << m << ", "
+                << r << "x" << r << ")." << std::endl;
+      return false;
+    }
+    if (header.conv_stride != stride) {
+      std::cout << "Error: Filter pack is for stride " << header.conv_stride << ", not " << stride
+                << "." << std::endl;
+      return false;
+    }
+    if ((header.elem_size != (int) sizeof(float) && header.elem_size != (int) sizeof(double)) ||
+        header.mr != BatchedGemm<double>::MR) {
+      std::cout << "Error: Filter pack was written by an incompatible build." << std::endl;
+      return false;
+    }
+    if (header.data_offset + header.stride[0] * header.dim[0] * (long) header.elem_size >
+        (long) size) {
+      std::cout << "Error: Filter pack " << path << " is truncated." << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // whether U is stored as T.
+  template <typename T>
+  bool holds() const {
+    return header.elem_size == (int) sizeof(T);
+  }
+
+  const char* precision() const {
+    return holds<float>() ? "float" : "double";
+  }
+
+  template <typename T>
+  T* data() const {
+    return (T*) ((char*) map + header.data_offset);
+  }
+
+  // A view of the packed U, which must be stored as T (see holds). The
+  // mapping is read-only.
+  template <typename T>
+  Tensor<T>* tensor() const {
+    return new Tensor<T>(data<T>(), header.dim[0], header.dim[1], header.dim[2], header.dim[3],
+                         header.stride[0], header.stride[1], header.stride[2], header.stride[3]);
+  }
+
+  // U[xi][nu](k, c), where c runs over the channels of the group of
+  // filter k (see BatchedGemm::packed).
+  double at(int xi, int nu, int k, int c) const {
+    int mr = header.mr;
+    int Kg = header.K / header.groups;
+    int row = k / Kg * ((Kg + mr - 1) / mr) * mr + k % Kg;
+    long i = xi * header.stride[0] + nu * header.stride[1] + (row / mr) * header.stride[2] +
+             (c * mr + row % mr) * header.stride[3];
+    return holds<float>() ? data<float>()[i] : data<double>()[i];
+  }
+
+ private:
+  FilterPack(const FilterPack&);
+  FilterPack& operator=(const FilterPack&);
+};
+
+#endif
@@ -0,0 +1,531 @@
+#ifndef __GEMM_H
+#define __GEMM_H
+
+#include <algorithm>
+#include <cstring>
+#include "simd.h"
+#include "tensor.h"
+
+// The transform-domain products M[xi][nu] = U[xi][nu] * V[xi][nu], where
+// U is K x C, V is C x P and M is K x P, for every (xi, nu).
+//
+// K and C are often far too small for a BLAS call to amortise its packing,
+// and BLAS would repack U for every one of the alpha^2 products of every
+// block of tiles. Instead U is packed once, right after the filter
+// transform, into panels of MR rows, stored c-major so that a panel
+// column is MR consecutive elements:
+//   Up(xi, nu, k / MR, c * MR + k % MR) = U(xi, nu, k, c)
+// V is packed in one pass, a KC x NR strip at a time, into a buffer that
+// stays in L1 while every panel of U is multiplied against it. The
+// micro-kernel keeps an MR x NR block of M in MR * 2 vector registers:
+// per column of U it does two vector loads of V, MR broadcasts of U and
+// MR * 2 FMAs.
+//
+// U, V and M may be stored in a narrower type T than the arithmetic type A
+// (half in float): V is widened as it is packed, U as it is broadcast, and
+// each block of M is narrowed once, when it is stored.
+template <typename T, typename A = typename Arithmetic<T>::type>
+struct BatchedGemm {
+  typedef Simd<A> S;
+  typedef typename S::type vec;
+  // the element types of U and V, and of M.
+  typedef T factor_type;
+  typedef T product_type;
+  static const int MR = 6;
+  static const int NR = 2 * S::width;
+  // rows of V per packed strip: KC * NR elements fill half of a 32 KB L1
+  // in double precision. With narrow storage the strips run 4x deeper, so
+  // that M of up to 512 channels is summed entirely in registers rather
+  // than through rounded partial sums in M; the strip then lives in L2.
+  static const int KC = sizeof(T) < sizeof(A) ? 512 : 128;
+
+  // U[xi][nu] of K x C packs into Tensor<T>(alpha, alpha, panels(K),
+  // panel_width(C)).
+  static int panels(int K) {
+    return (K + MR - 1) / MR;
+  }
+
+  static int panel_width(int C) {
+    return C * MR;
+  }
+
+  // width consecutive stored elements, widened, and back.
+  static vec load(const A* p) { return S::loadu(p); }
+  static vec load(const half* p) { return S::loadh(p); }
+  static void store(A* p, vec a) { S::storeu(p, a); }
+  static void store(half* p, vec a) { S::storeh(p, a); }
+
+  // M (MR x NR block at mm, row stride ldm) = or += up * vp over kc columns.
+  // Only the top left rows x cols of the block are written, so K and P need
+  // not be multiples of the block size; the padding of the panels is zero.
+  static inline void kernel(int kc, const T* up, const A* vp, T* mm, long ldm,
+                            bool accumulate, int rows, int cols) {
+    vec acc[MR][2];
+    #pragma GCC unroll 16
+    for (int i = 0; i < MR; i++) {
+      acc[i][0] = S::zero();
+      acc[i][1] = S::zero();
+    }
+    for (int c = 0; c < kc; c++) {
+      vec b0 = S::load(vp + c * NR);
+      vec b1 = S::load(vp + c * NR + S::width);
+      #pragma GCC unroll 16
+      for (int i = 0; i < MR; i++) {
+        vec a = S::set1((A) up[c * MR + i]);
+        acc[i][0] = S::fmadd(a, b0, acc[i][0]);
+        acc[i][1] = S::fmadd(a, b1, acc[i][1]);
+      }
+    }
+
+    if (rows == MR && cols == NR) {
+      #pragma GCC unroll 16
+      for (int i = 0; i < MR; i++) {
+        T* row = mm + i * ldm;
+        if (accumulate) {
+          acc[i][0] = S::add(acc[i][0], load(row));
+          acc[i][1] = S::add(acc[i][1], load(row + S::width));
+        }
+        store(row, acc[i][0]);
+        store(row + S::width, acc[i][1]);
+      }
+    } else {
+      alignas(TENSOR_ALIGNMENT) A tile[MR * NR];
+      for (int i = 0; i < MR; i++) {
+        S::store(tile + i * NR, acc[i][0]);
+        S::store(tile + i * NR + S::width, acc[i][1]);
+      }
+      for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+          A sum = accumulate ? (A) mm[i * ldm + j] + tile[i * NR + j] : tile[i * NR + j];
+          mm[i * ldm + j] = T(sum);
+        }
+      }
+    }
+  }
+
+  // Copies rows c0 .. c0 + kc - 1, columns j0 .. j0 + cols - 1 of V[xi][nu]
+  // into vp as kc rows of NR, zero-padding the columns past cols.
+  static void pack_v(const Tensor<T>& V, int xi, int nu, int c0, int kc, int j0, int cols,
+                     A* vp) {
+    for (int c = 0; c < kc; c++) {
+      const T* src = &V(xi, nu, c0 + c, j0);
+      A* dst = vp + c * NR;
+      if (cols == NR && V.stride[3] == 1) {
+        S::store(dst, load(src));
+        S::store(dst + S::width, load(src + S::width));
+      } else {
+        for (int j = 0; j < NR; j++) {
+          dst[j] = j < cols ? (A) src[j * V.stride[3]] : 0;
+        }
+      }
+    }
+  }
+
+  // Rows k0 .. k0 + nk - 1 and columns j0 .. j0 + np - 1 of
+  // M[xi][nu] = U[xi][nu] * V[xi][nu], with U pre-packed by the caller.
+  // k0 must be a multiple of MR. Disjoint blocks of M can be computed in
+  // parallel.
+  static void multiply_block(const Tensor<T>& Up, const Tensor<T>& V, Tensor<T>& M,
+                             int xi, int nu, int k0, int nk, int j0, int np) {
+    int C = V.dim[2];
+    alignas(TENSOR_ALIGNMENT) A vp[KC * NR];
+    const T* u = Up.ptr(xi, nu);
+    for (int c0 = 0; c0 < C; c0 += KC) {
+      int kc = std::min(KC, C - c0);
+      for (int j = j0; j < j0 + np; j += NR) {
+        int cols = std::min(NR, j0 + np - j);
+        pack_v(V, xi, nu, c0, kc, j, cols, vp);
+        for (int k = k0; k < k0 + nk; k += MR) {
+          kernel(kc, u + (k / MR) * Up.stride[2] + (long) c0 * MR, vp,
+                 &M(xi, nu, k, j), M.stride[2], c0 > 0,
+                 std::min(MR, k0 + nk - k), cols);
+        }
+      }
+    }
+  }
+
+  // All of M[xi][nu]. K comes from M, since the packed panels are padded to
+  // a multiple of MR.
+  static void multiply(const Tensor<T>& Up, const Tensor<T>& V, Tensor<T>& M,
+                       int xi, int nu) {
+    multiply_block(Up, V, M, xi, nu, 0, M.dim[2], 0, V.dim[3]);
+  }
+
+  // Grouped convolutions split the K filters and the C rows of V into
+  // groups; group g's Kg = K / groups filters only see its Cg = C / groups
+  // rows of V, so U is a stack of Kg x Cg matrices, each packed on its own:
+  //   Up(xi, nu, g * panels(Kg) + k / MR, c * MR + k % MR) = U_g(xi, nu, k, c)
+  // in Tensor<T>(alpha, alpha, groups * panels(Kg), Cg * MR). With a single
+  // group this is the plain layout. packed() is element (k, c) of U[xi][nu],
+  // c counting within the group of filter k.
+  static T& packed(Tensor<T>& Up, int xi, int nu, int Kg, int k, int c) {
+    int g = k / Kg;
+    k %= Kg;
+    return Up(xi, nu, g * panels(Kg) + k / MR, c * MR + k % MR);
+  }
+
+  // Groups whose reductions are at most this long (depthwise layers, with
+  // one channel per group, or four polyphase channels when strided) skip
+  // the GEMM: packing V and running the micro-kernel cost far more than
+  // the few multiplies per element.
+  static const int DEPTHWISE_MAX_C = 4;
+
+  // M_g[xi][nu] = U_g[xi][nu] * V_g[xi][nu] elementwise along the tiles:
+  // M(k, j) = sum over c of U_g(k, c) * V(g * Cg + c, j), for rows k0 ..
+  // k0 + nk - 1 and columns j0 .. j0 + np - 1 of group g.
+  static void multiply_depthwise_block(const Tensor<T>& Up, const Tensor<T>& V, Tensor<T>& M,
+                                       int xi, int nu, int groups, int g, int k0, int nk,
+                                       int j0, int np) {
+    int Cg = V.dim[2] / groups, Kg = M.dim[2] / groups;
+    const T* u = Up.ptr(xi, nu) + (long) g * panels(Kg) * Up.stride[2];
+    bool contiguous = V.stride[3] == 1 && M.stride[3] == 1;
+    for (int k = k0; k < k0 + nk; k++) {
+      const T* uk = u + (k / MR) * Up.stride[2] + k % MR;
+      T* out = &M(xi, nu, g * Kg + k, 0);
+      const T* in = &V(xi, nu, g * Cg, 0);
+      int j = j0;
+      if (contiguous) {
+        for (; j + S::width <= j0 + np; j += S::width) {
+          vec acc = S::mul(S::set1((A) uk[0]), load(in + j));
+          for (int c = 1; c < Cg; c++) {
+            acc = S::fmadd(S::set1((A) uk[c * MR]), load(in + c * V.stride[2] + j), acc);
+          }
+          store(out + j, acc);
+        }
+      }
+      for (; j < j0 + np; j++) {
+        A sum = 0;
+        for (int c = 0; c < Cg; c++) {
+          sum += (A) uk[c * MR] * (A) in[c * V.stride[2] + j * V.stride[3]];
+        }
+        out[j * M.stride[3]] = T(sum);
+      }
+    }
+  }
+
+  // Rows k0 .. k0 + nk - 1 (k0 a multiple of MR) and columns j0 .. j0 +
+  // np - 1 of group g's part of M[xi][nu]. Short groups go through
+  // multiply_depthwise_block, the others through the GEMM on views of U,
+  // V and M restricted to the group.
+  static void multiply_group_block(const Tensor<T>& Up, const Tensor<T>& V, Tensor<T>& M,
+                                   int xi, int nu, int groups, int g, int k0, int nk,
+                                   int j0, int np) {
+    int Cg = V.dim[2] / groups, Kg = M.dim[2] / groups;
+    if (Cg <= DEPTHWISE_MAX_C) {
+      multiply_depthwise_block(Up, V, M, xi, nu, groups, g, k0, nk, j0, np);
+      return;
+    }
+    Tensor<T> Ug(Up.data + (long) g * panels(Kg) * Up.stride[2], Up.dim[0], Up.dim[1],
+                 panels(Kg), Up.dim[3], Up.stride[0], Up.stride[1], Up.stride[2], Up.stride[3]);
+    Tensor<T> Vg(V.data + (long) g * Cg * V.stride[2], V.dim[0], V.dim[1], Cg, V.dim[3],
+                 V.stride[0], V.stride[1], V.stride[2], V.stride[3]);
+    Tensor<T> Mg(M.data + (long) g * Kg * M.stride[2], M.dim[0], M.dim[1], Kg, M.dim[3],
+                 M.stride[0], M.stride[1], M.stride[2], M.stride[3]);
+    multiply_block(Ug, Vg, Mg, xi, nu, k0, nk, j0, np);
+  }
+
+  // Rows k0 .. k0 + nk - 1 (k0 a multiple of MR) and columns j0 .. j0 +
+  // np - 1 of group g's part of the product M[xi][nu] = A[xi][nu] * V^T,
+  // reduced over the tiles instead of the channels: Ap is a K x P matrix
+  // packed like U (packed() with the tiles as c), V is C x P and M is
+  // K x Cg, column c of group g being row g * Cg + c of V. This is the
+  // weight gradient of a convolution, dU = dM V^T. V is read through a
+  // transposed view, which pack_v copies element by element.
+  static void multiply_nt_group_block(const Tensor<T>& Ap, const Tensor<T>& V, Tensor<T>& M,
+                                      int xi, int nu, int groups, int g, int k0, int nk,
+                                      int j0, int np) {
+    int Cg = V.dim[2] / groups, Kg = M.dim[2] / groups;
+    Tensor<T> Ag(Ap.data + (long) g * panels(Kg) * Ap.stride[2], Ap.dim[0], Ap.dim[1],
+                 panels(Kg), Ap.dim[3], Ap.stride[0], Ap.stride[1], Ap.stride[2], Ap.stride[3]);
+    Tensor<T> Vt(V.data + (long) g * Cg * V.stride[2], V.dim[0], V.dim[1], V.dim[3], Cg,
+                 V.stride[0], V.stride[1], V.stride[3], V.stride[2]);
+    Tensor<T> Mg(M.data + (long) g * Kg * M.stride[2], M.dim[0], M.dim[1], Kg, M.dim[3],
+                 M.stride[0], M.stride[1], M.stride[2], M.stride[3]);
+    multiply_block(Ag, Vt, Mg, xi, nu, k0, nk, j0, np);
+  }
+
+  // All of M[xi][nu] for a grouped convolution.
+  static void multiply_grouped(const Tensor<T>& Up, const Tensor<T>& V, Tensor<T>& M,
+                               int xi, int nu, int groups) {
+    int Kg = M.dim[2] / groups;
+    for (int g = 0; g < groups; g++) {
+      multiply_group_block(Up, V, M, xi, nu, groups, g, 0, Kg, 0, V.dim[3]);
+    }
+  }
+};
+
+// The transform-domain products of the quantised (int8) path, with U and V
+// in int16 and M summed exactly in int32. The micro-kernel is the one of
+// BatchedGemm, except that it consumes the channels two at a time with
+// pairwise multiply-adds (SimdInt16), so U is packed with the two elements
+// of a channel pair next to each other,
+//   Up(xi, nu, k / MR, c / 2 * 2 * MR + k % MR * 2 + c % 2) = U(xi, nu, k, c)
+// in Tensor<int16_t>(alpha, alpha, panels(K), panel_width(C)), and V
+// is packed into pairs of rows. An odd channel count leaves the last pair
+// half zero. Groups are stacked as in BatchedGemm::packed.
+struct QuantizedGemm {
+  typedef SimdInt16 S;
+  typedef S::type vec;
+  typedef int16_t factor_type;
+  typedef int32_t product_type;
+  static const int MR = 6;
+  static const int NR = 2 * S::width;
+  // channel pairs per packed strip: KC * NR int32 fill half of a 32 KB L1.
+  static const int KC = 64;
+
+  static int panels(int K) {
+    return (K + MR - 1) / MR;
+  }
+
+  static int pairs(int C) {
+    return (C + 1) / 2;
+  }
+
+  static int panel_width(int C) {
+    return pairs(C) * 2 * MR;
+  }
+
+  // The channel pair at c of row i of a panel, as one int32.
+  static int32_t pair(const int16_t* p) {
+    int32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+  }
+
+  static int32_t pair(int16_t lo, int16_t hi) {
+    int16_t p[2] = {lo, hi};
+    return pair(p);
+  }
+
+  // M (MR x NR block at mm, row stride ldm) = or += up * vp over kp channel
+  // pairs, writing only the top left rows x cols, as BatchedGemm::kernel.
+  static inline void kernel(int kp, const int16_t* up, const int32_t* vp, int32_t* mm,
+                            long ldm, bool accumulate, int rows, int cols) {
+    vec acc[MR][2];
+    #pragma GCC unroll 16
+    for (int i = 0; i < MR; i++) {
+      acc[i][0] = S::zero();
+      acc[i][1] = S::zero();
+    }
+    for (int p = 0; p < kp; p++) {
+      vec b0 = S::load(vp + p * NR);
+      vec b1 = S::load(vp + p * NR + S::width);
+      #pragma GCC unroll 16
+      for (int i = 0; i < MR; i++) {
+        vec a = S::set1(pair(up + (p * MR + i) * 2));
+        acc[i][0] = S::madd(acc[i][0], a, b0);
+        acc[i][1] = S::madd(acc[i][1], a, b1);
+      }
+    }
+    if (rows == MR && cols == NR) {
+      #pragma GCC unroll 16
+      for (int i = 0; i < MR; i++) {
+        int32_t* row = mm + i * ldm;
+        if (accumulate) {
+          acc[i][0] = S::add(acc[i][0], S::load(row));
+          acc[i][1] = S::add(acc[i][1], S::load(row + S::width));
+        }
+        S::store(row, acc[i][0]);
+        S::store(row + S::width, acc[i][1]);
+      }
+    } else {
+      alignas(TENSOR_ALIGNMENT) int32_t tile[MR * NR];
+      for (int i = 0; i < MR; i++) {
+        S::store(tile + i * NR, acc[i][0]);
+        S::store(tile + i * NR + S::width, acc[i][1]);
+      }
+      for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+          mm[i * ldm + j] = accumulate ? mm[i * ldm + j] + tile[i * NR + j] : tile[i * NR + j];
+        }
+      }
+    }
+  }
+
+  // Packs rows c0 .. c0 + 2 * kp - 1 (those below C of V[xi][nu], zero
+  // past it), columns j0 .. j0 + cols - 1, into vp as kp rows of NR pairs,
+  // a vector of pairs at a time where the strip is whole.
+  static void pack_v(const Tensor<int16_t>& V, int xi, int nu, int c0, int kp, int j0,
+                     int cols, int32_t* vp) {
+    int C = V.dim[2];
+    for (int p = 0; p < kp; p++) {
+      int c = c0 + 2 * p;
+      const int16_t* lo = &V(xi, nu, c, j0);
+      const int16_t* hi = c + 1 < C ? lo + V.stride[2] : NULL;
+      int32_t* dst = vp + p * NR;
+      if (hi && cols == NR && V.stride[3] == 1) {
+        S::storep(dst, S::interleave(lo, hi));
+        S::storep(dst + S::width, S::interleave(lo + S::width, hi + S::width));
+        continue;
+      }
+      for (int j = 0; j < NR; j++) {
+        dst[j] = j < cols ? pair(lo[j * V.stride[3]], hi ? hi[j * V.stride[3]] : 0) : 0;
+      }
+    }
+  }
+
+  // Rows k0 .. k0 + nk - 1 (k0 a multiple of MR) and columns j0 .. j0 + np
+  // - 1 of M[xi][nu] = U[xi][nu] * V[xi][nu].
+  static void multiply_block(const Tensor<int16_t>& Up, const Tensor<int16_t>& V,
+                             Tensor<int32_t>& M, int xi, int nu, int k0, int nk, int j0,
+                             int np) {
+    int P2 = pairs(V.dim[2]);
+    alignas(TENSOR_ALIGNMENT) int32_t vp[KC * NR];
+    const int16_t* u = Up.ptr(xi, nu);
+    for (int p0 = 0; p0 < P2; p0 += KC) {
+      int kp = std::min(KC, P2 - p0);
+      for (int j = j0; j < j0 + np; j += NR) {
+        int cols = std::min(NR, j0 + np - j);
+        pack_v(V, xi, nu, 2 * p0, kp, j, cols, vp);
+        for (int k = k0; k < k0 + nk; k += MR) {
+          kernel(kp, u + (k / MR) * Up.stride[2] + (long) p0 * 2 * MR, vp,
+                 &M(xi, nu, k, j), M.stride[2], p0 > 0,
+                 std::min(MR, k0 + nk - k), cols);
+        }
+      }
+    }
+  }
+
+  // Element (k, c) of U[xi][nu], c counting within the group of filter k.
+  static int16_t& packed(Tensor<int16_t>& Up, int xi, int nu, int Kg, int k, int c) {
+    int g = k / Kg;
+    k %= Kg;
+    return Up(xi, nu, g * panels(Kg) + k / MR, c / 2 * 2 * MR + k % MR * 2 + c % 2);
+  }
+
+  // Group g's part of rows k0 .. k0 + nk - 1 and columns j0 .. j0 + np - 1
+  // of M[xi][nu], on views of U, V and M restricted to the group.
+  static void multiply_group_block(const Tensor<int16_t>& Up, const Tensor<int16_t>& V,
+                                   Tensor<int32_t>& M, int xi, int nu, int groups, int g,
+                                   int k0, int nk, int j0, int np) {
+    int Cg = V.dim[2] / groups, Kg = M.dim[2] / groups;
+    Tensor<int16_t> Ug(Up.data + (long) g * panels(Kg) * Up.stride[2], Up.dim[0], Up.dim[1],
+                       panels(Kg), Up.dim[3], Up.stride[0], Up.stride[1], Up.stride[2],
+                       Up.stride[3]);
+    Tensor<int16_t> Vg(V.data + (long) g * Cg * V.stride[2], V.dim[0], V.dim[1], Cg, V.dim[3],
+                       V.stride[0], V.stride[1], V.stride[2], V.stride[3]);
+    Tensor<int32_t> Mg(M.data + (long) g * Kg * M.stride[2], M.dim[0], M.dim[1], Kg, M.dim[3],
+                       M.stride[0], M.stride[1], M.stride[2], M.stride[3]);
+    multiply_block(Ug, Vg, Mg, xi, nu, k0, nk, j0, np);
+  }
+
+  static void multiply_grouped(const Tensor<int16_t>& Up, const Tensor<int16_t>& V,
+                               Tensor<int32_t>& M, int xi, int nu, int groups) {
+    int Kg = M.dim[2] / groups;
+    for (int g = 0; g < groups; g++) {
+      multiply_group_block(Up, V, M, xi, nu, groups, g, 0, Kg, 0, V.dim[3]);
+    }
+  }
+};
+
+// Transform-domain products with U and V stored in bfloat16 and M in
+// float. The factors are widened to float, V as it is packed and U a few
+// panels at a time, for the micro-kernel of BatchedGemm<float>. That
+// beats pairing them for vdpbf16ps, which ran at a quarter of the FMA
+// rate on the Sapphire Rapids Xeon it was measured on, and V still moves
+// at half the bytes of float. U is packed as for BatchedGemm.
+struct Bf16Gemm {
+  typedef BatchedGemm<float> F;
+  typedef Simd<float> S;
+  typedef bfloat16 factor_type;
+  typedef float product_type;
+  typedef bfloat16 T;
+  static const int MR = F::MR;
+  static const int NR = F::NR;
+  static const int KC = F::KC;
+  // panels of U widened at a time: 24 KB of floats with AVX-512.
+  static const int KP = 8;
+
+  static int panels(int K) {
+    return F::panels(K);
+  }
+
+  static int panel_width(int C) {
+    return F::panel_width(C);
+  }
+
+  static T& packed(Tensor<T>& Up, int xi, int nu, int Kg, int k, int c) {
+    int g = k / Kg;
+    k %= Kg;
+    return Up(xi, nu, g * panels(Kg) + k / MR, c * MR + k % MR);
+  }
+
+  // n elements of bfloat16 widened to float.
+  static void widen(const T* src, int n, float* dst) {
+    int e = 0;
+    for (; e + S::width <= n; e += S::width) {
+      S::storeu(dst + e, S::loadb(src + e));
+    }
+    for (; e < n; e++) {
+      dst[e] = src[e];
+    }
+  }
+
+  // As BatchedGemm::pack_v, widening V to float.
+  static void pack_v(const Tensor<T>& V, int xi, int nu, int c0, int kc, int j0, int cols,
+                     float* vp) {
+    for (int c = 0; c < kc; c++) {
+      const T* src = &V(xi, nu, c0 + c, j0);
+      float* dst = vp + c * NR;
+      if (cols == NR && V.stride[3] == 1) {
+        widen(src, NR, dst);
+      } else {
+        for (int j = 0; j < NR; j++) {
+          dst[j] = j < cols ? (float) src[j * V.stride[3]] : 0;
+        }
+      }
+    }
+  }
+
+  // Rows k0 .. k0 + nk - 1 (k0 a multiple of MR) and columns j0 .. j0 + np
+  // - 1 of M[xi][nu] = U[xi][nu] * V[xi][nu].
+  static void multiply_block(const Tensor<T>& Up, const Tensor<T>& V, Tensor<float>& M, int xi,
+                             int nu, int k0, int nk, int j0, int np) {
+    int C = V.dim[2];
+    alignas(TENSOR_ALIGNMENT) float vp[KC * NR];
+    alignas(TENSOR_ALIGNMENT) float up[KP * KC * MR];
+    const T* u = Up.ptr(xi, nu);
+    for (int c0 = 0; c0 < C; c0 += KC) {
+      int kc = std::min(KC, C - c0);
+      for (int kp = k0; kp < k0 + nk; kp += KP * MR) {
+        int kn = std::min(KP * MR, k0 + nk - kp);
+        for (int q = 0; q * MR < kn; q++) {
+          widen(u + (kp / MR + q) * Up.stride[2] + (long) c0 * MR, kc * MR, up + q * KC * MR);
+        }
+        for (int j = j0; j < j0 + np; j += NR) {
+          int cols = std::min(NR, j0 + np - j);
+          pack_v(V, xi, nu, c0, kc, j, cols, vp);
+          for (int q = 0; q * MR < kn; q++) {
+            int k = kp + q * MR;
+            F::kernel(kc, up + q * KC * MR, vp, &M(xi, nu, k, j), M.stride[2], c0 > 0,
+                      std::min(MR, kp + kn - k), cols);
+          }
+        }
+      }
+    }
+  }
+
+  // As in QuantizedGemm.
+  static void multiply_group_block(const Tensor<T>& Up, const Tensor<T>& V, Tensor<float>& M,
+                                   int xi, int nu, int groups, int g, int k0, int nk, int j0,
+                                   int np) {
+    int Cg = V.dim[2] / groups, Kg = M.dim[2] / groups;
+    Tensor<T> Ug(Up.data + (long) g * panels(Kg) * Up.stride[2], Up.dim[0], Up.dim[1],
+                 panels(Kg), Up.dim[3], Up.stride[0], Up.stride[1], Up.stride[2], Up.stride[3]);
+    Tensor<T> Vg(V.data + (long) g * Cg * V.stride[2], V.dim[0], V.dim[1], Cg, V.dim[3],
+                 V.stride[0], V.stride[1], V.stride[2], V.stride[3]);
+    Tensor<float> Mg(M.data + (long) g * Kg * M.stride[2], M.dim[0], M.dim[1], Kg, M.dim[3],
+                     M.stride[0], M.stride[1], M.stride[2], M.stride[3]);
+    multiply_block(Ug, Vg, Mg, xi, nu, k0, nk, j0, np);
+  }
+
+  static void multiply_grouped(const Tensor<T>& Up, const Tensor<T>& V, Tensor<float>& M,
+                               int xi, int nu, int groups) {
+    int Kg = M.dim[2] / groups;
+    for (int g = 0; g < groups; g++) {
+      multiply_group_block(Up, V, M, xi, nu, groups, g, 0, Kg, 0, V.dim[3]);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,112 @@
+#!/usr/bin/python3
+import sys
+import numpy as np
+
+# a network file (see network.h) of L layers of K 3 x 3 filters with "same"
+# padding, biases and ReLU, the first over the C channels of the images.
+# From the third layer on, every second layer adds the output of the layer
+# two before it, as in a residual block. The weights are centred on zero so
+# that the activations stay in range through the stack. A mixed network
+# cycles the filters through 3 x 3, 5 x 5 and 7 x 7 and ends on a stride-2
+# layer without a residual.
+def gen_network(L, K, C, H, W, N=1, mixed=False):
+    layers = []
+    for l in range(1, L + 1):
+        channels = C if l == 1 else K
+        r = (3, 5, 7)[(l - 1) % 3] if mixed else 3
+        stride = 2 if mixed and l == L else 1
+        residual = l - 2 if l >= 3 and l % 2 == 1 and stride == 1 else -1
+        filters = (np.random.rand(K, channels, r, r) - 0.5) / (channels * r * r / 9)
+        bias = np.random.rand(K) - 0.5
+        layers.append((r, stride, residual, filters, bias))
+    return layers, np.random.rand(N, C, H, W)
+
+# Splits a network file into what naive_convolution needs to run its layers
+# one at a time: prefix_l.in holds the header and filters of layer l (its
+# input is appended to it), prefix_l.bias its biases and prefix_0.out the
+# images in the format of an output file. Prints, for every layer, the
+# options of its naive_convolution run and the activation it adds.
+def split_network(filename, prefix):
+    with open(filename) as f:
+        lines = f.read().split("\n")
+    header = lines[0].split()
+    C, H, W = [int(el) for el in header[1:4]]
+    N = header[4] if len(header) > 4 else None
+    tokens = " ".join(lines[1:]).split()
+    pos = 0
+    for l in range(1, int(header[0]) + 1):
+        K, r, stride, dilation, groups = [int(el) for el in tokens[pos:pos + 5]]
+        padding, activation, bias, residual = tokens[pos + 5:pos + 9]
+        pos += 9
+        size = K * (C // groups) * r * r
+        with open("%s_%d.in" % (prefix, l), "w") as f:
+            print(" ".join(str(el) for el in [K, C, H, W] + ([N] if N else [])), file=f)
+            print(" ".join(tokens[pos:pos + size]), file=f)
+        pos += size
+        options = "-r %d -s %d -d %d -g %d -p %s -a %s" % (r, stride, dilation, groups, padding,
+                                                            activation)
+        if bias == "1":
+            with open("%s_%d.bias" % (prefix, l), "w") as f:
+                print(" ".join(tokens[pos:pos + K]), file=f)
+            pos += K
+            options += " -B %s_%d.bias" % (prefix, l)
+        if int(residual) >= 0:
+            options += " -R %s_%s.out" % (prefix, residual)
+        print(options)
+        extent = dilation * (r - 1) + 1
+        pad = (extent - 1) // 2 if padding == "same" else 0 if padding == "valid" else int(padding)
+        C, H, W = K, (H + 2 * pad - extent) // stride + 1, (W + 2 * pad - extent) // stride + 1
+    with open("%s_0.out" % prefix, "w") as f:
+        print(lines[0], file=f)
+        print(" ".join(tokens[pos:]), file=f)
+
+if __name__ == "__main__":
+    L = 4
+    K = 4
+    C = 3
+    H = 10
+    W = 10
+    N = 1
+    if (len(sys.argv) == 4 and sys.argv[1] == "--layers"):
+        split_network(sys.argv[2], sys.argv[3])
+        sys.exit()
+    mixed = "--mixed" in sys.argv
+    if (mixed):
+        sys.argv.remove("--mixed")
+    argc = len(sys.argv)
+    if (argc != 1 and argc != 6 and argc != 7):
+        print("".join(["Usage: [python gen_network.py] to use default values, or ",
+            "[python gen_network.py [--mixed] L K C H W [N]] to specify number of layers, number of filters ",
+            "per layer, number of channels, height, width and (optionally) the number of images ",
+            "in the batch respectively; --mixed cycles the filter sizes and ends on a stride-2 layer. ",
+            "[python gen_network.py --layers <network file> <prefix>] splits a network into the ",
+            "layers of naive_convolution runs"]))
+        sys.exit()
+    if (argc >= 6):
+        L, K, C, H, W = tuple([int(el) for el in sys.argv[1:6]])
+    if (argc == 7):
+        N = int(sys.argv[6])
+    layers, data = gen_network(L, K, C, H, W, N, mixed)
+    # as in gen_problem.py, the batch size is only written for batches.
+    if (N == 1):
+        print(L, C, H, W)
+    else:
+        print(L, C, H, W, N)
+    for r, stride, residual, filters, bias in layers:
+        print(K, r, stride, 1, 1, "same", "relu", 1, residual)
+        for _filter in filters:
+            for channel in _filter:
+                for row in channel:
+                    print(" ".join([str(el) for el in row]))
+                print("")
+            print("\n")
+        print(" ".join([str(el) for el in bias]))
+        print("\n")
+
+    print("\n\n")
+
+    for image in data:
+        for channel in image:
+            for row in channel:
+                print(" ".join([str(el) for el in row]))
+            print("\n")
@@ -3,30 +3,60 @@ import sys
 import math
 import numpy as np
 
-def gen_problem(K, C, H, W):
+# in a grouped convolution every filter only spans the C / groups channels
+# of its group. The filters are r x r, or r_h x r_w if r_w is given. A
+# problem for the backward-data pass (winograd -b) holds the N x K channels
+# of a gradient of the output instead of N x C image channels.
+def gen_problem(K, C, H, W, N=1, groups=1, r=3, r_w=None, backward=False):
     filters = []
     for i in range(K):
         current_filter = []
         filters.append(current_filter)
-        for j in range(C):
-            current_filter.append(np.random.rand(3, 3))
-    return filters, np.random.rand(C, H, W)
+        for j in range(C // groups):
+            current_filter.append(np.random.rand(r, r if r_w is None else r_w))
+    return filters, np.random.rand(N, K if backward else C, H, W)
 
 if __name__ == "__main__":
     K = 2
     C = 3
     H = 10
     W = 10
+    N = 1
+    groups = 1
+    r = 3
+    r_w = None
+    backward = "--backward" in sys.argv
+    if (backward):
+        sys.argv.remove("--backward")
     argc = len(sys.argv)
-    if (argc != 1 and argc != 5):
+    if (argc != 1 and argc != 5 and argc != 6 and argc != 7 and argc != 8):
         print("".join(["Usage: [python gen_problem.py] to use default values, or ",
-            "[python gen_problem.py K C H W] to specify number of filters, number of channels, ",
-            "height, and width respectively"]))
+            "[python gen_problem.py [--backward] K C H W [N [groups [r]]]] to specify number of filters, number of channels, ",
+            "height, width and (optionally) the number of images in the batch, the number of ",
+            "filter groups and the filter size (r, or r_h x r_w such as 1x3) respectively. ",
+            "--backward writes N x K gradient channels for winograd -b instead of the images"]))
         sys.exit()
-    if (argc == 5):
-        K, C, H, W = tuple([int(el) for el in sys.argv[1:]])
-    filters, data = gen_problem(K, C, H, W)
-    print(K, C, H, W)
+    if (argc >= 5):
+        K, C, H, W = tuple([int(el) for el in sys.argv[1:5]])
+    if (argc >= 6):
+        N = int(sys.argv[5])
+    if (argc >= 7):
+        groups = int(sys.argv[6])
+        if (K % groups != 0 or C % groups != 0):
+            print("The number of groups must divide both K and C")
+            sys.exit()
+    if (argc == 8):
+        if ("x" in sys.argv[7]):
+            r, r_w = tuple([int(el) for el in sys.argv[7].split("x")])
+        else:
+            r = int(sys.argv[7])
+    filters, data = gen_problem(K, C, H, W, N, groups, r, r_w, backward)
+    # the batch size is only written for batches, so single images keep the
+    # "K C H W" header every program reads.
+    if (N == 1):
+        print(K, C, H, W)
+    else:
+        print(K, C, H, W, N)
     for _filter in filters:
         for channel in _filter:
             for row in channel:
@@ -36,8 +66,9 @@ if __name__ == "__main__":
 
     print("\n\n")
 
-    for channel in data:
-        for row in channel:
-            print(" ".join([str(el) for el in row]))
-        print("\n")
+    for image in data:
+        for channel in image:
+            for row in channel:
+                print(" ".join([str(el) for el in row]))
+            print("\n")
 
@@ -0,0 +1,50 @@
+#!/usr/bin/python3
+import sys
+import numpy as np
+
+# a volume problem for winograd_3d: K filters of C channels of 3 x 3 x 3
+# and N volumes of C channels of D x H x W.
+def gen_volume(K, C, D, H, W, N=1):
+    filters = np.random.rand(K, C, 3, 3, 3)
+    return filters, np.random.rand(N, C, D, H, W)
+
+if __name__ == "__main__":
+    K = 2
+    C = 3
+    D = 10
+    H = 10
+    W = 10
+    N = 1
+    argc = len(sys.argv)
+    if (argc != 1 and argc != 6 and argc != 7):
+        print("".join(["Usage: [python gen_volume.py] to use default values, or ",
+            "[python gen_volume.py K C D H W [N]] to specify number of filters, number of channels, ",
+            "depth, height, width and (optionally) the number of volumes in the batch respectively"]))
+        sys.exit()
+    if (argc >= 6):
+        K, C, D, H, W = tuple([int(el) for el in sys.argv[1:6]])
+    if (argc == 7):
+        N = int(sys.argv[6])
+    filters, data = gen_volume(K, C, D, H, W, N)
+    # as in gen_problem.py, the batch size is only written for batches.
+    if (N == 1):
+        print(K, C, D, H, W)
+    else:
+        print(K, C, D, H, W, N)
+    for _filter in filters:
+        for channel in _filter:
+            for plane in channel:
+                for row in plane:
+                    print(" ".join([str(el) for el in row]))
+                print("")
+            print("\n")
+
+    print("\n\n")
+
+    for volume in data:
+        for channel in volume:
+            for plane in channel:
+                for row in plane:
+                    print(" ".join([str(el) for el in row]))
+                print("")
+            print("\n")
@@ -1,12 +1,18 @@
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
 #include <sys/time.h>
+#include <unistd.h>
 
 using namespace std;
 
 double timestamp();
-void report_naive_statistics(int K, int C, int H, int W, double time);
+void report_naive_statistics(int N, int K, int C, int r_d, int r_h, int r_w, int out_D,
+                             int out_H, int out_W, double time);
 
 void print_filter(float* filter) {
   for (int i = 0; i < 3; i++) {
@@ -21,38 +27,181 @@ void print_filter(float* filter) {
 void print_image(float* image, int H, int W) {
   for (int i = 0; i < H; i++) {
     for (int j = 0; j < W; j++) {
-      cout << setw(10) << image[i*H+j];
+      cout << setw(10) << image[i*W+j];
     }
     cout << endl;
   }
   cout << endl;
 }
 
-void convolution_helper(float* &in, float* &filter, float* &out, int height, int width) {
-  float sum;
-  for (int i = 1; i < height-1; i++) {
-    for (int j = 1; j < width-1; j++) {
-      for (int ii = i-1; ii <= i+1; ii++) {
-        for (int jj = j-1; jj <= j+1; jj++) {
-          out[i*height+j] += in[ii*height+jj] * filter[(ii-i+1)*3+jj-j+1];
+// out (out_H x out_W) += in (height x width) correlated with the r_h x r_w
+// filter, dilated by dilation, at every stride-th pixel, where in is
+// zero-padded by pad_h rows and pad_w columns on each side.
+void convolution_helper(float* &in, float* &filter, float* &out, int height, int width,
+                        int out_H, int out_W, int r_h, int r_w, int pad_h, int pad_w,
+                        int stride, int dilation) {
+  for (int i = 0; i < out_H; i++) {
+    for (int j = 0; j < out_W; j++) {
+      for (int ii = 0; ii < r_h; ii++) {
+        for (int jj = 0; jj < r_w; jj++) {
+          int y = i*stride + ii*dilation - pad_h, x = j*stride + jj*dilation - pad_w;
+          if (y >= 0 && y < height && x >= 0 && x < width) {
+            out[i*out_W+j] += in[y*width+x] * filter[ii*r_w+jj];
+          }
         }
       }
     }
   }
 }
 
+// out (out_H x out_W) += in (height x width) scattered through the r_h x
+// r_w filter, dilated by dilation: pixel (i, j) of in lands on
+// (i * stride, j * stride) of the zero-padded out, whose pad_h rows and
+// pad_w columns of padding are cropped. This is the transposed correlation
+// of convolution_helper.
+void transposed_convolution_helper(float* &in, float* &filter, float* &out, int height,
+                                   int width, int out_H, int out_W, int r_h, int r_w,
+                                   int pad_h, int pad_w, int stride, int dilation) {
+  for (int i = 0; i < height; i++) {
+    for (int j = 0; j < width; j++) {
+      for (int ii = 0; ii < r_h; ii++) {
+        for (int jj = 0; jj < r_w; jj++) {
+          int y = i*stride + ii*dilation - pad_h, x = j*stride + jj*dilation - pad_w;
+          if (y >= 0 && y < out_H && x >= 0 && x < out_W) {
+            out[y*out_W+x] += in[i*width+j] * filter[ii*r_w+jj];
+          }
+        }
+      }
+    }
+  }
+}
+
+// filter (r_h x r_w) += the correlation of in (height x width, zero-padded
+// by pad_h rows and pad_w columns) with grad (out_H x out_W): the gradient
+// of each filter tap collects every input pixel it multiplied in
+// convolution_helper, weighted by the gradient of the output it reached.
+void filter_gradient_helper(float* &in, float* &grad, float* &filter, int height, int width,
+                            int out_H, int out_W, int r_h, int r_w, int pad_h, int pad_w,
+                            int stride, int dilation) {
+  for (int ii = 0; ii < r_h; ii++) {
+    for (int jj = 0; jj < r_w; jj++) {
+      for (int i = 0; i < out_H; i++) {
+        for (int j = 0; j < out_W; j++) {
+          int y = i*stride + ii*dilation - pad_h, x = j*stride + jj*dilation - pad_w;
+          if (y >= 0 && y < height && x >= 0 && x < width) {
+            filter[ii*r_w+jj] += in[y*width+x] * grad[i*out_W+j];
+          }
+        }
+      }
+    }
+  }
+}
+
+// data holds plane z of channel c of image n at (n * C + c) * D + z, and
+// plane z of output channel k of it at (n * K + k) * out_D + z; images
+// have D = 1 plane and filters r_d = 1, volumes more. Plane z of the output
+// sums the planes of the input the r_d planes of the filter reach, each
+// correlated in 2-D. Filter k only spans the C / groups channels of its
+// group.
 void convolution(float** &data, float*** &filters, float** &output,
-          int K, int C, int H, int W) {
+          int N, int K, int C, int D, int H, int W, int out_D, int out_H, int out_W,
+          int r_d, int r_h, int r_w, int pad_d, int pad_h, int pad_w, int stride,
+          int dilation, int groups) {
   double time = timestamp();
 
-  for (int c = 0; c < C; c++) {
+  int Kg = K / groups, Cg = C / groups;
+  for (int n = 0; n < N; n++) {
     for (int k = 0; k < K; k++) {
-      convolution_helper(data[c], filters[k][c], output[k], H, W);
+      for (int c = 0; c < Cg; c++) {
+        for (int z = 0; z < out_D; z++) {
+          for (int zz = 0; zz < r_d; zz++) {
+            int plane = z*stride + zz*dilation - pad_d;
+            if (plane >= 0 && plane < D) {
+              convolution_helper(data[(n*C+(k/Kg)*Cg+c)*D+plane], filters[k][c*r_d+zz],
+                                 output[(n*K+k)*out_D+z], H, W, out_H, out_W, r_h, r_w,
+                                 pad_h, pad_w, stride, dilation);
+            }
+          }
+        }
+      }
     }
   }
 
   time = timestamp() - time;
-  report_naive_statistics(K, C, H, W, time);
+  report_naive_statistics(N, K, Cg, r_d, r_h, r_w, out_D, out_H, out_W, time);
+}
+
+// The backward-data pass (transposed convolution) of convolution: data
+// holds the N x K channels of a gradient of the output, and channel c of
+// the output of image n, at n * C + c, receives every channel k whose
+// filter spans c.
+void convolution_backward_data(float** &data, float*** &filters, float** &output,
+          int N, int K, int C, int H, int W, int out_H, int out_W, int r_h, int r_w,
+          int pad_h, int pad_w, int stride, int dilation, int groups) {
+  double time = timestamp();
+
+  int Kg = K / groups, Cg = C / groups;
+  for (int n = 0; n < N; n++) {
+    for (int k = 0; k < K; k++) {
+      for (int c = 0; c < Cg; c++) {
+        transposed_convolution_helper(data[n*K+k], filters[k][c], output[n*C+(k/Kg)*Cg+c], H,
+                                      W, out_H, out_W, r_h, r_w, pad_h, pad_w, stride,
+                                      dilation);
+      }
+    }
+  }
+
+  time = timestamp() - time;
+  report_naive_statistics(N, K, Cg, 1, r_h, r_w, 1, H, W, time);
+}
+
+// The backward-filter (weight gradient) pass of convolution: grad holds
+// the N x K channels of a gradient of the output, and grad_filters[k][c]
+// sums the gradients of filter k's channel c over the N images.
+void convolution_backward_filter(float** &data, float** &grad, float*** &grad_filters,
+          int N, int K, int C, int H, int W, int out_H, int out_W, int r_h, int r_w,
+          int pad_h, int pad_w, int stride, int dilation, int groups) {
+  double time = timestamp();
+
+  int Kg = K / groups, Cg = C / groups;
+  for (int n = 0; n < N; n++) {
+    for (int k = 0; k < K; k++) {
+      for (int c = 0; c < Cg; c++) {
+        filter_gradient_helper(data[n*C+(k/Kg)*Cg+c], grad[n*K+k], grad_filters[k][c], H, W,
+                               out_H, out_W, r_h, r_w, pad_h, pad_w, stride, dilation);
+      }
+    }
+  }
+
+  time = timestamp() - time;
+  report_naive_statistics(N, K, Cg, 1, r_h, r_w, 1, out_H, out_W, time);
+}
+
+// The epilogue of a layer, as a separate pass over the finished output:
+// y = activation(y + bias[c] + residual) on every value of output channel
+// c, whose out_D planes follow each other. activation is none, relu,
+// relu6 or leaky (max(y, slope * y)).
+void apply_epilogue(float** &output, float* bias, float** residual, const char* activation,
+                    double slope, int planes, int out_C, int out_D, int size) {
+  for (int k = 0; k < planes; k++) {
+    for (int i = 0; i < size; i++) {
+      float y = output[k][i];
+      if (bias) {
+        y += bias[k / out_D % out_C];
+      }
+      if (residual) {
+        y += residual[k][i];
+      }
+      if (strcmp(activation, "relu") == 0) {
+        y = y > 0 ? y : 0;
+      } else if (strcmp(activation, "relu6") == 0) {
+        y = y > 0 ? (y < 6 ? y : 6) : 0;
+      } else if (strcmp(activation, "leaky") == 0) {
+        y = y > slope * y ? y : slope * y;
+      }
+      output[k][i] = y;
+    }
+  }
 }
 
 double timestamp()
@@ -62,91 +211,301 @@ double timestamp()
   return tv.tv_sec + 1e-6*tv.tv_usec;
 }
 
-void report_naive_statistics(int K, int C, int H, int W, double time) {
-  int flop = (K * C * H * W * 3 * 3 * 2);
+void report_naive_statistics(int N, int K, int C, int r_d, int r_h, int r_w, int out_D,
+                             int out_H, int out_W, double time) {
+  long flop = ((long) N * K * C * out_D * out_H * out_W * r_d * r_h * r_w * 2);
   double mflops = flop / (1024.0 * 1024.0 * time);
   cout << "Floating point operations: " << flop << "\n";
   cout << "Time Elapsed: " << time << "\n";
   cout << "MFlop/s: " << mflops << "\n";
 }
 
-int main(int argc, char const *argv[])
+int main(int argc, char *argv[])
 {
-  if (argc != 3) {
-    cout << "Usage: ./naive_convolution <input filename> <output filename>\n";
+  // -p zero-pads the image as in the Winograd programs (valid, same or a
+  // width), -r sets the filter size (r, or r_h x r_w such as 1x3), -s the
+  // stride, -d the dilation and -g the number of groups. The filters of a
+  // 1-D layer (1 x r or r x 1) are only padded along their length, as in
+  // winograd_1d. -v reads a volume problem of gen_volume.py instead, with
+  // r x r x r filters, as winograd_3d does. -b runs the backward-data pass
+  // (a transposed convolution) of the convolution the other options
+  // describe, as in winograd: the input then holds N x K channels and the
+  // output N x C, enlarged by -o extra rows and columns. -w runs the
+  // backward-filter pass instead: it reads the gradient of the output from
+  // the second file, in the format of an output file, and writes the
+  // gradient of the filters to a third. -a, -B and -R apply the epilogue
+  // of winograd to the forward or backward-data output: an activation
+  // (none, relu, relu6 or leaky[:slope]), a bias file of one value per
+  // output channel and a residual file in the format of an output file.
+  const char* pad_arg = "valid";
+  const char* r_arg = "3";
+  int stride = 1;
+  int dilation = 1;
+  int groups = 1;
+  bool volume = false;
+  bool backward = false;
+  int output_padding = 0;
+  bool weights = false;
+  char activation[16] = "none";
+  double slope = 0.01;
+  const char* bias_filename = NULL;
+  const char* residual_filename = NULL;
+  bool bad_usage = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:r:s:d:g:vbo:wa:B:R:")) != -1) {
+    switch (opt) {
+      case 'p': pad_arg = optarg; break;
+      case 'r': r_arg = optarg; break;
+      case 's': stride = atoi(optarg); break;
+      case 'd': dilation = atoi(optarg); break;
+      case 'g': groups = atoi(optarg); break;
+      case 'v': volume = true; break;
+      case 'b': backward = true; break;
+      case 'o': output_padding = atoi(optarg); break;
+      case 'w': weights = true; break;
+      case 'a':
+        // leaky takes an optional slope, as in leaky:0.1.
+        strncpy(activation, optarg, sizeof(activation) - 1);
+        if (strchr(activation, ':')) {
+          slope = atof(strchr(activation, ':') + 1);
+          *strchr(activation, ':') = '\0';
+        }
+        break;
+      case 'B': bias_filename = optarg; break;
+      case 'R': residual_filename = optarg; break;
+      default: bad_usage = true;
+    }
+  }
+  int r_h = atoi(r_arg), r_w = r_h;
+  if (strchr(r_arg, 'x')) {
+    r_w = atoi(strchr(r_arg, 'x') + 1);
+  }
+  int r_d = volume ? r_h : 1;
+  // the dilated filter spans extent_d x extent_h x extent_w pixels.
+  int extent_d = dilation * (r_d - 1) + 1;
+  int extent_h = dilation * (r_h - 1) + 1, extent_w = dilation * (r_w - 1) + 1;
+  int pad_d = 0, pad_h = 0, pad_w = 0;
+  if (strcmp(pad_arg, "same") == 0) {
+    pad_d = (extent_d - 1) / 2;
+    pad_h = (extent_h - 1) / 2;
+    pad_w = (extent_w - 1) / 2;
+  } else if (strcmp(pad_arg, "valid") != 0) {
+    pad_d = r_d > 1 ? atoi(pad_arg) : 0;
+    pad_h = r_h > 1 ? atoi(pad_arg) : 0;
+    pad_w = r_w > 1 ? atoi(pad_arg) : 0;
+  }
+  if (bad_usage || argc - optind != (weights ? 3 : 2) || pad_d < 0 || pad_h < 0 || pad_w < 0 ||
+      r_h < 1 || r_w < 1 || stride < 1 || dilation < 1 || volume + backward + weights > 1 ||
+      output_padding < 0 || (strcmp(activation, "none") != 0 && strcmp(activation, "relu") != 0 &&
+      strcmp(activation, "relu6") != 0 && strcmp(activation, "leaky") != 0) ||
+      (weights && (strcmp(activation, "none") != 0 || bias_filename || residual_filename))) {
+    cout << "Usage: ./naive_convolution [-p valid|same|padding] [-r filter size] [-s stride] [-d dilation] [-g groups] [-v | -b [-o output padding]] [-a none|relu|relu6|leaky[:slope]] [-B bias file] [-R residual file] <input filename> <output filename>\n";
+    cout << "       ./naive_convolution -w [-p valid|same|padding] [-r filter size] [-s stride] [-d dilation] [-g groups] <input filename> <output gradient filename> <filter gradient filename>\n";
     return 1;
   }
   ifstream file;
-  file.open(argv[1]);
+  file.open(argv[optind]);
 
-  int K, C, H, W;
-  file >> K >> C >> H >> W;
+  // the header is "K C H W", or "K C H W N" for a batch of N images; with
+  // -v it is "K C D H W [N]".
+  int K, C, D = 1, H, W, N = 1;
+  string header;
+  getline(file, header);
+  istringstream header_fields(header);
+  header_fields >> K >> C;
+  if (volume) {
+    header_fields >> D;
+  }
+  header_fields >> H >> W;
+  if (!(header_fields >> N)) {
+    N = 1;
+  }
+  if (groups < 1 || K % groups != 0 || C % groups != 0) {
+    cout << "Error: The number of groups must divide both K and C." << endl;
+    return 1;
+  }
 
-  // Read in data for filters
+  // Read in data for filters, C / groups channels of r_d planes each
   float ***filters = new float**[K];
   for (int i = 0; i < K; i++) {
-    filters[i] = new float*[C];
-    for (int j = 0; j < C; j++) {
-      filters[i][j] = new float[9];
-      for (int m = 0; m < 3; m++) {
-        for (int n = 0; n < 3; n++) {
-          file >> filters[i][j][m*3+n];
+    filters[i] = new float*[C/groups*r_d];
+    for (int j = 0; j < C/groups*r_d; j++) {
+      filters[i][j] = new float[r_h*r_w];
+      for (int m = 0; m < r_h; m++) {
+        for (int n = 0; n < r_w; n++) {
+          file >> filters[i][j][m*r_w+n];
         }
       }
     }
   }
 
-  // Read in data for image
-  float **data = new float*[C];
-  for (int c = 0; c < C; c++) {
+  // Read in data for images; the backward-data pass reads the K channels
+  // of a gradient of the output instead.
+  int in_C = backward ? K : C, out_C = backward ? C : K;
+  float **data = new float*[N*in_C*D];
+  for (int c = 0; c < N*in_C*D; c++) {
     data[c] = new float[H*W]();
     for (int m = 0; m < H; m++) {
       for (int n = 0; n < W; n++) {
-        file >> data[c][m*H+n];
+        file >> data[c][m*W+n];
       }
     }
   }
   file.close();
 
   // Create empty output object
-  float **output = new float*[K];
-  for (int k = 0; k < K; k++) {
-    output[k] = new float[H*W]();  
+  int out_D = (D + 2*pad_d - extent_d) / stride + 1;
+  int out_H = (H + 2*pad_h - extent_h) / stride + 1, out_W = (W + 2*pad_w - extent_w) / stride + 1;
+  if (backward) {
+    out_H = (H - 1)*stride - 2*pad_h + extent_h + output_padding;
+    out_W = (W - 1)*stride - 2*pad_w + extent_w + output_padding;
+  }
+  float **output = new float*[N*out_C*out_D];
+  for (int k = 0; k < N*out_C*out_D; k++) {
+    output[k] = new float[out_H*out_W]();
   }
 
   // Run the data
-  convolution(data, filters, output, K, C, H, W);
+  if (weights) {
+    // the gradient of the output comes in the format of an output file.
+    float **grad = new float*[N*K];
+    file.open(argv[optind+1]);
+    getline(file, header);
+    for (int k = 0; k < N*K; k++) {
+      grad[k] = new float[out_H*out_W];
+      for (int i = 0; i < out_H*out_W; i++) {
+        file >> grad[k][i];
+      }
+    }
+    file.close();
 
-  // Print the output to file
-  ofstream fileout;
-  fileout.open(argv[2], ofstream::out | ofstream::trunc );
-  fileout << K << " " << C << " " << H-2 << " " << W-2 << " " << endl;
-  for (int k = 0; k < K; k++) {
-    for (int i = 1; i < H-1; i++) {
-      for (int j = 1; j < W-1; j++) {
-        fileout << setw(6) << setprecision(4) << output[k][i*H+j] << " ";
+    float ***grad_filters = new float**[K];
+    for (int i = 0; i < K; i++) {
+      grad_filters[i] = new float*[C/groups];
+      for (int j = 0; j < C/groups; j++) {
+        grad_filters[i][j] = new float[r_h*r_w]();
       }
-      fileout << endl;
+    }
+    convolution_backward_filter(data, grad, grad_filters, N, K, C, H, W, out_H, out_W, r_h,
+                                r_w, pad_h, pad_w, stride, dilation, groups);
+
+    // K x (C / groups) filter slices, under the header of the input.
+    ofstream fileout;
+    fileout.open(argv[optind+2], ofstream::out | ofstream::trunc );
+    fileout << K << " " << C << " " << H << " " << W;
+    if (N > 1) {
+      fileout << " " << N;
+    }
+    fileout << endl;
+    for (int i = 0; i < K; i++) {
+      for (int j = 0; j < C/groups; j++) {
+        for (int m = 0; m < r_h; m++) {
+          for (int n = 0; n < r_w; n++) {
+            fileout << setw(10) << setprecision(6) << grad_filters[i][j][m*r_w+n] << " ";
+          }
+          fileout << endl;
+        }
+        fileout << endl;
+      }
+    }
+    fileout.close();
+
+    for (int i = 0; i < K; i++) {
+      for (int j = 0; j < C/groups; j++) {
+        delete [] grad_filters[i][j];
+      }
+      delete [] grad_filters[i];
+    }
+    delete [] grad_filters;
+    for (int k = 0; k < N*K; k++) {
+      delete [] grad[k];
+    }
+    delete [] grad;
+  } else if (backward) {
+    convolution_backward_data(data, filters, output, N, K, C, H, W, out_H, out_W, r_h, r_w,
+                              pad_h, pad_w, stride, dilation, groups);
+  } else {
+    convolution(data, filters, output, N, K, C, D, H, W, out_D, out_H, out_W, r_d, r_h, r_w,
+                pad_d, pad_h, pad_w, stride, dilation, groups);
+  }
+
+  if (!weights) {
+    float *bias = NULL;
+    if (bias_filename) {
+      bias = new float[out_C];
+      file.open(bias_filename);
+      for (int c = 0; c < out_C; c++) {
+        file >> bias[c];
+      }
+      file.close();
+    }
+    // the residual comes in the format of an output file.
+    float **residual = NULL;
+    if (residual_filename) {
+      residual = new float*[N*out_C*out_D];
+      file.open(residual_filename);
+      getline(file, header);
+      for (int k = 0; k < N*out_C*out_D; k++) {
+        residual[k] = new float[out_H*out_W];
+        for (int i = 0; i < out_H*out_W; i++) {
+          file >> residual[k][i];
+        }
+      }
+      file.close();
+    }
+    apply_epilogue(output, bias, residual, activation, slope, N*out_C*out_D, out_C, out_D,
+                   out_H*out_W);
+    delete [] bias;
+    if (residual) {
+      for (int k = 0; k < N*out_C*out_D; k++) {
+        delete [] residual[k];
+      }
+      delete [] residual;
+    }
+  }
+
+  // Print the output to file, under the header of the input as the engines
+  // do; the backward-filter pass wrote its gradient above and reads the
+  // second file.
+  if (!weights) {
+    ofstream fileout;
+    fileout.open(argv[optind+1], ofstream::out | ofstream::trunc );
+    fileout << K << " " << C << " ";
+    if (volume) {
+      fileout << D << " ";
+    }
+    fileout << H << " " << W;
+    if (N > 1) {
+      fileout << " " << N;
     }
     fileout << endl;
+    for (int k = 0; k < N*out_C*out_D; k++) {
+      for (int i = 0; i < out_H; i++) {
+        for (int j = 0; j < out_W; j++) {
+          fileout << setw(10) << setprecision(6) << output[k][i*out_W+j] << " ";
+        }
+        fileout << endl;
+      }
+      fileout << endl;
+    }
+    fileout.close();
   }
-  fileout.close();
 
   // Cleanup
   for (int i = 0; i < K; i++) {
-    for (int j = 0; j < C; j++) {
+    for (int j = 0; j < C/groups*r_d; j++) {
       delete [] filters[i][j];
     }
     delete [] filters[i];
   }
   delete [] filters;
 
-  for (int c = 0; c < C; c++) {
+  for (int c = 0; c < N*in_C*D; c++) {
     delete [] data[c];
   }
   delete [] data;
 
-  for (int k = 0; k < K; k++) {
+  for (int k = 0; k < N*out_C*out_D; k++) {
     delete [] output[k];
   }
   delete [] output;
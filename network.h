@@ -0,0 +1,144 @@
+#ifndef __NETWORK_H
+#define __NETWORK_H
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "winograd.h"
+
+// A network file describes a stack of convolution layers that an engine
+// runs back to back on a batch of images (see gen_network.py):
+//
+//   L C H W [N]
+//   K r stride dilation groups padding activation bias residual
+//   <the K x (C / groups) r x r filters of the layer, and K biases if bias is 1>
+//   ... (L layers)
+//   <the N x C input images of H x W, as in a problem file>
+//
+// padding and activation take the values of -p and -a. Every layer reads
+// the output of the one before it (the images for the first), so its C, H
+// and W are implied. residual names an earlier activation to add to the
+// output before the activation function: 0 for the input images, l for
+// the output of layer l, -1 for none. It must have the shape of the output.
+
+struct NetworkLayer {
+  // input channels and size, and the output size.
+  int K, C, H, W;
+  int out_H, out_W;
+  int r, stride, dilation, groups, pad;
+  Activation activation;
+  double slope;
+  int residual;
+  // filters[((k * (C / groups) + c) * r + row) * r + col]; bias is empty
+  // when the layer has none.
+  std::vector<double> filters;
+  std::vector<double> bias;
+};
+
+struct Network {
+  int N, C, H, W;
+  std::vector<NetworkLayer> layers;
+
+  // The shape of activation l: 0 is the input, l the output of layer l.
+  int channels(int l) const { return l == 0 ? C : layers[l - 1].K; }
+  int height(int l) const { return l == 0 ? H : layers[l - 1].out_H; }
+  int width(int l) const { return l == 0 ? W : layers[l - 1].out_W; }
+
+  // The last layer that reads activation l, as its input or residual; the
+  // output of the network is read by none and gets L + 1. Engines recycle
+  // the buffer of activation l once layer last_use(l) has run.
+  int last_use(int l) const {
+    int last = l + 1;
+    for (int i = l + 1; i < (int) layers.size(); i++) {
+      if (layers[i].residual == l) {
+        last = i + 1;
+      }
+    }
+    return last;
+  }
+};
+
+// Reads the header and layers of a network file, leaving file at the input
+// images. Prints what is wrong and returns false on a malformed network.
+inline bool read_network(std::istream& file, Network& net) {
+  using std::cout;
+  using std::endl;
+  int L;
+  std::string header;
+  getline(file, header);
+  std::istringstream header_fields(header);
+  if (!(header_fields >> L >> net.C >> net.H >> net.W) || L < 1) {
+    cout << "Error: Network header must be \"L C H W [N]\" with at least one layer." << endl;
+    return false;
+  }
+  if (!(header_fields >> net.N)) {
+    net.N = 1;
+  }
+  net.layers.resize(L);
+  for (int l = 0; l < L; l++) {
+    NetworkLayer& layer = net.layers[l];
+    std::string pad_arg, activation_arg;
+    int has_bias;
+    layer.C = net.channels(l);
+    layer.H = net.height(l);
+    layer.W = net.width(l);
+    layer.slope = 0.01;
+    if (!(file >> layer.K >> layer.r >> layer.stride >> layer.dilation >> layer.groups >>
+          pad_arg >> activation_arg >> has_bias >> layer.residual)) {
+      cout << "Error: Layer " << l + 1 << " is missing." << endl;
+      return false;
+    }
+    int extent = layer.dilation * (layer.r - 1) + 1;
+    if (!parse_padding(pad_arg.c_str(), extent, layer.pad) ||
+        !parse_activation(activation_arg.c_str(), layer.activation, layer.slope) ||
+        (has_bias != 0 && has_bias != 1)) {
+      cout << "Error: Layer " << l + 1 << " has a bad padding, activation or bias flag." << endl;
+      return false;
+    }
+    if ((layer.r != 3 && layer.r != 5 && layer.r != 7) ||
+        (layer.stride != 1 && layer.stride != 2) || layer.dilation < 1 ||
+        (layer.dilation > 1 && layer.stride > 1)) {
+      cout << "Error: Layer " << l + 1 << " needs a filter size of 3, 5 or 7, a stride of 1 "
+           << "or 2 and a dilation of at least 1, and 1 with stride 2." << endl;
+      return false;
+    }
+    if (layer.K < 1 || layer.groups < 1 || layer.K % layer.groups != 0 ||
+        layer.C % layer.groups != 0) {
+      cout << "Error: The number of groups of layer " << l + 1
+           << " must divide both its K and C." << endl;
+      return false;
+    }
+    if (layer.H + 2 * layer.pad < extent || layer.W + 2 * layer.pad < extent) {
+      cout << "Error: The padded input of layer " << l + 1 << " is smaller than its filter."
+           << endl;
+      return false;
+    }
+    layer.out_H = (layer.H + 2 * layer.pad - extent) / layer.stride + 1;
+    layer.out_W = (layer.W + 2 * layer.pad - extent) / layer.stride + 1;
+    int j = layer.residual;
+    if (j < -1 || j > l ||
+        (j >= 0 && (net.channels(j) != layer.K || net.height(j) != layer.out_H ||
+                    net.width(j) != layer.out_W))) {
+      cout << "Error: The residual of layer " << l + 1
+           << " must be an earlier activation of the shape of its output." << endl;
+      return false;
+    }
+
+    layer.filters.resize((size_t) layer.K * (layer.C / layer.groups) * layer.r * layer.r);
+    for (size_t i = 0; i < layer.filters.size(); i++) {
+      file >> layer.filters[i];
+    }
+    layer.bias.resize(has_bias ? layer.K : 0);
+    for (size_t i = 0; i < layer.bias.size(); i++) {
+      file >> layer.bias[i];
+    }
+    if (!file) {
+      cout << "Error: The filters of layer " << l + 1 << " are cut short." << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+#endif
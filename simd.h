@@ -0,0 +1,529 @@
+#ifndef __SIMD_H
+#define __SIMD_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__AVX512F__) || defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+// An IEEE binary16 value, kept as its bits. U, V and M can be stored in it
+// to halve the memory traffic of the transform domain; all arithmetic on it
+// is done in float (see Arithmetic below), converting with F16C where the
+// compiler targets it and bit by bit otherwise. Conversions round to
+// nearest even.
+struct half {
+  uint16_t bits;
+
+  half() = default;
+  explicit half(float f) : bits(from_float(f)) {}
+  operator float() const { return to_float(bits); }
+
+  static uint16_t from_float(float f) {
+#if defined(__F16C__)
+    return _cvtss_sh(f, 0);
+#else
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t abs = x & 0x7fffffff;
+    if (abs >= 0x7f800000) {
+      // infinity stays infinity, NaN stays a (quiet) NaN.
+      return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+    }
+    if (abs >= 0x477ff000) {
+      // rounds to a magnitude of 65520 or more.
+      return sign | 0x7c00;
+    }
+    if (abs < 0x38800000) {
+      // a subnormal half (or zero): shift the significand, with its
+      // implicit bit, into place and round.
+      if (abs < 0x33000000) {
+        return sign;
+      }
+      int shift = 126 - (abs >> 23);
+      uint32_t mant = (abs & 0x7fffff) | 0x800000;
+      uint32_t bits = mant >> shift;
+      uint32_t rest = mant & ((1u << shift) - 1);
+      uint32_t halfway = 1u << (shift - 1);
+      bits += rest > halfway || (rest == halfway && (bits & 1));
+      return sign | bits;
+    }
+    // rebias the exponent and round the significand to 10 bits; a carry
+    // out of the significand correctly bumps the exponent.
+    uint32_t bits = (abs - 0x38000000) >> 13;
+    uint32_t rest = abs & 0x1fff;
+    bits += rest > 0x1000 || (rest == 0x1000 && (bits & 1));
+    return sign | bits;
+#endif
+  }
+
+  static float to_float(uint16_t h) {
+#if defined(__F16C__)
+    return _cvtsh_ss(h);
+#else
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t x;
+    if (exp == 0x1f) {
+      x = sign | 0x7f800000 | (mant << 13);
+    } else if (exp != 0) {
+      x = sign | ((exp + 112) << 23) | (mant << 13);
+    } else if (mant == 0) {
+      x = sign;
+    } else {
+      // subnormal: normalise the significand.
+      exp = 113;
+      while (!(mant & 0x400)) {
+        mant <<= 1;
+        exp--;
+      }
+      x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+#endif
+  }
+};
+
+// A bfloat16 value, the upper 16 bits of a float, kept as its bits. It has
+// the range of float with an 8-bit significand, so products of two of them
+// are exact in float; U and V can be stored in it for the GEMM, which sums
+// in float (see Bf16Gemm). Conversion from float rounds to nearest even.
+struct bfloat16 {
+  uint16_t bits;
+
+  bfloat16() = default;
+  explicit bfloat16(float f) : bits(from_float(f)) {}
+  operator float() const { return to_float(bits); }
+
+  static uint16_t from_float(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    if ((x & 0x7fffffff) > 0x7f800000) {
+      // NaN stays a (quiet) NaN rather than rounding to infinity.
+      return (x >> 16) | 0x40;
+    }
+    return (x + 0x7fff + ((x >> 16) & 1)) >> 16;
+  }
+
+  static float to_float(uint16_t b) {
+    uint32_t x = (uint32_t) b << 16;
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+  }
+};
+
+// The type arithmetic on stored elements of type T is done in.
+template <typename T>
+struct Arithmetic {
+  typedef T type;
+};
+
+template <>
+struct Arithmetic<half> {
+  typedef float type;
+};
+
+template <>
+struct Arithmetic<bfloat16> {
+  typedef float type;
+};
+
+// Thin wrappers over the widest vector unit the compiler targets (build with
+// -march=native): AVX-512 on Skylake-SP, AVX2 + FMA on Haswell, otherwise
+// one element per "vector". Code written against Simd<T> processes
+// Simd<T>::width independent lanes at once and stays portable.
+template <typename T>
+struct Simd {
+  typedef T type;
+  static const int width = 1;
+  static type load(const T* p) { return *p; }
+  static type loadu(const T* p) { return *p; }
+  static void store(T* p, type a) { *p = a; }
+  static void storeu(T* p, type a) { *p = a; }
+  static type set1(T a) { return a; }
+  static type zero() { return 0; }
+  static type add(type a, type b) { return a + b; }
+  static type sub(type a, type b) { return a - b; }
+  static type mul(type a, type b) { return a * b; }
+  // a * b + c
+  static type fmadd(type a, type b, type c) { return a * b + c; }
+  static type max(type a, type b) { return a > b ? a : b; }
+  static type min(type a, type b) { return a < b ? a : b; }
+  // width values stored as half.
+  static type loadh(const half* p) { return (float) *p; }
+  static void storeh(half* p, type a) { *p = half((float) a); }
+  // width integers, read as int32 and written rounded to int16, saturating
+  // as the vector versions do.
+  static type loadi32(const int32_t* p) { return (T) *p; }
+  static void storei16(int16_t* p, type a) {
+    long x = lrint(a);
+    *p = (int16_t) (x < -32768 ? -32768 : x > 32767 ? 32767 : x);
+  }
+  // width values, read from and written to float or double, and from and
+  // (rounded) to bfloat16.
+  static type loadf(const float* p) { return (T) *p; }
+  static void storef(float* p, type a) { *p = (float) a; }
+  static type loadd(const double* p) { return (T) *p; }
+  static void stored(double* p, type a) { *p = (double) a; }
+  static void storeb(bfloat16* p, type a) { *p = bfloat16((float) a); }
+  static type loadb(const bfloat16* p) { return (float) *p; }
+};
+
+#if defined(__AVX512F__)
+
+template <>
+struct Simd<double> {
+  typedef __m512d type;
+  static const int width = 8;
+  static type load(const double* p) { return _mm512_load_pd(p); }
+  static type loadu(const double* p) { return _mm512_loadu_pd(p); }
+  static void store(double* p, type a) { _mm512_store_pd(p, a); }
+  static void storeu(double* p, type a) { _mm512_storeu_pd(p, a); }
+  static type set1(double a) { return _mm512_set1_pd(a); }
+  static type zero() { return _mm512_setzero_pd(); }
+  static type add(type a, type b) { return _mm512_add_pd(a, b); }
+  static type sub(type a, type b) { return _mm512_sub_pd(a, b); }
+  static type mul(type a, type b) { return _mm512_mul_pd(a, b); }
+  static type fmadd(type a, type b, type c) { return _mm512_fmadd_pd(a, b, c); }
+  static type max(type a, type b) { return _mm512_max_pd(a, b); }
+  static type min(type a, type b) { return _mm512_min_pd(a, b); }
+  static type loadh(const half* p) {
+    __m256i h = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) p));
+    return _mm512_cvtps_pd(_mm512_castps512_ps256(_mm512_cvtph_ps(h)));
+  }
+  static void storeh(half* p, type a) {
+    __m256i h = _mm512_cvtps_ph(_mm512_castps256_ps512(_mm512_cvtpd_ps(a)),
+                                _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128((__m128i*) p, _mm256_castsi256_si128(h));
+  }
+  static type loadi32(const int32_t* p) {
+    return _mm512_cvtepi32_pd(_mm256_loadu_si256((const __m256i*) p));
+  }
+  static void storei16(int16_t* p, type a) {
+    __m256i x = _mm512_cvtpd_epi32(a);
+    __m128i h = _mm_packs_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+    _mm_storeu_si128((__m128i*) p, h);
+  }
+  static type loadf(const float* p) { return _mm512_cvtps_pd(_mm256_loadu_ps(p)); }
+  static type loadd(const double* p) { return loadu(p); }
+  static void stored(double* p, type a) { storeu(p, a); }
+  static void storeb(bfloat16* p, type a) {
+#if defined(__AVX512BF16__) && defined(__AVX512VL__)
+    _mm_storeu_si128((__m128i*) p, (__m128i) _mm256_cvtneps_pbh(_mm512_cvtpd_ps(a)));
+#else
+    // round the float bits to nearest even in their upper half (finite
+    // values only, unlike bfloat16::from_float).
+    __m256i x = _mm256_castps_si256(_mm512_cvtpd_ps(a));
+    __m256i odd = _mm256_and_si256(_mm256_srli_epi32(x, 16), _mm256_set1_epi32(1));
+    x = _mm256_srli_epi32(_mm256_add_epi32(x, _mm256_add_epi32(odd, _mm256_set1_epi32(0x7fff))),
+                          16);
+    __m128i h = _mm_packus_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+    _mm_storeu_si128((__m128i*) p, h);
+#endif
+  }
+};
+
+template <>
+struct Simd<float> {
+  typedef __m512 type;
+  static const int width = 16;
+  static type load(const float* p) { return _mm512_load_ps(p); }
+  static type loadu(const float* p) { return _mm512_loadu_ps(p); }
+  static void store(float* p, type a) { _mm512_store_ps(p, a); }
+  static void storeu(float* p, type a) { _mm512_storeu_ps(p, a); }
+  static type set1(float a) { return _mm512_set1_ps(a); }
+  static type zero() { return _mm512_setzero_ps(); }
+  static type add(type a, type b) { return _mm512_add_ps(a, b); }
+  static type sub(type a, type b) { return _mm512_sub_ps(a, b); }
+  static type mul(type a, type b) { return _mm512_mul_ps(a, b); }
+  static type fmadd(type a, type b, type c) { return _mm512_fmadd_ps(a, b, c); }
+  static type max(type a, type b) { return _mm512_max_ps(a, b); }
+  static type min(type a, type b) { return _mm512_min_ps(a, b); }
+  static type loadh(const half* p) {
+    return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*) p));
+  }
+  static void storeh(half* p, type a) {
+    _mm256_storeu_si256((__m256i*) p, _mm512_cvtps_ph(a, _MM_FROUND_TO_NEAREST_INT));
+  }
+  static type loadi32(const int32_t* p) { return _mm512_cvtepi32_ps(_mm512_loadu_si512(p)); }
+  static void storei16(int16_t* p, type a) {
+    _mm256_storeu_si256((__m256i*) p, _mm512_cvtsepi32_epi16(_mm512_cvtps_epi32(a)));
+  }
+  static type loadf(const float* p) { return loadu(p); }
+  static void storef(float* p, type a) { storeu(p, a); }
+  static void storeb(bfloat16* p, type a) {
+#if defined(__AVX512BF16__)
+    _mm256_storeu_si256((__m256i*) p, (__m256i) _mm512_cvtneps_pbh(a));
+#else
+    // as in Simd<double>.
+    __m512i x = _mm512_castps_si512(a);
+    __m512i odd = _mm512_and_si512(_mm512_srli_epi32(x, 16), _mm512_set1_epi32(1));
+    x = _mm512_srli_epi32(_mm512_add_epi32(x, _mm512_add_epi32(odd, _mm512_set1_epi32(0x7fff))),
+                          16);
+    _mm256_storeu_si256((__m256i*) p, _mm512_cvtepi32_epi16(x));
+#endif
+  }
+  static type loadb(const bfloat16* p) {
+    __m512i x = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*) p));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(x, 16));
+  }
+};
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+template <>
+struct Simd<double> {
+  typedef __m256d type;
+  static const int width = 4;
+  static type load(const double* p) { return _mm256_load_pd(p); }
+  static type loadu(const double* p) { return _mm256_loadu_pd(p); }
+  static void store(double* p, type a) { _mm256_store_pd(p, a); }
+  static void storeu(double* p, type a) { _mm256_storeu_pd(p, a); }
+  static type set1(double a) { return _mm256_set1_pd(a); }
+  static type zero() { return _mm256_setzero_pd(); }
+  static type add(type a, type b) { return _mm256_add_pd(a, b); }
+  static type sub(type a, type b) { return _mm256_sub_pd(a, b); }
+  static type mul(type a, type b) { return _mm256_mul_pd(a, b); }
+  static type fmadd(type a, type b, type c) { return _mm256_fmadd_pd(a, b, c); }
+  static type max(type a, type b) { return _mm256_max_pd(a, b); }
+  static type min(type a, type b) { return _mm256_min_pd(a, b); }
+#if defined(__F16C__)
+  static type loadh(const half* p) {
+    return _mm256_cvtps_pd(_mm_cvtph_ps(_mm_loadl_epi64((const __m128i*) p)));
+  }
+  static void storeh(half* p, type a) {
+    _mm_storel_epi64((__m128i*) p, _mm_cvtps_ph(_mm256_cvtpd_ps(a), _MM_FROUND_TO_NEAREST_INT));
+  }
+#else
+  static type loadh(const half* p) { return _mm256_set_pd(p[3], p[2], p[1], p[0]); }
+  static void storeh(half* p, type a) {
+    alignas(32) double x[width];
+    _mm256_store_pd(x, a);
+    for (int l = 0; l < width; l++) {
+      p[l] = half((float) x[l]);
+    }
+  }
+#endif
+  static type loadi32(const int32_t* p) {
+    return _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*) p));
+  }
+  static void storei16(int16_t* p, type a) {
+    __m128i x = _mm256_cvtpd_epi32(a);
+    _mm_storel_epi64((__m128i*) p, _mm_packs_epi32(x, x));
+  }
+  static type loadf(const float* p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+  static type loadd(const double* p) { return loadu(p); }
+  static void stored(double* p, type a) { storeu(p, a); }
+  static void storeb(bfloat16* p, type a) {
+    // as in the AVX-512 version.
+    __m128i x = _mm_castps_si128(_mm256_cvtpd_ps(a));
+    __m128i odd = _mm_and_si128(_mm_srli_epi32(x, 16), _mm_set1_epi32(1));
+    x = _mm_srli_epi32(_mm_add_epi32(x, _mm_add_epi32(odd, _mm_set1_epi32(0x7fff))), 16);
+    _mm_storel_epi64((__m128i*) p, _mm_packus_epi32(x, x));
+  }
+};
+
+template <>
+struct Simd<float> {
+  typedef __m256 type;
+  static const int width = 8;
+  static type load(const float* p) { return _mm256_load_ps(p); }
+  static type loadu(const float* p) { return _mm256_loadu_ps(p); }
+  static void store(float* p, type a) { _mm256_store_ps(p, a); }
+  static void storeu(float* p, type a) { _mm256_storeu_ps(p, a); }
+  static type set1(float a) { return _mm256_set1_ps(a); }
+  static type zero() { return _mm256_setzero_ps(); }
+  static type add(type a, type b) { return _mm256_add_ps(a, b); }
+  static type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+  static type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+  static type fmadd(type a, type b, type c) { return _mm256_fmadd_ps(a, b, c); }
+  static type max(type a, type b) { return _mm256_max_ps(a, b); }
+  static type min(type a, type b) { return _mm256_min_ps(a, b); }
+#if defined(__F16C__)
+  static type loadh(const half* p) { return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) p)); }
+  static void storeh(half* p, type a) {
+    _mm_storeu_si128((__m128i*) p, _mm256_cvtps_ph(a, _MM_FROUND_TO_NEAREST_INT));
+  }
+#else
+  static type loadh(const half* p) {
+    return _mm256_set_ps(p[7], p[6], p[5], p[4], p[3], p[2], p[1], p[0]);
+  }
+  static void storeh(half* p, type a) {
+    alignas(32) float x[width];
+    _mm256_store_ps(x, a);
+    for (int l = 0; l < width; l++) {
+      p[l] = half(x[l]);
+    }
+  }
+#endif
+  static type loadi32(const int32_t* p) {
+    return _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*) p));
+  }
+  static void storei16(int16_t* p, type a) {
+    __m256i x = _mm256_cvtps_epi32(a);
+    __m128i h = _mm_packs_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+    _mm_storeu_si128((__m128i*) p, h);
+  }
+  static type loadf(const float* p) { return loadu(p); }
+  static void storef(float* p, type a) { storeu(p, a); }
+  static void storeb(bfloat16* p, type a) {
+    // as in Simd<double>.
+    __m256i x = _mm256_castps_si256(a);
+    __m256i odd = _mm256_and_si256(_mm256_srli_epi32(x, 16), _mm256_set1_epi32(1));
+    x = _mm256_srli_epi32(_mm256_add_epi32(x, _mm256_add_epi32(odd, _mm256_set1_epi32(0x7fff))),
+                          16);
+    __m128i h = _mm_packus_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+    _mm_storeu_si128((__m128i*) p, h);
+  }
+  static type loadb(const bfloat16* p) {
+    __m256i x = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) p));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(x, 16));
+  }
+};
+
+#endif
+
+// Simd<int16_t> is what the int8 path gathers and transforms its input
+// tiles in (see WinogradConv::input_tiles), with twice the lanes of float.
+// The adds wrap, which the exactness bound of that path rules out, and
+// set1 takes the integral coefficients of its transforms.
+#if defined(__AVX512BW__)
+
+template <>
+struct Simd<int16_t> {
+  typedef __m512i type;
+  static const int width = 32;
+  static type load(const int16_t* p) { return _mm512_load_si512(p); }
+  static type loadu(const int16_t* p) { return _mm512_loadu_si512(p); }
+  static void store(int16_t* p, type a) { _mm512_store_si512(p, a); }
+  static void storeu(int16_t* p, type a) { _mm512_storeu_si512(p, a); }
+  static type set1(int16_t a) { return _mm512_set1_epi16(a); }
+  static type zero() { return _mm512_setzero_si512(); }
+  static type add(type a, type b) { return _mm512_add_epi16(a, b); }
+  static type sub(type a, type b) { return _mm512_sub_epi16(a, b); }
+  static type mul(type a, type b) { return _mm512_mullo_epi16(a, b); }
+  static type fmadd(type a, type b, type c) { return add(mul(a, b), c); }
+};
+
+#elif defined(__AVX2__)
+
+template <>
+struct Simd<int16_t> {
+  typedef __m256i type;
+  static const int width = 16;
+  static type load(const int16_t* p) { return _mm256_load_si256((const __m256i*) p); }
+  static type loadu(const int16_t* p) { return _mm256_loadu_si256((const __m256i*) p); }
+  static void store(int16_t* p, type a) { _mm256_store_si256((__m256i*) p, a); }
+  static void storeu(int16_t* p, type a) { _mm256_storeu_si256((__m256i*) p, a); }
+  static type set1(int16_t a) { return _mm256_set1_epi16(a); }
+  static type zero() { return _mm256_setzero_si256(); }
+  static type add(type a, type b) { return _mm256_add_epi16(a, b); }
+  static type sub(type a, type b) { return _mm256_sub_epi16(a, b); }
+  static type mul(type a, type b) { return _mm256_mullo_epi16(a, b); }
+  static type fmadd(type a, type b, type c) { return add(mul(a, b), c); }
+};
+
+#endif
+
+// The pair vectors of two rows of int16 (interleave in the structs below):
+// both are widened to 32 bits and hi is shifted into the upper halves.
+#if defined(__AVX512F__)
+static inline __m512i interleave_pairs512(const int16_t* lo, const int16_t* hi) {
+  __m512i l = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*) lo));
+  __m512i h = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*) hi));
+  return _mm512_or_si512(l, _mm512_slli_epi32(h, 16));
+}
+#endif
+#if defined(__AVX2__)
+static inline __m256i interleave_pairs256(const int16_t* lo, const int16_t* hi) {
+  __m256i l = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) lo));
+  __m256i h = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) hi));
+  return _mm256_or_si256(l, _mm256_slli_epi32(h, 16));
+}
+#endif
+
+// Dot products of int16 pairs accumulated in int32 lanes, for the GEMM of
+// the quantised path: a vector is width int32 lanes, each holding two int16
+// (the lower address in the low half), and madd(acc, a, b) adds
+// a.lo * b.lo + a.hi * b.hi to every lane of acc. storep stores a vector of
+// pairs to aligned memory, and interleave(lo, hi) pairs up lo[j] and hi[j]
+// from two rows of width int16 each, for packing V. AVX-512 VNNI and
+// AVX-VNNI do this in one instruction (vpdpwssd), AVX-512BW and AVX2 in two
+// (vpmaddwd and an add).
+#if defined(__AVX512BW__)
+
+struct SimdInt16 {
+  typedef __m512i type;
+  static const int width = 16;
+  static type load(const int32_t* p) { return _mm512_loadu_si512(p); }
+  static void store(int32_t* p, type a) { _mm512_storeu_si512(p, a); }
+  static type set1(int32_t a) { return _mm512_set1_epi32(a); }
+  static void storep(int32_t* p, type a) { _mm512_store_si512(p, a); }
+  static type interleave(const int16_t* lo, const int16_t* hi) {
+    return interleave_pairs512(lo, hi);
+  }
+  static type zero() { return _mm512_setzero_si512(); }
+  static type add(type a, type b) { return _mm512_add_epi32(a, b); }
+  static type madd(type acc, type a, type b) {
+#if defined(__AVX512VNNI__)
+    // GCC copies acc around the intrinsic in the unrolled GEMM kernel;
+    // naming it as an in/out operand keeps the accumulators in place.
+    __asm__("vpdpwssd %2, %1, %0" : "+v"(acc) : "v"(a), "v"(b));
+    return acc;
+#else
+    return _mm512_add_epi32(acc, _mm512_madd_epi16(a, b));
+#endif
+  }
+};
+
+#elif defined(__AVX2__)
+
+struct SimdInt16 {
+  typedef __m256i type;
+  static const int width = 8;
+  static type load(const int32_t* p) { return _mm256_loadu_si256((const __m256i*) p); }
+  static void store(int32_t* p, type a) { _mm256_storeu_si256((__m256i*) p, a); }
+  static type set1(int32_t a) { return _mm256_set1_epi32(a); }
+  static void storep(int32_t* p, type a) { _mm256_store_si256((__m256i*) p, a); }
+  static type interleave(const int16_t* lo, const int16_t* hi) {
+    return interleave_pairs256(lo, hi);
+  }
+  static type zero() { return _mm256_setzero_si256(); }
+  static type add(type a, type b) { return _mm256_add_epi32(a, b); }
+  static type madd(type acc, type a, type b) {
+#if defined(__AVXVNNI__)
+    return _mm256_dpwssd_avx_epi32(acc, a, b);
+#else
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(a, b));
+#endif
+  }
+};
+
+#else
+
+struct SimdInt16 {
+  typedef int32_t type;
+  static const int width = 1;
+  static type load(const int32_t* p) { return *p; }
+  static void store(int32_t* p, type a) { *p = a; }
+  static type set1(int32_t a) { return a; }
+  static void storep(int32_t* p, type a) { *p = a; }
+  static type interleave(const int16_t* lo, const int16_t* hi) {
+    return (int32_t) ((uint16_t) *lo | (uint32_t) (uint16_t) *hi << 16);
+  }
+  static type zero() { return 0; }
+  static type add(type a, type b) { return a + b; }
+  static type madd(type acc, type a, type b) {
+    return acc + (int16_t) a * (int16_t) b + (int16_t) (a >> 16) * (int16_t) (b >> 16);
+  }
+};
+
+#endif
+
+#endif
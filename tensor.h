@@ -0,0 +1,77 @@
+#ifndef __TENSOR_H
+#define __TENSOR_H
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Every tensor allocation starts on a cache line, so that SIMD loads and
+// the GEMM panels built on top of it never straddle one.
+#define TENSOR_ALIGNMENT 64
+
+// A 4-D array with explicit strides. An owning tensor lives in a single
+// 64-byte aligned allocation and is laid out row-major, except that the
+// stride of the second dimension is rounded up to a whole number of cache
+// lines: for U, V and M indexed as (xi, nu, row, col), every one of the
+// alpha x alpha matrices starts aligned and is itself dense row-major.
+//
+// A tensor can also be a non-owning view over existing memory with
+// arbitrary strides, e.g. an Armadillo cube, which is column-major.
+template <typename T>
+struct Tensor {
+  int dim[4];
+  long stride[4];
+  T* data;
+  bool owner;
+
+  Tensor(int d0, int d1, int d2, int d3) : owner(true) {
+    const long line = TENSOR_ALIGNMENT / sizeof(T);
+    dim[0] = d0; dim[1] = d1; dim[2] = d2; dim[3] = d3;
+    stride[3] = 1;
+    stride[2] = d3;
+    stride[1] = ((long) d2 * d3 + line - 1) / line * line;
+    stride[0] = stride[1] * d1;
+    void* p = NULL;
+    size_t bytes = sizeof(T) * stride[0] * d0;
+    if (posix_memalign(&p, TENSOR_ALIGNMENT, bytes > 0 ? bytes : TENSOR_ALIGNMENT) != 0) {
+      throw std::bad_alloc();
+    }
+    data = (T*) p;
+    memset(data, 0, bytes);
+  }
+
+  Tensor(T* ptr, int d0, int d1, int d2, int d3,
+         long s0, long s1, long s2, long s3) : data(ptr), owner(false) {
+    dim[0] = d0; dim[1] = d1; dim[2] = d2; dim[3] = d3;
+    stride[0] = s0; stride[1] = s1; stride[2] = s2; stride[3] = s3;
+  }
+
+  ~Tensor() {
+    if (owner) {
+      free(data);
+    }
+  }
+
+  T& operator()(int i0, int i1, int i2, int i3) {
+    return data[i0 * stride[0] + i1 * stride[1] + i2 * stride[2] + i3 * stride[3]];
+  }
+
+  const T& operator()(int i0, int i1, int i2, int i3) const {
+    return data[i0 * stride[0] + i1 * stride[1] + i2 * stride[2] + i3 * stride[3]];
+  }
+
+  // The matrix at (i0, i1), with row stride stride[2] and column stride stride[3].
+  T* ptr(int i0, int i1) {
+    return data + i0 * stride[0] + i1 * stride[1];
+  }
+
+  const T* ptr(int i0, int i1) const {
+    return data + i0 * stride[0] + i1 * stride[1];
+  }
+
+ private:
+  Tensor(const Tensor&);
+  Tensor& operator=(const Tensor&);
+};
+
+#endif
@@ -1,6 +1,331 @@
 #!/bin/bash
+# Checks the CPU engines against naive_convolution on small problems, one
+# block per feature, then the GPU outputs of bench_image_size.sh. Run
+# `make` first; the problems and outputs are written as test_*.in,
+# test_*.out and test.pack.
+failures=0
+
+# check <description> <reference output> <output>
+check() {
+    echo -n "$1: "
+    if ! ./compare_outputs $2 $3; then
+        failures=$((failures + 1))
+    fi
+}
+
+# check_engines <input> <flags>: runs naive_convolution and both CPU
+# engines, with every tile size, plain and fused, with the same flags.
+check_engines() {
+    input=$1
+    shift
+    ./naive_convolution "$@" $input test_naive.out > /dev/null
+    for engine in winograd winograd_openmp; do
+        for m in 2 4 6; do
+            for fused in "" -f; do
+                ./$engine -m $m $fused "$@" $input test_engine.out > /dev/null
+                check "$(echo $engine -m $m $fused "$@" $input)" test_naive.out test_engine.out
+            done
+        done
+    done
+}
+
+# check_storage <storage> <tolerance> <input> <flags>: runs
+# naive_convolution and winograd_openmp -t storage, with every tile size
+# (or those in $tiles), plain and fused, with the same flags, and compares
+# their outputs within the relative tolerance of the storage.
+check_storage() {
+    storage=$1
+    tolerance=$2
+    input=$3
+    shift 3
+    ./naive_convolution "$@" $input test_naive.out > /dev/null
+    for m in ${tiles:-2 4 6}; do
+        for fused in "" -f; do
+            ./winograd_openmp -m $m $fused -t $storage "$@" $input test_engine.out > /dev/null
+            echo -n "$(echo winograd_openmp -m $m $fused -t $storage "$@" $input): "
+            if ! ./compare_outputs test_naive.out test_engine.out $tolerance; then
+                failures=$((failures + 1))
+            fi
+        done
+    done
+}
+
+# check_epilogue <input> <flags>: takes the output of naive_convolution
+# as the residual, and checks every activation, with test_bias.txt and
+# with and without the residual, through check_engines.
+check_epilogue() {
+    input=$1
+    shift
+    ./naive_convolution "$@" $input test_residual.out > /dev/null
+    for activation in none relu relu6 leaky:0.2; do
+        for residual in "" "-R test_residual.out"; do
+            check_engines $input "$@" -a $activation -B test_bias.txt $residual
+        done
+    done
+}
+
+# check_weights <input> <flags>: takes the output of naive_convolution as
+# the gradient of the output, and checks the filter gradients of both CPU
+# engines (-w), with every tile size, plain and fused, against the one of
+# naive_convolution -w, with the same flags.
+check_weights() {
+    input=$1
+    shift
+    ./naive_convolution "$@" $input test_grad.out > /dev/null
+    ./naive_convolution -w "$@" $input test_grad.out test_naive.out > /dev/null
+    for engine in winograd winograd_openmp; do
+        for m in 2 4 6; do
+            for fused in "" -f; do
+                ./$engine -m $m $fused -w "$@" $input test_grad.out test_engine.out > /dev/null
+                check "$(echo $engine -m $m $fused -w "$@" $input)" test_naive.out test_engine.out
+            done
+        done
+    done
+}
+
+# check_1d <input> <axis> <flags>: runs naive_convolution with the 1 x 3
+# (w) or 3 x 1 (h) filters of the axis and winograd_1d along it, in both
+# precisions, with every tile size, plain and streaming, with the same
+# flags.
+check_1d() {
+    input=$1
+    axis=$2
+    shift 2
+    if [ $axis = w ]; then r=1x3; else r=3x1; fi
+    ./naive_convolution -r $r "$@" $input test_naive.out > /dev/null
+    for precision in float double; do
+        for m in 2 4 6; do
+            for streaming in "" -f; do
+                ./winograd_1d -P $precision -m $m -a $axis $streaming "$@" $input test_engine.out > /dev/null
+                check "$(echo winograd_1d -P $precision -m $m -a $axis $streaming "$@" $input)" test_naive.out test_engine.out
+            done
+        done
+    done
+}
+
+# check_3d <input> <flags>: runs naive_convolution on a volume problem and
+# winograd_3d in both precisions, with every tile size, plain and
+# streaming over depth, with the same flags.
+check_3d() {
+    input=$1
+    shift
+    ./naive_convolution -v "$@" $input test_naive.out > /dev/null
+    for precision in float double; do
+        for m in 2 4; do
+            for streaming in "" -f; do
+                ./winograd_3d -P $precision -m $m $streaming "$@" $input test_engine.out > /dev/null
+                check "$(echo winograd_3d -P $precision -m $m $streaming "$@" $input)" test_naive.out test_engine.out
+            done
+        done
+    done
+}
+
+# check_network <network>: runs the layers of the network one at a time
+# on naive_convolution, each on the output of the one before it, and
+# checks winograd_openmp -n on the whole network, with every tile size,
+# plain and fused, against the output of the last.
+check_network() {
+    input=$1
+    l=0
+    python3 gen_network.py --layers $input test_layer > test_layers.txt
+    while read options; do
+        cat test_layer_$((l + 1)).in > test_layer.in
+        tail -n +2 test_layer_$l.out >> test_layer.in
+        l=$((l + 1))
+        ./naive_convolution $options test_layer.in test_layer_$l.out > /dev/null
+    done < test_layers.txt
+    # the output of a network goes under "K C H W [N]", with the K of the
+    # last layer and the images of the network.
+    read L C H W N < $input
+    read K rest < test_layer_$l.in
+    echo $K $C $H $W $N > test_naive.out
+    tail -n +2 test_layer_$l.out >> test_naive.out
+    for m in 2 4 6; do
+        for fused in "" -f; do
+            ./winograd_openmp -n -m $m $fused $input test_engine.out > /dev/null
+            check "$(echo winograd_openmp -n -m $m $fused $input)" test_naive.out test_engine.out
+        done
+    done
+}
+
+# check_pack <input> <flags>: packs the filters with every tile size and
+# runs both CPU engines, plain and fused, with and without the pack. The
+# outputs must be identical, as U is the same either way.
+check_pack() {
+    input=$1
+    shift
+    for m in 2 4 6; do
+        ./winograd --pack-filters -m $m "$@" $input test.pack > /dev/null
+        for engine in winograd winograd_openmp; do
+            for fused in "" -f; do
+                ./$engine -m $m $fused "$@" $input test_unpacked.out > /dev/null
+                ./$engine -m $m $fused -u test.pack "$@" $input test_packed.out > /dev/null
+                echo -n "$(echo $engine -m $m $fused -u "$@" $input): "
+                if cmp -s test_unpacked.out test_packed.out; then
+                    echo "Outputs are identical."
+                else
+                    echo "Outputs differ."
+                    failures=$((failures + 1))
+                fi
+            done
+        done
+    done
+}
+
+# a batch of N images per call.
+python3 gen_problem.py 4 3 14 14 > test_single.in
+python3 gen_problem.py 4 3 14 14 3 > test_batch.in
+check_engines test_single.in
+check_engines test_batch.in
+
+# any image size, with virtual zero padding.
+python3 gen_problem.py 4 3 13 17 2 > test_odd.in
+check_engines test_odd.in
+check_engines test_odd.in -p same
+check_engines test_odd.in -p 2
+python3 gen_problem.py 2 3 3 5 > test_tiny.in
+check_engines test_tiny.in
+check_engines test_tiny.in -p same
+
+# stride 2, on odd and even sizes.
+check_engines test_odd.in -s 2
+check_engines test_odd.in -s 2 -p same
+check_engines test_batch.in -s 2 -p 1
+
+# dilated filters.
+check_engines test_odd.in -d 2
+check_engines test_odd.in -d 2 -p same
+check_engines test_batch.in -d 3 -p 1
+
+# grouped and depthwise convolutions.
+python3 gen_problem.py 6 4 13 11 2 2 > test_grouped.in
+python3 gen_problem.py 5 5 13 11 2 5 > test_depthwise.in
+check_engines test_grouped.in -g 2
+check_engines test_grouped.in -g 2 -s 2 -p same
+check_engines test_depthwise.in -g 5
+check_engines test_depthwise.in -g 5 -d 2 -p same
+
+# 5 x 5 and 7 x 7 filters, cut into 3 x 3 pieces.
+python3 gen_problem.py 4 3 17 15 2 1 5 > test_5x5.in
+python3 gen_problem.py 4 4 19 17 1 2 7 > test_7x7.in
+check_engines test_5x5.in -r 5
+check_engines test_5x5.in -r 5 -p same -s 2
+check_engines test_5x5.in -r 5 -d 2
+check_engines test_7x7.in -r 7 -g 2
+check_engines test_7x7.in -r 7 -g 2 -p same -s 2
+
+# the backward-data pass (transposed convolution), upsampling included.
+python3 gen_problem.py --backward 4 6 7 9 2 > test_backward.in
+python3 gen_problem.py --backward 6 4 8 7 1 2 > test_backward_grouped.in
+python3 gen_problem.py --backward 4 3 6 5 1 1 5 > test_backward_5x5.in
+check_engines test_backward.in -b
+check_engines test_backward.in -b -p same
+check_engines test_backward.in -b -d 2
+check_engines test_backward.in -b -s 2
+check_engines test_backward.in -b -s 2 -o 1 -p 1
+check_engines test_backward_grouped.in -b -g 2 -s 2 -o 1
+check_engines test_backward_5x5.in -b -r 5 -s 2 -p 2
+
+# fused epilogues: a bias, a residual and an activation, on biases that
+# take outputs below 0 and above 6.
+echo "-7 -5 -3 -1 1 3" > test_bias.txt
+check_epilogue test_odd.in -p same
+check_epilogue test_odd.in -s 2
+check_epilogue test_grouped.in -g 2
+check_epilogue test_5x5.in -r 5 -s 2 -p same
+check_epilogue test_backward.in -b -s 2
+
+# the backward-filter pass (weight gradient). Each gradient sums over every
+# output pixel and comes to around a hundred here, so compare_outputs checks
+# it to about four significant digits.
+python3 gen_problem.py 4 2 8 7 2 > test_weights.in
+python3 gen_problem.py 6 4 9 8 1 2 > test_weights_grouped.in
+python3 gen_problem.py 4 2 9 8 1 1 5 > test_weights_5x5.in
+check_weights test_weights.in
+check_weights test_weights.in -p same
+check_weights test_weights.in -d 2
+check_weights test_weights.in -s 2 -p 1
+check_weights test_weights_grouped.in -g 2 -s 2
+check_weights test_weights_5x5.in -r 5 -p same
+
+# U, V and M stored in half precision, to about 3 significant digits.
+check_storage half 0.02 test_batch.in
+check_storage half 0.02 test_odd.in -p same
+check_storage half 0.02 test_odd.in -s 2
+check_storage half 0.02 test_grouped.in -g 2 -d 2
+check_storage half 0.02 test_depthwise.in -g 5
+check_storage half 0.02 test_5x5.in -r 5 -p same
+check_storage half 0.02 test_odd.in -p same -a relu -B test_bias.txt
+
+# the forward pass quantised to int8, with F(2 x 2, 3 x 3) only, to within
+# the quantisation error.
+tiles=2 check_storage int8 0.02 test_batch.in
+tiles=2 check_storage int8 0.02 test_odd.in -p same
+tiles=2 check_storage int8 0.02 test_odd.in -s 2
+tiles=2 check_storage int8 0.02 test_grouped.in -g 2 -d 2
+tiles=2 check_storage int8 0.02 test_depthwise.in -g 5
+tiles=2 check_storage int8 0.02 test_5x5.in -r 5 -p same
+tiles=2 check_storage int8 0.02 test_odd.in -p same -a relu -B test_bias.txt
+
+# U and V stored in bfloat16, to about 2 significant digits: within 1%
+# with -m 2. -m 4 and -m 6 amplify that to around 5%, and up to 10% on
+# depthwise layers, where no sum over channels averages the rounding out.
+tiles=2 check_storage bf16 0.02 test_batch.in
+tiles=2 check_storage bf16 0.02 test_odd.in -p same
+tiles=2 check_storage bf16 0.02 test_odd.in -s 2
+tiles=2 check_storage bf16 0.02 test_grouped.in -g 2 -d 2
+tiles=2 check_storage bf16 0.02 test_depthwise.in -g 5
+tiles=2 check_storage bf16 0.02 test_5x5.in -r 5 -p same
+tiles=2 check_storage bf16 0.02 test_odd.in -p same -a relu -B test_bias.txt
+tiles="4 6" check_storage bf16 0.15 test_batch.in
+tiles="4 6" check_storage bf16 0.15 test_odd.in -p same
+tiles="4 6" check_storage bf16 0.15 test_odd.in -s 2
+tiles="4 6" check_storage bf16 0.15 test_grouped.in -g 2 -d 2
+tiles="4 6" check_storage bf16 0.15 test_depthwise.in -g 5
+tiles="4 6" check_storage bf16 0.15 test_5x5.in -r 5 -p same
+tiles="4 6" check_storage bf16 0.15 test_odd.in -p same -a relu -B test_bias.txt
+
+# 1-D layers: sequences, and the rows or columns of images.
+python3 gen_problem.py 4 3 1 37 3 1 1x3 > test_sequence.in
+python3 gen_problem.py 4 3 9 13 2 1 1x3 > test_rows.in
+python3 gen_problem.py 4 3 13 9 2 1 3x1 > test_columns.in
+check_1d test_sequence.in w
+check_1d test_sequence.in w -p same
+check_1d test_rows.in w -p 2
+check_1d test_columns.in h
+check_1d test_columns.in h -p same
+
+# 3-D volumes, with tiles cut short on every face.
+python3 gen_volume.py 3 2 7 9 6 2 > test_volume.in
+check_3d test_volume.in
+check_3d test_volume.in -p same
+check_3d test_volume.in -p 2
+
+# networks, with residual blocks.
+python3 gen_network.py 4 4 3 10 10 > test_network.in
+python3 gen_network.py 5 6 3 12 11 2 > test_network_batch.in
+python3 gen_network.py --mixed 4 4 3 13 12 2 > test_network_mixed.in
+check_network test_network.in
+check_network test_network_batch.in
+check_network test_network_mixed.in
+
+# filter packs.
+check_pack test_single.in
+check_pack test_batch.in
+check_pack test_odd.in -s 2 -p same
+check_pack test_odd.in -d 2 -p same
+check_pack test_grouped.in -g 2 -s 2 -p same
+check_pack test_depthwise.in -g 5
+check_pack test_5x5.in -r 5
+check_pack test_7x7.in -r 7 -g 2 -s 2
+
+# the GPU outputs bench_image_size.sh left, if it was run.
 for n in {2..9};
-do 
+do
     N=$((1 << n))
-    ./compare_outputs naive_64_3_$((N))_$((N)).out gpu_64_3_$((N))_$((N)).out
-done
\ No newline at end of file
+    if [ -f gpu_64_3_$((N))_$((N)).out ]; then
+        check "winograd_gpu $N x $N" naive_64_3_$((N))_$((N)).out gpu_64_3_$((N))_$((N)).out
+    fi
+done
+
+exit $((failures > 0))
@@ -0,0 +1,315 @@
+#ifndef __TRANSFORM_PROGRAM_H
+#define __TRANSFORM_PROGRAM_H
+
+#include <sstream>
+#include <string>
+
+// Straight-line code for the Winograd transforms. Applying a constant
+// rows x cols matrix M to a vector x as a matrix product costs rows * cols
+// multiply-adds, although nearly every entry of B^T, G and A^T is 0, +-1 or
+// a power of two. TransformProgram compiles y = M x, at compile time, into a
+// sequence of adds, subtracts and scales instead:
+//
+//  - while some pair of terms c_p x_p + c_q x_q appears, up to a common
+//    factor, in two or more rows, the most common pair becomes a new value
+//    t = x_p + (c_q / c_p) x_q that those rows use instead (common
+//    subexpressions, e.g. x_1 + x_2 and x_1 - x_2 of A^T are computed once);
+//  - every row then sums its remaining terms, with the factor taken out
+//    that leaves the fewest scales and FMAs: a row of equal weights is a
+//    chain of adds and a single scale.
+//
+// The 2-D transforms apply the 1-D program along each axis, e.g. B^T d B of
+// F(2x2, 3x3) takes 4 programs down the columns and 4 along the rows of 4
+// adds each: 32 adds per tile rather than the 224 flops of two 4 x 4 matrix
+// products. run_transform executes a program on scalars or SIMD vectors and
+// opencl_source writes it out as an OpenCL C function.
+
+// Value cols + s of a program is the result of its step s; values 0 ..
+// cols - 1 are the inputs x.
+enum TransformOp {
+  TRANSFORM_ADD,    // a + b
+  TRANSFORM_SUB,    // a - b
+  TRANSFORM_FMA,    // a + c * b
+  TRANSFORM_NEG,    // -a
+  TRANSFORM_SCALE,  // c * a
+};
+
+struct TransformStep {
+  TransformOp op;
+  int a, b;
+  double c;
+};
+
+constexpr double transform_abs(double x) {
+  return x < 0 ? -x : x;
+}
+
+// The coefficients are generated in double (see CookToom), so ratios such
+// as (1/24) / (1/12) are compared with a little slack.
+constexpr bool transform_equal(double x, double y) {
+  return transform_abs(x - y) <= 1e-9 * (transform_abs(x) + transform_abs(y));
+}
+
+// 0 for a factor of 1, 1 for -1 and 2 for any other: the cheaper the
+// factor, the less it costs to apply to a row.
+constexpr int transform_factor_rank(double f) {
+  return transform_equal(f, 1.0) ? 0 : transform_equal(f, -1.0) ? 1 : 2;
+}
+
+template <int rows, int cols>
+struct TransformProgram {
+  // a row of k terms takes at most k - 1 sums and a scale, and every
+  // common subexpression saves at least one of those sums.
+  static constexpr int max_steps = rows * cols + rows;
+  static constexpr int max_values = cols + max_steps;
+  TransformStep step[max_steps];
+  int steps;
+  // the value holding y[i], or -1 if row i of M is zero.
+  int out[rows];
+
+  constexpr TransformProgram(const double (&M)[rows][cols]) : step(), steps(0), out() {
+    // every step is set explicitly: GCC does not accept the result as a
+    // constant otherwise.
+    for (int s = 0; s < max_steps; s++) {
+      step[s] = TransformStep{TRANSFORM_ADD, 0, 0, 0.0};
+    }
+    // coef[i][v] is the weight of value v in row i.
+    double coef[rows][max_values] = {};
+    for (int i = 0; i < rows; i++) {
+      for (int j = 0; j < cols; j++) {
+        coef[i][j] = M[i][j];
+      }
+    }
+
+    while (true) {
+      int best = 1, base = -1, other = -1;
+      double ratio = 0;
+      for (int i = 0; i < rows; i++) {
+        for (int p = 0; p < cols + steps; p++) {
+          if (coef[i][p] == 0) {
+            continue;
+          }
+          for (int q = p + 1; q < cols + steps; q++) {
+            if (coef[i][q] == 0) {
+              continue;
+            }
+            // the term of smaller weight gets the unit coefficient.
+            int b = p, o = q;
+            if (transform_abs(coef[i][q]) < transform_abs(coef[i][p]) &&
+                !transform_equal(transform_abs(coef[i][q]), transform_abs(coef[i][p]))) {
+              b = q;
+              o = p;
+            }
+            double c = coef[i][o] / coef[i][b];
+            int count = 0;
+            for (int k = 0; k < rows; k++) {
+              if (coef[k][b] != 0 && coef[k][o] != 0 &&
+                  transform_equal(coef[k][o] / coef[k][b], c)) {
+                count++;
+              }
+            }
+            if (count > best || (count == best && count > 1 &&
+                                 transform_factor_rank(c) < transform_factor_rank(ratio))) {
+              best = count;
+              base = b;
+              other = o;
+              ratio = c;
+            }
+          }
+        }
+      }
+      if (base < 0) {
+        break;
+      }
+      int t = emit(base, other, ratio);
+      for (int k = 0; k < rows; k++) {
+        if (coef[k][base] != 0 && coef[k][other] != 0 &&
+            transform_equal(coef[k][other] / coef[k][base], ratio)) {
+          coef[k][t] = coef[k][base];
+          coef[k][base] = 0;
+          coef[k][other] = 0;
+        }
+      }
+    }
+
+    // each row sums its terms from a start term, with a factor f taken
+    // out: s = (c_0 / f) x_0 + sum_l (c_l / f) x_l, y = f s. Starting or
+    // ending on a weight other than 1 costs a scale, a weight other than
+    // +-1 in between an FMA; the cheapest choice of f (1 or one of the
+    // weights) and start term wins.
+    for (int i = 0; i < rows; i++) {
+      int terms = 0;
+      for (int v = 0; v < cols + steps; v++) {
+        terms += coef[i][v] != 0;
+      }
+      if (terms == 0) {
+        out[i] = -1;
+        continue;
+      }
+      double f = 1.0;
+      int start = -1, cost = max_steps * 2;
+      for (int g = -1; g < cols + steps; g++) {
+        if (g >= 0 && coef[i][g] == 0) {
+          continue;
+        }
+        double h = g < 0 ? 1.0 : coef[i][g];
+        for (int v = 0; v < cols + steps; v++) {
+          if (coef[i][v] == 0) {
+            continue;
+          }
+          int n = (transform_equal(coef[i][v], h) ? 0 : 1) + (transform_equal(h, 1.0) ? 0 : 1);
+          for (int w = 0; w < cols + steps; w++) {
+            if (coef[i][w] != 0 && w != v) {
+              n += transform_factor_rank(coef[i][w] / h) < 2 ? 1 : 2;
+            }
+          }
+          if (n < cost) {
+            cost = n;
+            f = h;
+            start = v;
+          }
+        }
+      }
+      int acc = start;
+      double e = coef[i][start] / f;
+      if (transform_equal(e, -1.0)) {
+        acc = push(TRANSFORM_NEG, acc, 0, 0.0);
+      } else if (!transform_equal(e, 1.0)) {
+        acc = push(TRANSFORM_SCALE, acc, 0, e);
+      }
+      for (int v = 0; v < cols + steps; v++) {
+        if (coef[i][v] != 0 && v != start) {
+          acc = emit(acc, v, coef[i][v] / f);
+        }
+      }
+      if (transform_equal(f, -1.0)) {
+        acc = push(TRANSFORM_NEG, acc, 0, 0.0);
+      } else if (!transform_equal(f, 1.0)) {
+        acc = push(TRANSFORM_SCALE, acc, 0, f);
+      }
+      out[i] = acc;
+    }
+  }
+
+  // The value a + c * b.
+  constexpr int emit(int a, int b, double c) {
+    if (transform_equal(c, 1.0)) {
+      return push(TRANSFORM_ADD, a, b, 0.0);
+    } else if (transform_equal(c, -1.0)) {
+      return push(TRANSFORM_SUB, a, b, 0.0);
+    }
+    return push(TRANSFORM_FMA, a, b, c);
+  }
+
+  constexpr int push(TransformOp op, int a, int b, double c) {
+    step[steps].op = op;
+    step[steps].a = a;
+    step[steps].b = b;
+    step[steps].c = c;
+    steps++;
+    return cols + steps - 1;
+  }
+
+  // Flops of one application, counting an FMA as two.
+  constexpr int flops() const {
+    int n = 0;
+    for (int s = 0; s < steps; s++) {
+      n += step[s].op == TRANSFORM_FMA ? 2 : 1;
+    }
+    return n;
+  }
+
+  // The program as the OpenCL C function
+  //   void name(const float *x, int xs, float *y, int ys)
+  // which sets y[i * ys] from the x[j * xs], in float.
+  std::string opencl_source(const char* name) const {
+    std::ostringstream src;
+    src << "/* " << rows << " x " << cols << ", " << flops() << " flops. */\n";
+    src << "void " << name << "(const float *x, int xs, float *y, int ys)\n{\n";
+    for (int s = 0; s < steps; s++) {
+      const TransformStep& st = step[s];
+      src << "  float t" << cols + s << " = ";
+      switch (st.op) {
+        case TRANSFORM_ADD: src << value(st.a) << " + " << value(st.b); break;
+        case TRANSFORM_SUB: src << value(st.a) << " - " << value(st.b); break;
+        case TRANSFORM_FMA:
+          src << value(st.a) << (st.c < 0 ? " - " : " + ") << literal(transform_abs(st.c))
+              << " * " << value(st.b);
+          break;
+        case TRANSFORM_NEG: src << "-" << value(st.a); break;
+        case TRANSFORM_SCALE: src << literal(st.c) << " * " << value(st.a); break;
+      }
+      src << ";\n";
+    }
+    for (int i = 0; i < rows; i++) {
+      src << "  y[" << i << "*ys] = " << (out[i] < 0 ? std::string("0") : value(out[i])) << ";\n";
+    }
+    src << "}\n";
+    return src.str();
+  }
+
+  std::string value(int v) const {
+    std::ostringstream s;
+    if (v < cols) {
+      s << "x[" << v << "*xs]";
+    } else {
+      s << "t" << v;
+    }
+    return s.str();
+  }
+
+  static std::string literal(double c) {
+    std::ostringstream s;
+    s.precision(9);
+    s << c;
+    std::string text = s.str();
+    if (text.find_first_of(".e") == std::string::npos) {
+      text += ".0";
+    }
+    return text + "f";
+  }
+};
+
+// y[i * ys] = (M x)[i] for the x[j * xs] of program p, on whatever S
+// computes in: a Simd<T> for width tiles at once or ScalarOps. Meant to be
+// inlined with p a constexpr program, so the unrolled steps fold into the
+// straight-line sequence itself.
+template <typename S, int rows, int cols>
+inline __attribute__((always_inline))
+void run_transform(const TransformProgram<rows, cols>& p, const typename S::type* x, int xs,
+                   typename S::type* y, int ys) {
+  typename S::type t[TransformProgram<rows, cols>::max_values];
+  #pragma GCC unroll 16
+  for (int j = 0; j < cols; j++) {
+    t[j] = x[j * xs];
+  }
+  #pragma GCC unroll 128
+  for (int s = 0; s < p.steps; s++) {
+    const TransformStep& st = p.step[s];
+    switch (st.op) {
+      case TRANSFORM_ADD: t[cols + s] = S::add(t[st.a], t[st.b]); break;
+      case TRANSFORM_SUB: t[cols + s] = S::sub(t[st.a], t[st.b]); break;
+      case TRANSFORM_FMA: t[cols + s] = S::fmadd(S::set1(st.c), t[st.b], t[st.a]); break;
+      case TRANSFORM_NEG: t[cols + s] = S::sub(S::zero(), t[st.a]); break;
+      case TRANSFORM_SCALE: t[cols + s] = S::mul(S::set1(st.c), t[st.a]); break;
+    }
+  }
+  #pragma GCC unroll 16
+  for (int i = 0; i < rows; i++) {
+    y[i * ys] = p.out[i] < 0 ? S::zero() : t[p.out[i]];
+  }
+}
+
+// Scalar double arithmetic for run_transform, for the filter transforms,
+// which sum in double whatever the working precision.
+struct ScalarOps {
+  typedef double type;
+  static type set1(double a) { return a; }
+  static type zero() { return 0; }
+  static type add(type a, type b) { return a + b; }
+  static type sub(type a, type b) { return a - b; }
+  static type mul(type a, type b) { return a * b; }
+  static type fmadd(type a, type b, type c) { return a * b + c; }
+};
+
+#endif
@@ -1,186 +1,315 @@
-/* We are using 3 x 3 filters and an output tile size of 2 x 2. 
- * alpha = m + r - 1 = 4 */
+/* The host program passes the tile sizes in as build options
+ * (-D m=... -D r=... -D alpha=...). Without them we fall back to 3 x 3
+ * filters and an output tile size of 2 x 2, alpha = m + r - 1 = 4.
+ *
+ * The host also puts the transforms of F(m x m, r x r) generated by
+ * transform_program.h in front of this file: the straight-line functions
+ * transform_G, transform_BT and transform_AT, y = G x, B^T x and A^T x for
+ * x[j * xs] and y[i * ys]. The kernels apply them along each axis of a
+ * tile. */
+#ifndef m
 #define m 2
+#endif
+#ifndef r
 #define r 3
-#define alpha 4
+#endif
+#ifndef alpha
+#define alpha (m + r - 1)
+#endif
+
+/* With -D HALF_STORAGE (-t half on the host) U, V and M are stored as
+ * half, which halves the traffic of calc_M, and read and written through
+ * vload_half and vstore_half, which need no cl_khr_fp16. All arithmetic,
+ * the sums of calc_M included, stays in float. */
+#ifdef HALF_STORAGE
+typedef half store_t;
+#define LOAD(p, i) vload_half((i), (p))
+#define STORE(x, p, i) vstore_half((x), (i), (p))
+#else
+typedef float store_t;
+#define LOAD(p, i) ((p)[i])
+#define STORE(x, p, i) ((p)[i] = (x))
+#endif
+
+/* Activations of the epilogue of calc_Y, numbered as enum Activation in
+ * winograd.h. */
+#define ACTIVATION_NONE 0
+#define ACTIVATION_RELU 1
+#define ACTIVATION_RELU6 2
+#define ACTIVATION_LEAKY_RELU 3
+
+float activate(float y, int activation, float slope)
+{
+  switch (activation) {
+    case ACTIVATION_RELU: return fmax(y, 0.0f);
+    case ACTIVATION_RELU6: return clamp(y, 0.0f, 6.0f);
+    case ACTIVATION_LEAKY_RELU: return fmax(y, slope * y);
+    default: return y;
+  }
+}
 
 /* For the filter g located at FILTERS[k][c], computes the transformation
  * u = G * g * G^T. Then, scatters each matrix u into the output U. 
- * G has dimensions (alpha,r)*/
+ * G has dimensions (alpha,r).
+ * FILTERS holds filters of filter_r x filter_r. At stride 2, or when
+ * filter_r is larger than r, every channel of a filter holds
+ * phases = stride^2 * splits^2 sub-filters of r x r (see TileGrid and
+ * polyphase_filter in winograd.h), which are the channels of U: channel c
+ * of U is sub-filter c % phases of channel c / phases of the filter. */
 __kernel void filter_transform(__global float *filters,
-        __constant float *G,
-        __global float *U,
+        __global store_t *U,
         int K,
-        int C)
+        int C,
+        int filter_r,
+        int stride,
+        int splits)
 {
 
   size_t k = get_global_id(0);
   size_t c = get_global_id(1);
 
   if((int) k < K && (int) c < C) {
-    int offset = (k * C + c) * r * r;
+    int phases = stride * stride * splits * splits;
+    int phase = c % phases;
+    int poly = phase / (splits * splits), piece = phase % (splits * splits);
+    int py = poly / stride, px = poly % stride;
+    int oy = r * (piece / splits), ox = r * (piece % splits);
+    int offset = (k * (C / phases) + c / phases) * filter_r * filter_r;
 
-    /* Compute the matrix multiplication:
-     * temp = G * filters[k][c].
-     * temp needs to be size alpha*r = 4*3 = 12 */
-    float temp[12];
-    float sum;
-    for(int i = 0; i < alpha; i++) {
-      for(int j = 0; j < r; j++) {
-        sum = 0;
-        for(int l = 0; l < r; l ++) {
-          sum += G[i*r + l] * filters[offset + l*r + j];
-        }
-        temp[i*r + j] = sum;
+    /* Gather the sub-filter g, zero-padded to r x r. */
+    float g[r*r];
+    for(int a = 0; a < r; a++) {
+      for(int b = 0; b < r; b++) {
+        int i = stride * (oy + a) + py, j = stride * (ox + b) + px;
+        g[a*r + b] = i < filter_r && j < filter_r ? filters[offset + i*filter_r + j] : 0;
       }
     }
 
-    /* Compute the matrix multiplication:
-     * u = temp * G^T. Scatter u into U as follows:
+    float temp[alpha*r];
+    float u[alpha*alpha];
+    /* temp = G * g column by column, then u = temp * G^T row by row. */
+    for(int j = 0; j < r; j++)
+      transform_G(g + j, r, temp + j, r);
+    for(int xi = 0; xi < alpha; xi++)
+      transform_G(temp + xi*r, 1, u + xi*alpha, 1);
+
+    /* Scatter u into U as follows:
      * U[xi][nu][k][c] = u[xi][nu]. */
-    offset = (k * C + c) * alpha * alpha;
-    for(int xi = 0; xi < alpha; xi++){
-      for(int nu = 0; nu < alpha; nu++) {
-        sum = 0;
-        for(int l = 0; l < r; l++) {
-          sum += temp[xi*r + l] * G[nu*r + l];
-        }
-        U[xi*(alpha*K*C) + nu*(K*C) + k*C + c] = sum;
-      }
-    }
+    for(int xi = 0; xi < alpha; xi++)
+      for(int nu = 0; nu < alpha; nu++)
+        STORE(u[xi*alpha + nu], U, xi*(alpha*K*C) + nu*(K*C) + k*C + c);
   }
 }
 
 __kernel void data_transform(__global float *data,
-        __constant float *B,
-        __global float *V,
+        __global store_t *V,
         int C,
         int P,
         int H,
         int W,
         int num_h_tiles,
-        int num_w_tiles)
+        int num_w_tiles,
+        int pad_h,
+        int pad_w,
+        int dilation,
+        int stride,
+        int splits)
 {
-  int c = get_global_id(0);
+  /* The first dimension runs over the C channels of each of the N images
+   * of the batch, whose tiles follow one another along P. At stride 2, or
+   * for filters cut into pieces, every channel of the image is the
+   * phases = stride^2 * splits^2 channels of V of its sub-problems (see
+   * filter_transform); these are gathered here from the image itself. */
+  int phases = stride * stride * splits * splits;
+  int tiles = num_h_tiles * num_w_tiles;
+  int N = P / tiles;
+  int n = get_global_id(0) / (C * phases);
+  int c = get_global_id(0) % (C * phases);
   int block_y = get_global_id(1);
   int block_x = get_global_id(2);
   
-  if (c < C && block_y < num_h_tiles && block_x < num_w_tiles) {
-    int b = block_y * num_w_tiles + block_x;
-    int x = block_x * m;
-    int y = block_y * m;
-
-    /* Compute the matrix multiplication:
-     * temp = B^T * data[c][b], where b is a 1d index 
-     * over the tiles in the image. 
-     * temp needs to be size alpha*alpha = 4*4 = 16 */
-    float temp[16];
-    float sum;
-    for(int i = 0; i < alpha; i++) {
+  if (n < N && block_y < num_h_tiles && block_x < num_w_tiles) {
+    int b = n * tiles + block_y * num_w_tiles + block_x;
+    __global float *image = data + (n*C + c / phases)*(H*W);
+    /* With dilation the tiles of the dilation^2 output phases are stacked
+     * phase-major along each axis (see TileGrid in winograd.h); phase
+     * (dy, dx) is a stride-1 convolution of the image subsampled every
+     * dilation pixels from (dy, dx). (y, x) is the top left corner of the
+     * tile in its phase, moved by piece (piece / splits, piece % splits)
+     * r pixels per step, and the sub-image of polyphase component poly
+     * takes every stride-th pixel from (poly / stride, poly % stride),
+     * as TileGrid::input_pos does. The image is padded by pad_h rows and
+     * pad_w columns of zeros on each side, which are never stored. */
+    int phase = c % phases;
+    int poly = phase / (splits * splits), piece = phase % (splits * splits);
+    int band_h = num_h_tiles / dilation;
+    int band_w = num_w_tiles / dilation;
+    int dy = block_y / band_h;
+    int dx = block_x / band_w;
+    int y = block_y % band_h * m + r * (piece / splits);
+    int x = block_x % band_w * m + r * (piece % splits);
+    int step = stride * dilation;
+    /* (oy, ox) is where the pixels of the tile start in the image: the
+     * output phase, plus the polyphase offset, less the padding. */
+    int oy = dy + poly / stride - pad_h;
+    int ox = dx + poly % stride - pad_w;
+
+    /* Gather the tile d = data[c][b], where b is a 1d index over the
+     * tiles in the image. The padding and the parts of tiles that hang
+     * past the bottom or right edge of the image read as zeros. */
+    float d[alpha*alpha];
+    for(int l = 0; l < alpha; l++) {
+      int iy = step*(y+l) + oy;
       for(int j = 0; j < alpha; j++) {
-        sum = 0;
-        for(int l = 0; l < alpha; l++) {
-          sum += B[l*alpha + i] * data[c*(H*W) + (y+l)*W + (x+j)];
-        }
-        temp[i*alpha + j] = sum;
+        int ix = step*(x+j) + ox;
+        d[l*alpha + j] = iy >= 0 && iy < H && ix >= 0 && ix < W ? image[iy*W + ix] : 0;
       }
     }
 
-    /* Compute the matrix multiplication:
-     * v = temp * B, then scatters v into V as follows:
+    float temp[alpha*alpha];
+    float v[alpha*alpha];
+    /* temp = B^T * d column by column, then v = temp * B row by row. */
+    for(int j = 0; j < alpha; j++)
+      transform_BT(d + j, alpha, temp + j, alpha);
+    for(int xi = 0; xi < alpha; xi++)
+      transform_BT(temp + xi*alpha, 1, v + xi*alpha, 1);
+
+    /* Scatter v into V as follows:
      * V[xi][nu][c][b] = v[xi][nu] */
-    int offset = c*(P*alpha*alpha) + b*(alpha*alpha);
-    for(int xi = 0; xi < alpha; xi++) {
-      for(int nu = 0; nu < alpha; nu++) {
-        sum = 0;
-        for(int l = 0; l < alpha; l++) {
-          sum += temp[xi*alpha + l] * B[l*alpha + nu];
-        }
-        V[xi*(alpha*C*P) + nu*(C*P) + c*P + b] = sum;
-      }
-    }
+    int channels = C * phases;
+    for(int xi = 0; xi < alpha; xi++)
+      for(int nu = 0; nu < alpha; nu++)
+        STORE(v[xi*alpha + nu], V, xi*(alpha*channels*P) + nu*(channels*P) + c*P + b);
   }
 }
 
 /* Computes U[xi][nu] * V[xi][ni], for each matrix in U and V,
- * where U has dimensions (alpha,alpha,K,C), and V has dimensions
- * (alpha,alpha,C,P). Stores U[xi][nu] * V[xi][ni] in M[xi][nu]*/
-__kernel void calc_M (__global float *U,
-        __global float *V,
-        __global float *M,
+ * where U has dimensions (alpha,alpha,K,C/groups), and V has dimensions
+ * (alpha,alpha,C,P). Stores U[xi][nu] * V[xi][ni] in M[xi][nu].
+ * In a grouped convolution filter k only sees the C/groups channels
+ * of its group. */
+__kernel void calc_M (__global store_t *U,
+        __global store_t *V,
+        __global store_t *M,
         int K,
         int P,
-        int C)
+        int C,
+        int groups)
 {
   int k = get_global_id(0);
   int b = get_global_id(1);
   if (k < K && b < P) {
+    int Cg = C / groups;
+    int c0 = k / (K / groups) * Cg;
     float sum;
     for(int xi = 0; xi < alpha; xi++) {
       for(int nu = 0; nu < alpha; nu++) {
         sum = 0;
-        for(int c = 0; c < C; c++) {
-          sum += U[xi*(alpha*K*C) + nu*(K*C) + k*C + c]
-                   * V[xi*(alpha*C*P) + nu*(C*P) + c*P + b];
+        for(int c = 0; c < Cg; c++) {
+          sum += LOAD(U, xi*(alpha*K*Cg) + nu*(K*Cg) + k*Cg + c)
+                   * LOAD(V, xi*(alpha*C*P) + nu*(C*P) + (c0 + c)*P + b);
         }
-        M[xi*(alpha*K*P) + nu*(K*P) + k*P + b] = sum;
+        STORE(sum, M, xi*(alpha*K*P) + nu*(K*P) + k*P + b);
       }
     }
   }
 }
 
+/* calc_M for groups of at most a few channels (depthwise layers): the
+ * product is elementwise along the tiles, so every work item computes a
+ * single element M[xi][nu][k][b]. The first dimension runs over the tiles,
+ * so consecutive work items read consecutive elements of V, and the second
+ * over (xi, nu, k). */
+__kernel void calc_M_depthwise (__global store_t *U,
+        __global store_t *V,
+        __global store_t *M,
+        int K,
+        int P,
+        int C,
+        int groups)
+{
+  int b = get_global_id(0);
+  int e = get_global_id(1);
+  if (e < alpha*alpha*K && b < P) {
+    int k = e % K;
+    int xinu = e / K;
+    int Cg = C / groups;
+    int c0 = k / (K / groups) * Cg;
+    __global store_t *u = U + xinu*(K*Cg) + k*Cg;
+    __global store_t *v = V + xinu*(C*P) + c0*P + b;
+    float sum = 0;
+    for(int c = 0; c < Cg; c++) {
+      sum += LOAD(u, c) * LOAD(v, c*P);
+    }
+    STORE(sum, M, xinu*(K*P) + k*P + b);
+  }
+}
+
 /* Gathers each matrix temp_m from M and computes A^T * temp_m * A.
- * A has dimensions (alpha,m). */
-__kernel void calc_Y(__global float *M,
-        __constant float *A,
+ * A has dimensions (alpha,m). The epilogue is applied to each output value
+ * before it is stored: y = activation(y + bias[k] + residual[n][k][y][x]),
+ * where bias (K values) and residual (shaped like Y) may be NULL. */
+__kernel void calc_Y(__global store_t *M,
         __global float *Y,
         int out_H,
         int out_W,
         int K,
         int P,
         int num_h_tiles,
-        int num_w_tiles)
+        int num_w_tiles,
+        int dilation,
+        __global const float *bias,
+        __global const float *residual,
+        int activation,
+        float slope)
 {
-  int k = get_global_id(0);
+  /* The first dimension runs over the K filters of each of the N images
+   * of the batch. */
+  int tiles = num_h_tiles * num_w_tiles;
+  int N = P / tiles;
+  int n = get_global_id(0) / K;
+  int k = get_global_id(0) % K;
   int block_y = get_global_id(1);
   int block_x = get_global_id(2);
   
-  if (k < K && block_y < num_h_tiles && block_x < num_w_tiles) {
-    int b = block_y * num_w_tiles + block_x;
-    /* temp_m needs to be size alpha*alpha = 4*4 = 16 */
-    float temp_m[16];
+  if (n < N && block_y < num_h_tiles && block_x < num_w_tiles) {
+    int b = n * tiles + block_y * num_w_tiles + block_x;
+    float temp_m[alpha*alpha];
     /* Gather temp_m from M, where:
      * temp_m[xi][nu] = M[xi][nu][k][b]*/
     for(int xi = 0; xi < alpha; xi++) {
       for(int nu = 0; nu < alpha; nu++) {
-        temp_m[xi*alpha + nu] = M[xi*(alpha*K*P) + nu*(K*P)+ k*P + b];
-      }
-    }
-    /* Compute temp_m = A^T * temp. */
-    /* temp needs to be size alpha*m = 4*2 = 8*/
-    float temp[8];
-    float sum;
-    for(int i = 0; i < m; i++) {
-      for(int j = 0; j < alpha; j ++) {
-        sum = 0;
-        for(int l = 0; l < alpha; l++) {
-          sum += A[l*m + i] * temp_m[l*alpha + j];
-        }
-        temp[i*alpha + j] = sum;
+        temp_m[xi*alpha + nu] = LOAD(M, xi*(alpha*K*P) + nu*(K*P)+ k*P + b);
       }
     }
+    float temp[m*alpha];
+    float y_tile[m*m];
+    /* temp = A^T * temp_m column by column, then y_tile = temp * A row by
+     * row. */
+    for(int j = 0; j < alpha; j++)
+      transform_AT(temp_m + j, alpha, temp + j, alpha);
+    for(int i = 0; i < m; i++)
+      transform_AT(temp + i*alpha, 1, y_tile + i*m, 1);
 
-    int x = block_x * m;
-    int y = block_y * m;
+    /* Output phase (dy, dx) and top left corner (y, x) of the tile in
+     * that phase, as in data_transform. */
+    int band_h = num_h_tiles / dilation;
+    int band_w = num_w_tiles / dilation;
+    int dy = block_y / band_h;
+    int dx = block_x / band_w;
+    int y = block_y % band_h * m;
+    int x = block_x % band_w * m;
 
-    /* Compute Y[k][b] = temp_m * A. */
-    for(int i = 0; i < m; i++) {
-      for(int j = 0; j < m; j ++) {
-        sum = 0;
-        for(int l = 0; l < alpha; l++) {
-          sum += temp[i*alpha + l] * A[l*m + j];
-        }
-        Y[k*(out_H*out_W) + (y+i)*out_W + (x+j)] = sum;
+    /* Y[n][k][b] = y_tile, keeping only the part of the tile that lies
+     * inside the output. */
+    float b_k = bias ? bias[k] : 0;
+    for(int i = 0; i < m && dilation*(y+i) + dy < out_H; i++) {
+      for(int j = 0; j < m && dilation*(x+j) + dx < out_W; j ++) {
+        float sum = y_tile[i*m + j] + b_k;
+        int index = (n*K + k)*(out_H*out_W) + (dilation*(y+i) + dy)*out_W + dilation*(x+j) + dx;
+        if (residual)
+          sum += residual[index];
+        Y[index] = activate(sum, activation, slope);
       }
     }
   }
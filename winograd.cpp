@@ -1,138 +1,468 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <string>
 #include <armadillo>
 #include <math.h>
 #include <sys/time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include "filter_pack.h"
+#include "gemm.h"
+#include "tensor.h"
+#include "winograd.h"
 
 using namespace std;
 using namespace arma;
 
 double timestamp();
-void report_winograd_statistics(int K, int C, int P, double time);
+template <int m, int r>
+void report_winograd_statistics(int K, int C, int groups, int P, bool kept_U, double time);
+template <int m, int r>
+void report_backward_filter_statistics(int K, int C, int groups, int P, bool kept_V, double time);
 
-mat** create_fourd_array(int d1, int d2, int d3, int d4) {
-  mat** array = new mat*[d1]();
-  for (int i = 0; i < d1; i++) {
-    array[i] = new mat[d2]();
-    for (int j = 0; j < d2; j++) {
-      array[i][j] = mat(d3, d4);
+// The pass convolute() runs: the forward convolution, its backward-data
+// pass or, as in a training step, the forward convolution followed by the
+// backward-filter pass on the V it keeps.
+enum Pass { FORWARD, BACKWARD_DATA, BACKWARD_FILTER };
+
+// Generates U, an alpha x alpha x K x (C / groups * phases) transformation
+// of the polyphase sub-filters (see TileGrid), directly in BatchedGemm's
+// grouped panel layout. With stride 1 there is a single phase, the filter
+// itself.
+template <int m, int r, int stride, typename Real>
+void transform_filters(int K, int C, int groups, Cube<Real>* filters, Tensor<Real>& U) {
+  typedef Polyphase<r, stride> Split;
+  typedef WinogradConv<m, Split::rs, Real> Conv;
+  const int alpha = Conv::alpha;
+  Real sub[Split::rs * Split::rs];
+  Real u[alpha * alpha];
+  int Kg = K / groups;
+  for (int k = 0; k < K; k++) {
+    for (int c = 0; c < C / groups; c++) {
+      for (int phase = 0; phase < Split::phases; phase++) {
+        polyphase_filter(filters[k].slice_memptr(c), 1, r, r, stride, phase, sub);
+        // flop: K * C * Conv::P::filter_flops()
+        Conv::filter_transform(sub, Split::rs, 1, u);
+        for (int xi = 0; xi < alpha; xi++) {
+          for (int nu = 0; nu < alpha; nu++) {
+            int cp = c * Split::phases + phase;
+            BatchedGemm<Real>::packed(U, xi, nu, Kg, k, cp) = u[xi * alpha + nu];
+          }
+        }
+      }
     }
   }
-  return array;
 }
 
-void free_fourd_array(mat** array, int d1) {
-  for (int i = 0; i < d1; i++) {
-    delete[] array[i];
+// Generates the U of the transposed convolution of the K filters (see
+// TileGrid): C * stride^2 filters, one per output channel and output
+// phase, over the K input channels with their pieces, in the grouped
+// panel layout. The rotated, channel-transposed sub-filters are read
+// straight out of the filters by transposed_filter.
+template <int m, int r, int stride, typename Real>
+void transform_filters_transposed(int K, int C, int groups, Cube<Real>* filters,
+                                  Tensor<Real>& U) {
+  typedef Polyphase<polyphase_size(r, stride), 1> Split;
+  typedef WinogradConv<m, Split::rs, Real> Conv;
+  const int alpha = Conv::alpha;
+  const int up2 = stride * stride;
+  Real sub[Split::rs * Split::rs];
+  Real u[alpha * alpha];
+  int Kg = K / groups, Cg = C / groups;
+  for (int k = 0; k < K; k++) {
+    for (int c = 0; c < Cg; c++) {
+      for (int q = 0; q < up2; q++) {
+        for (int phase = 0; phase < Split::phases; phase++) {
+          transposed_filter(filters[k].slice_memptr(c), 1, r, r, stride, q, phase, sub);
+          // flop: C * K * Conv::P::filter_flops()
+          Conv::filter_transform(sub, Split::rs, 1, u);
+          // filter k of group g is input channel k % Kg of its transpose,
+          // and channel c its output channel g * Cg + c.
+          int kt = (k / Kg * Cg + c) * up2 + q;
+          int ct = k % Kg * Split::phases + phase;
+          for (int xi = 0; xi < alpha; xi++) {
+            for (int nu = 0; nu < alpha; nu++) {
+              BatchedGemm<Real>::packed(U, xi, nu, Cg * up2, kt, ct) =
+                  u[xi * alpha + nu];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+// The F(m x m, rs x rs) pipeline over the tiles of grid: the input transform
+// of the C channels of D, each split into grid.phases() sub-problems, the
+// grouped transform-domain products with the K filters of the packed U
+// and the output transform into Y.
+//
+// By default the whole of V and M is materialised before the output
+// transform runs. In fused mode the tiles instead go through the input
+// transform, the GEMMs and the output transform a cache-sized block at a
+// time, so only one block of V and M is ever live. The output transform
+// applies the epilogue to each tile on the way out. Unfused, the caller can
+// pass keep_V (alpha x alpha x (C * phases) x P) to hold V for the
+// backward-filter pass. Everything runs in the working precision Real.
+template <int m, int rs, typename Real>
+void run_pipeline(const TileGrid& grid, int K, int C, int groups, const Tensor<Real>& U,
+                  const Tensor<Real>& D, Tensor<Real>& Y, bool fused,
+                  const Epilogue<Real>& epilogue, Tensor<Real>* keep_V = NULL) {
+  typedef WinogradConv<m, rs, Real> Conv;
+  typedef BatchedGemm<Real> Gemm;
+  const int alpha = Conv::alpha;
+  int P = grid.P;
+  int phases = grid.phases();
+  int CP = C * phases;
+  int block = fused ? min(P, fused_block_size(alpha * alpha, K, CP, sizeof(Real))) : P;
+  Tensor<Real> V_block(alpha, alpha, CP, keep_V ? 0 : block);
+  Tensor<Real>& V = keep_V ? *keep_V : V_block;
+  Tensor<Real> M(alpha, alpha, K, block);
+
+  for (int b0 = 0; b0 < P; b0 += block) {
+    int nb = min(block, P - b0);
+    // the last block may be short; its matrices are packed densely with nb
+    // columns at the start of each block-sized matrix of V and M.
+    Tensor<Real> Vb(V.data, alpha, alpha, CP, nb, V.stride[0], V.stride[1], nb, 1);
+    Tensor<Real> Mb(M.data, alpha, alpha, K, nb, M.stride[0], M.stride[1], nb, 1);
+
+    // Generates V, an alpha x alpha x (C * phases) x nb transformation of
+    // the image.
+    for (int c = 0; c < C; c++) {
+      for (int phase = 0; phase < phases; phase++) {
+        Conv::input_tiles(D, c, phase, grid, b0, nb, Vb, 0);
+      }
+    }
+
+    // computes M, an alpha x alpha x K x nb matrix
+    for (int xi = 0; xi < alpha; xi++) {
+      for (int nu = 0; nu < alpha; nu++) {
+        // flop: alpha * alpha * K * P * (2C / groups - 1)
+        Gemm::multiply_grouped(U, Vb, Mb, xi, nu, groups);
+      }
+    }
+
+    // computes the final convolution.
+    for (int k = 0; k < K; k++) {
+      Conv::output_tiles(Mb, k, 0, grid, b0, nb, Y, epilogue);
+    }
   }
-  delete[] array;
 }
 
 // input: K filters, C channels, H height, W width, array of filters, image reference,
-// result reference. Modifies result.
-void convolute(int K, int C, int H, int W, cube* filters, cube& image, cube& result) {
+// result reference. Modifies result. The transforms for F(m x m, r x r) come
+// from WinogradConv<m, r, Real> (see winograd.h), the transform-domain
+// products from BatchedGemm (see gemm.h), which wants U pre-packed into
+// panels. Real is the working precision, float unless -P double.
+//
+// With a filter pack U is taken as is from the mapped file and the filters
+// are not transformed at all. The epilogue (bias, activation, residual)
+// is applied by the output transform. keep_V, if given, receives V for
+// the backward-filter pass (see run_pipeline).
+//
+// A strided convolution runs F(m x m, rs x rs) on the stride^2 polyphase
+// sub-problems, which enter the GEMMs as C * stride^2 input channels.
+// A dilated one runs on dilation^2 subsampled images, whose tiles simply
+// add to P; TileGrid does the gathering and scattering with the dilation
+// step. Grouped convolutions multiply each group's slices of U, V and M
+// on their own, and depthwise ones skip the GEMM (see
+// BatchedGemm::multiply_grouped).
+template <int m, int r, int stride, typename Real>
+void convolute(int N, int K, int C, int H, int W, int pad, int dilation, int groups,
+               Cube<Real>* filters, Cube<Real>& image, Cube<Real>& result, bool fused,
+               const FilterPack* pack, const Epilogue<Real>& epilogue,
+               Tensor<Real>* keep_V = NULL) {
+  typedef Polyphase<r, stride> Split;
+  typedef BatchedGemm<Real> Gemm;
   // defining constants and values that follow directly from
   // https://arxiv.org/abs/1509.09308
-  int m = 2;
-  int r = 3;
-  int alpha = m + r - 1;
-  int out_H = H - r + 1;
-  int out_W = W - r + 1;
-  int num_h_tiles = ceil(out_H/m);
-  int num_w_tiles = ceil(out_W/m);
-  int P = num_h_tiles * num_w_tiles;
-  mat G = { {1.0, 0.0, 0.0},
-            {0.5, 0.5, 0.5},
-            {0.5, -0.5, 0.5},
-            {0.0, 0.0, 1.0} };
-  mat B = { {1, 0, 0, 0},
-            {0, 1, -1, 1},
-            {-1, 1, 1, 0},
-            {0, 0, 0, -1} };
-  mat A = { {1, 0},
-            {1, 1},
-            {1, -1},
-            {0, -1}};
-
-  // a helper lambda function that generates b, the tile index,
-  // from the y and x tile coordinates.
-  auto gen_b = [num_h_tiles, num_w_tiles](int y, int x) -> int {
-    return y * num_w_tiles + x;
-  };
+  const int alpha = m + Split::rs - 1;
+  TileGrid grid(m, r, H, W, N, pad, pad, stride, dilation);
+  int CP = C * Split::phases;
+  int Kg = K / groups;
 
-  // factoring out malloc'ing before measuring runtime
-  mat **U = create_fourd_array(alpha, alpha, K, C);
-  mat **V = create_fourd_array(alpha, alpha, C, P);
-  mat**M = new mat*[alpha]();
-  for (int xi = 0; xi < alpha; xi++) {
-    M[xi] = new mat[alpha];
+  // factoring out malloc'ing of U before measuring runtime. U, V and M are
+  // indexed (xi, nu, row, col); see tensor.h for the layout.
+  Tensor<Real>* U = pack ? pack->template tensor<Real>()
+                        : new Tensor<Real>(alpha, alpha, groups * Gemm::panels(Kg),
+                                           CP / groups * Gemm::MR);
+  // views of the image and result cubes as (1, channel, row, col); Armadillo
+  // stores each slice column-major.
+  Tensor<Real> D(image.memptr(), N, C, H, W, (long) C * H * W, (long) H * W, 1, H);
+  Tensor<Real> Y(result.memptr(), N, K, grid.out_H, grid.out_W,
+                 (long) K * grid.out_H * grid.out_W, (long) grid.out_H * grid.out_W,
+                 1, grid.out_H);
+
+  double time = timestamp();
+
+  if (!pack) {
+    transform_filters<m, r, stride>(K, C, groups, filters, *U);
   }
-  
+  run_pipeline<m, Split::rs>(grid, K, C, groups, *U, D, Y, fused, epilogue, keep_V);
+
+  time = timestamp() - time;
+  report_winograd_statistics<m, Split::rs>(K, CP, groups, grid.P, pack != NULL, time);
+  delete U;
+}
+
+// The backward-filter (weight gradient) pass of the convolution above:
+// image holds the N x C channels of its input and grad the N x K channels
+// of the gradient of its output; grad_filters receives the gradient of the
+// K filters, each r x r x (C / groups). Since a tile of the output is
+// A^T (U .* V) A, with u = G g G^T,
+//   dg = G^T (sum over the tiles of (A dy A^T) .* V) G,
+// so the gradient tiles go through the transpose of the output transform
+// into dM, dU = dM V^T is one K x P by P x C product per transform point,
+// reduced over all the tiles, and the transpose of the filter transform
+// maps dU back to the filters. Each polyphase part or piece of a filter
+// gets its own gradient, which is scattered back into place.
+//
+// V is exactly the V of the forward pass; when the caller kept it
+// (kept_V) the input transform is skipped, otherwise it is recomputed.
+template <int m, int r, int stride, typename Real>
+void convolute_backward_filter(int N, int K, int C, int H, int W, int pad, int dilation,
+                               int groups, Cube<Real>& image, Cube<Real>& grad,
+                               Cube<Real>* grad_filters, const Tensor<Real>* kept_V) {
+  typedef Polyphase<r, stride> Split;
+  typedef WinogradConv<m, Split::rs, Real> Conv;
+  typedef BatchedGemm<Real> Gemm;
+  const int alpha = Conv::alpha;
+  const int rs = Split::rs;
+  TileGrid grid(m, r, H, W, N, pad, pad, stride, dilation);
+  int P = grid.P;
+  int CP = C * Split::phases;
+  int Kg = K / groups, CPg = CP / groups;
+
+  Tensor<Real> V_own(alpha, alpha, CP, kept_V ? 0 : P);
+  const Tensor<Real>& V = kept_V ? *kept_V : V_own;
+  // dM is packed like U, with the tiles in place of the channels.
+  Tensor<Real> dM(alpha, alpha, groups * Gemm::panels(Kg), P * Gemm::MR);
+  Tensor<Real> dU(alpha, alpha, K, CPg);
+  Tensor<Real> D(image.memptr(), N, C, H, W, (long) C * H * W, (long) H * W, 1, H);
+  Tensor<Real> DY(grad.memptr(), N, K, grid.out_H, grid.out_W,
+                  (long) K * grid.out_H * grid.out_W, (long) grid.out_H * grid.out_W,
+                  1, grid.out_H);
 
   double time = timestamp();
 
-  // Generates U, an alpha x alpha x K x C transformation of the filters.
-  for (int k = 0; k < K; k++) {
+  if (!kept_V) {
     for (int c = 0; c < C; c++) {
-      // flop: K * C * (4 * 3 * 5) * 2 
-      mat u = G * filters[k].slice(c) * G.t();
-      for (int xi = 0; xi < alpha; xi++) {
-        for (int nu = 0; nu < alpha; nu++) {
-          U[xi][nu](k, c) = u(xi, nu);
-        }
+      for (int phase = 0; phase < Split::phases; phase++) {
+        Conv::input_tiles(D, c, phase, grid, 0, P, V_own, 0);
       }
     }
   }
 
-  // Generates V, an alpha x alpha x C x P transformation of the image.
-  for (int c = 0; c < C; c++) {
-    mat channel = image.slice(c);
-    for (int y = 0; y < num_h_tiles; y++) {
-      for (int x = 0; x < num_w_tiles; x++) {
-        mat d = channel(span(y * m, y * m + alpha - 1), span(x * m, x * m + alpha - 1));
-        // flop: C * P * (4 * 4 * 7) * 2
-        mat v = B.t() * d * B;
-        int b = gen_b(y, x);
-        for (int xi = 0; xi < alpha; xi++) {
-          for (int nu = 0; nu < alpha; nu++) {
-            V[xi][nu](c, b) = v(xi, nu);
-          }
-        }
-      }
-    }
+  for (int k = 0; k < K; k++) {
+    Conv::template gradient_tiles<Gemm>(DY, k, grid, 0, P, dM, 0, Kg);
   }
-  
-  // computes M, an alpha x alpha x K x P matrix
+
   for (int xi = 0; xi < alpha; xi++) {
     for (int nu = 0; nu < alpha; nu++) {
-      // flop: 16 * K * P * (2C - 1) 
-      M[xi][nu] = U[xi][nu] * V[xi][nu];
+      for (int g = 0; g < groups; g++) {
+        // flop: alpha * alpha * K * (C / groups) * (2P - 1)
+        Gemm::multiply_nt_group_block(dM, V, dU, xi, nu, groups, g, 0, Kg, 0, CPg);
+      }
     }
   }
 
-  // computes the final convolution.
-  mat m_hold = zeros<mat>(alpha, alpha);
+  Real du[alpha * alpha];
+  Real dg[rs * rs];
   for (int k = 0; k < K; k++) {
-    for (int y = 0; y < num_h_tiles; y++) {
-      for (int x = 0; x < num_w_tiles; x++) {
-        int b = gen_b(y, x);
+    grad_filters[k].zeros();
+    for (int c = 0; c < C / groups; c++) {
+      for (int phase = 0; phase < Split::phases; phase++) {
         for (int xi = 0; xi < alpha; xi++) {
           for (int nu = 0; nu < alpha; nu++) {
-            m_hold(xi, nu) = M[xi][nu](k, b);
+            du[xi * alpha + nu] = dU(xi, nu, k, c * Split::phases + phase);
           }
         }
-        // flop: K * P * (2 * 4 * 7) * 2
-        result.slice(k)(span(y*m, (y+1)*m-1), span(x*m, (x+1)*m-1)) = A.t() * m_hold * A;
+        // flop: K * C * Conv::P::filter_gradient_flops()
+        Conv::filter_gradient(du, dg);
+        polyphase_scatter(dg, 1, r, r, stride, phase, grad_filters[k].slice_memptr(c));
       }
     }
   }
 
   time = timestamp() - time;
-  report_winograd_statistics(K, C, P, time);
+  report_backward_filter_statistics<m, rs>(K, CP, groups, P, kept_V != NULL, time);
+}
+
+// One training step's worth of the convolution: the forward pass, keeping
+// V unless fused, and the backward-filter pass on it.
+template <int m, int r, int stride, typename Real>
+void convolute_and_backward_filter(int N, int K, int C, int H, int W, int pad, int dilation,
+                                   int groups, Cube<Real>* filters, Cube<Real>& image,
+                                   Cube<Real>& result, bool fused, Cube<Real>& grad,
+                                   Cube<Real>* grad_filters) {
+  typedef Polyphase<r, stride> Split;
+  const int alpha = m + Split::rs - 1;
+  TileGrid grid(m, r, H, W, N, pad, pad, stride, dilation);
+  Tensor<Real> V(alpha, alpha, C * Split::phases, fused ? 0 : grid.P);
+  convolute<m, r, stride>(N, K, C, H, W, pad, dilation, groups, filters, image, result, fused,
+                          NULL, Epilogue<Real>(), fused ? NULL : &V);
+  convolute_backward_filter<m, r, stride>(N, K, C, H, W, pad, dilation, groups, image, grad,
+                                          grad_filters, fused ? NULL : &V);
+}
+
+// The backward-data pass of the convolution above, which is also a
+// transposed convolution (deconvolution) layer: image holds N x K channels
+// of H x W (the gradient of the forward output) and result receives N x C
+// channels of out_H x out_W (the gradient of the forward input, or the
+// upsampled output of a decoder layer). It is a convolution with the
+// rotated filters with K and C swapped. U is built for it directly from
+// the forward filters, and the tiles then run through the same pipeline.
+// With stride 2 every output phase is a separate stride-1 problem (see
+// TileGrid::transposed), which keeps the Winograd tiles dense instead of
+// multiplying by the zeros of an upsampled input.
+template <int m, int r, int stride, typename Real>
+void convolute_backward_data(int N, int K, int C, int H, int W, int pad, int dilation,
+                             int groups, Cube<Real>* filters, Cube<Real>& image,
+                             Cube<Real>& result, bool fused, const Epilogue<Real>& epilogue) {
+  typedef Polyphase<polyphase_size(r, stride), 1> Split;
+  typedef BatchedGemm<Real> Gemm;
+  const int alpha = m + Split::rs - 1;
+  int out_H = result.n_rows, out_W = result.n_cols;
+  TileGrid grid = TileGrid::transposed(m, r, H, W, N, pad, stride, dilation, out_H, out_W);
+  int KP = K * Split::phases;
+  int CQ = C * stride * stride;
+
+  Tensor<Real> U(alpha, alpha, groups * Gemm::panels(CQ / groups), KP / groups * Gemm::MR);
+  Tensor<Real> D(image.memptr(), N, K, H, W, (long) K * H * W, (long) H * W, 1, H);
+  Tensor<Real> Y(result.memptr(), N, C, out_H, out_W, (long) C * out_H * out_W,
+                 (long) out_H * out_W, 1, out_H);
+
+  double time = timestamp();
+
+  transform_filters_transposed<m, r, stride>(K, C, groups, filters, U);
+  run_pipeline<m, Split::rs>(grid, CQ, K, groups, U, D, Y, fused, epilogue);
+
+  time = timestamp() - time;
+  report_winograd_statistics<m, Split::rs>(CQ, KP, groups, grid.P, false, time);
+}
+
+// Picks the F(m x m, r x r) instantiation for the requested output tile
+// size, filter size and stride, one template parameter at a time, and the
+// pass. The epilogue applies to the forward and backward-data passes, grad
+// and grad_filters are only used by the backward-filter pass. A pack must
+// hold U as Real.
+template <int m, int r, int stride, typename Real>
+void convolute_pass(Pass pass, int N, int K, int C, int H, int W, int pad, int dilation,
+                    int groups, Cube<Real>* filters, Cube<Real>& image, Cube<Real>& result,
+                    bool fused, const FilterPack* pack, const Epilogue<Real>& epilogue,
+                    Cube<Real>* grad, Cube<Real>* grad_filters) {
+  switch (pass) {
+    case FORWARD:
+      convolute<m, r, stride>(N, K, C, H, W, pad, dilation, groups, filters, image, result,
+                              fused, pack, epilogue);
+      break;
+    case BACKWARD_DATA:
+      convolute_backward_data<m, r, stride>(N, K, C, H, W, pad, dilation, groups, filters,
+                                            image, result, fused, epilogue);
+      break;
+    case BACKWARD_FILTER:
+      convolute_and_backward_filter<m, r, stride>(N, K, C, H, W, pad, dilation, groups,
+                                                  filters, image, result, fused, *grad,
+                                                  grad_filters);
+      break;
+  }
+}
+
+template <int m, int r, typename Real>
+void convolute_stride(int stride, Pass pass, int N, int K, int C, int H, int W, int pad,
+                      int dilation, int groups, Cube<Real>* filters, Cube<Real>& image,
+                      Cube<Real>& result, bool fused, const FilterPack* pack,
+                      const Epilogue<Real>& epilogue, Cube<Real>* grad,
+                      Cube<Real>* grad_filters) {
+  if (stride == 1) {
+    convolute_pass<m, r, 1>(pass, N, K, C, H, W, pad, dilation, groups, filters, image, result,
+                            fused, pack, epilogue, grad, grad_filters);
+  } else {
+    convolute_pass<m, r, 2>(pass, N, K, C, H, W, pad, dilation, groups, filters, image, result,
+                            fused, pack, epilogue, grad, grad_filters);
+  }
+}
+
+template <int m, typename Real>
+void convolute_filter(int r, int stride, Pass pass, int N, int K, int C, int H, int W,
+                      int pad, int dilation, int groups, Cube<Real>* filters, Cube<Real>& image,
+                      Cube<Real>& result, bool fused, const FilterPack* pack,
+                      const Epilogue<Real>& epilogue, Cube<Real>* grad,
+                      Cube<Real>* grad_filters) {
+  switch (r) {
+    case 3: convolute_stride<m, 3>(stride, pass, N, K, C, H, W, pad, dilation, groups,
+                                   filters, image, result, fused, pack, epilogue,
+                                   grad, grad_filters); break;
+    case 5: convolute_stride<m, 5>(stride, pass, N, K, C, H, W, pad, dilation, groups,
+                                   filters, image, result, fused, pack, epilogue,
+                                   grad, grad_filters); break;
+    case 7: convolute_stride<m, 7>(stride, pass, N, K, C, H, W, pad, dilation, groups,
+                                   filters, image, result, fused, pack, epilogue,
+                                   grad, grad_filters); break;
+  }
+}
+
+template <typename Real>
+void convolute(int m, int r, int stride, Pass pass, int N, int K, int C, int H, int W,
+               int pad, int dilation, int groups, Cube<Real>* filters, Cube<Real>& image,
+               Cube<Real>& result, bool fused, const FilterPack* pack,
+               const Epilogue<Real>& epilogue, Cube<Real>* grad, Cube<Real>* grad_filters) {
+  switch (m) {
+    case 2: convolute_filter<2>(r, stride, pass, N, K, C, H, W, pad, dilation, groups,
+                                filters, image, result, fused, pack, epilogue,
+                                grad, grad_filters); break;
+    case 4: convolute_filter<4>(r, stride, pass, N, K, C, H, W, pad, dilation, groups,
+                                filters, image, result, fused, pack, epilogue,
+                                grad, grad_filters); break;
+    case 6: convolute_filter<6>(r, stride, pass, N, K, C, H, W, pad, dilation, groups,
+                                filters, image, result, fused, pack, epilogue,
+                                grad, grad_filters); break;
+  }
+}
+
+// Transforms the filters once and saves U as a filter pack (filter_pack.h)
+// in the working precision.
+template <int m, int r, int stride, typename Real>
+bool pack_filters(int K, int C, int groups, Cube<Real>* filters, const char* path) {
+  typedef Polyphase<r, stride> Split;
+  typedef BatchedGemm<Real> Gemm;
+  const int alpha = m + Split::rs - 1;
+  Tensor<Real> U(alpha, alpha, groups * Gemm::panels(K / groups),
+                 C / groups * Split::phases * Gemm::MR);
+  transform_filters<m, r, stride>(K, C, groups, filters, U);
+  return write_filter_pack(path, m, r, stride, groups, K, C, U);
+}
+
+template <int m, int r, typename Real>
+bool pack_filters_stride(int stride, int K, int C, int groups, Cube<Real>* filters,
+                         const char* path) {
+  if (stride == 1) {
+    return pack_filters<m, r, 1>(K, C, groups, filters, path);
+  }
+  return pack_filters<m, r, 2>(K, C, groups, filters, path);
+}
 
-  free_fourd_array(U, alpha);
-  free_fourd_array(V, alpha);
-  free_fourd_array(M, alpha);
+template <int m, typename Real>
+bool pack_filters_filter(int r, int stride, int K, int C, int groups, Cube<Real>* filters,
+                         const char* path) {
+  switch (r) {
+    case 3: return pack_filters_stride<m, 3>(stride, K, C, groups, filters, path);
+    case 5: return pack_filters_stride<m, 5>(stride, K, C, groups, filters, path);
+    case 7: return pack_filters_stride<m, 7>(stride, K, C, groups, filters, path);
+  }
+  return false;
+}
+
+template <typename Real>
+bool pack_filters(int m, int r, int stride, int K, int C, int groups, Cube<Real>* filters,
+                  const char* path) {
+  switch (m) {
+    case 2: return pack_filters_filter<2>(r, stride, K, C, groups, filters, path);
+    case 4: return pack_filters_filter<4>(r, stride, K, C, groups, filters, path);
+    case 6: return pack_filters_filter<6>(r, stride, K, C, groups, filters, path);
+  }
+  return false;
 }
 
 double timestamp()
@@ -142,11 +472,36 @@ double timestamp()
   return tv.tv_sec + 1e-6*tv.tv_usec;
 }
 
-void report_winograd_statistics(int K, int C, int P, double time) {
-  int flop = (K * C * (4 * 3 * 5) * 2 +
-              C * P * (4 * 4 * 7) * 2 + 
-              16 * K * P * (2 * C - 1) + 
-              K * P * (2 * 4 * 7) * 2);
+// C input channels split into the given number of groups; the filter
+// transform only counts when U was not kept (taken from a filter pack). The
+// transforms count the flops of their generated programs (see
+// TransformPrograms).
+template <int m, int r>
+void report_winograd_statistics(int K, int C, int groups, int P, bool kept_U, double time) {
+  typedef TransformPrograms<m, r> Programs;
+  long int alpha = m + r - 1;
+  long int Cg = C / groups;
+  long int flop = ((kept_U ? 0 : K * Cg * Programs::filter_flops()) +
+                   C * P * Programs::input_flops() +
+                   alpha * alpha * K * P * (2 * Cg - 1) +
+                   K * P * Programs::output_flops());
+  double mflops = flop / (1024.0 * 1024.0 * time);
+  cout << "Floating point operations: " << flop << "\n";
+  cout << "Time Elapsed: " << time << "\n";
+  cout << "MFlop/s: " << mflops << "\n";
+}
+
+// The backward-filter pass over C input channels (with their phases) in
+// groups; the input transform only counts when V was not kept.
+template <int m, int r>
+void report_backward_filter_statistics(int K, int C, int groups, int P, bool kept_V, double time) {
+  typedef TransformPrograms<m, r> Programs;
+  long int alpha = m + r - 1;
+  long int Cg = C / groups;
+  long int flop = ((kept_V ? 0 : C * P * Programs::input_flops()) +
+                   K * P * Programs::gradient_flops() +
+                   alpha * alpha * K * Cg * (2 * P - 1) +
+                   K * Cg * Programs::filter_gradient_flops());
   double mflops = flop / (1024.0 * 1024.0 * time);
   cout << "Floating point operations: " << flop << "\n";
   cout << "Time Elapsed: " << time << "\n";
@@ -155,52 +510,307 @@ void report_winograd_statistics(int K, int C, int P, double time) {
 
 int main(int argc, char* argv[])
 {
-  if (argc != 3) {
-    cout << "Usage: ./winograd <input filename> <output filename>\n";
+  // -m picks the output tile size, -r the filter size (3, 5 or 7), -f the
+  // fused (cache-blocked) pipeline, -p the zero padding (valid, same or a
+  // width), -s the stride (1 or 2), -d the dilation, -g the number of
+  // groups (C for depthwise) and -u a filter pack to use instead of
+  // transforming the filters. -b runs the backward-data pass (a transposed
+  // convolution) instead: the input then holds N x K channels and the
+  // output N x C, enlarged by -o extra rows and columns of output padding.
+  // -w runs the forward pass followed by the backward-filter pass, as a
+  // training step does: it reads the gradient of the output from the second
+  // file and writes the gradient of the filters to the third. -a applies an
+  // activation (relu, relu6 or leaky[:slope]) to the output, -B adds the
+  // per-channel biases of a file and -R a residual in the format of an
+  // output file, all inside the output transform (see Epilogue).
+  // -P double reads, computes and writes everything in double instead of
+  // float (see parse_precision). --pack-filters transforms the filters of
+  // the input and writes them to the second file as a filter pack, in that
+  // precision, instead of convolving; -u only takes a pack of the same
+  // precision.
+  int m = 2;
+  bool fused = false;
+  const char* pad_arg = "valid";
+  int pad = 0;
+  int stride = 1;
+  int dilation = 1;
+  int groups = 1;
+  int r = 3;
+  bool backward = false;
+  bool weights = false;
+  const char* activation_arg = "none";
+  const char* bias_filename = NULL;
+  const char* residual_filename = NULL;
+  int output_padding = 0;
+  const char* precision_arg = "float";
+  bool pack_mode = false;
+  const char* pack_filename = NULL;
+  bool bad_usage = false;
+  // --pack-filters has no short form.
+  const int PACK_FILTERS = 256;
+  static struct option long_options[] = {
+    {"pack-filters", no_argument, NULL, PACK_FILTERS},
+    {NULL, 0, NULL, 0}
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "m:r:fp:s:d:g:u:bo:wa:B:R:P:", long_options, NULL)) !=
+         -1) {
+    switch (opt) {
+      case 'm': m = atoi(optarg); break;
+      case 'r': r = atoi(optarg); break;
+      case 'f': fused = true; break;
+      case 'p': pad_arg = optarg; break;
+      case 's': stride = atoi(optarg); break;
+      case 'd': dilation = atoi(optarg); break;
+      case 'g': groups = atoi(optarg); break;
+      case 'u': pack_filename = optarg; break;
+      case 'b': backward = true; break;
+      case 'o': output_padding = atoi(optarg); break;
+      case 'w': weights = true; break;
+      case 'a': activation_arg = optarg; break;
+      case 'B': bias_filename = optarg; break;
+      case 'R': residual_filename = optarg; break;
+      case 'P': precision_arg = optarg; break;
+      case PACK_FILTERS: pack_mode = true; break;
+      default: bad_usage = true;
+    }
+  }
+  // "same" padding depends on the dilated filter extent.
+  if (!parse_padding(pad_arg, dilation * (r - 1) + 1, pad)) {
+    bad_usage = true;
+  }
+  Activation activation;
+  double slope = 0.01;
+  if (!parse_activation(activation_arg, activation, slope)) {
+    bad_usage = true;
+  }
+  bool use_double;
+  if (!parse_precision(precision_arg, use_double)) {
+    bad_usage = true;
+  }
+  bool has_epilogue = activation != ACTIVATION_NONE || bias_filename || residual_filename;
+  if (bad_usage || argc - optind != (weights ? 3 : 2) || (pack_mode && pack_filename) ||
+      ((backward || weights) && (pack_mode || pack_filename)) || (backward && weights) ||
+      ((weights || pack_mode) && has_epilogue)) {
+    cout << "Usage: ./winograd [-m tile size (2, 4 or 6)] [-r filter size (3, 5 or 7)] [-f] [-p valid|same|padding] [-s stride] [-d dilation] [-g groups] [-P float|double] [-u filter pack] [-a none|relu|relu6|leaky[:slope]] [-B bias file] [-R residual file] <input filename> <output filename>\n";
+    cout << "       ./winograd -b [-o output padding] [-m tile size (2, 4 or 6)] [-r filter size (3, 5 or 7)] [-f] [-p valid|same|padding] [-s stride] [-d dilation] [-g groups] [-P float|double] [-a none|relu|relu6|leaky[:slope]] [-B bias file] [-R residual file] <input filename> <output filename>\n";
+    cout << "       ./winograd -w [-m tile size (2, 4 or 6)] [-r filter size (3, 5 or 7)] [-f] [-p valid|same|padding] [-s stride] [-d dilation] [-g groups] [-P float|double] <input filename> <output gradient filename> <filter gradient filename>\n";
+    cout << "       ./winograd --pack-filters [-m tile size (2, 4 or 6)] [-r filter size (3, 5 or 7)] [-s stride] [-g groups] [-P float|double] <input filename> <filter pack filename>\n";
+    return 1;
+  }
+  if (m != 2 && m != 4 && m != 6) {
+    cout << "Error: Output tile size must be 2, 4 or 6." << endl;
+    return 1;
+  }
+  if (r != 3 && r != 5 && r != 7) {
+    cout << "Error: Filter size must be 3, 5 or 7." << endl;
+    return 1;
+  }
+  if (stride != 1 && stride != 2) {
+    cout << "Error: Stride must be 1 or 2." << endl;
+    return 1;
+  }
+  if (dilation < 1 || (dilation > 1 && stride > 1)) {
+    cout << "Error: Dilation must be at least 1, and 1 with stride 2." << endl;
+    return 1;
+  }
+  // the sub-problems of a transposed convolution need pad / stride <=
+  // dilation * (R - 1) to cover the output (see TileGrid::transposed).
+  if (backward && (output_padding < 0 || output_padding >= stride ||
+                   pad / stride > dilation * (polyphase_size(r, stride) - 1))) {
+    cout << "Error: Output padding must be below the stride, and the padding at most the dilated filter size minus 1." << endl;
+    return 1;
+  }
+  FilterPack pack;
+  if (pack_filename && !pack.open(pack_filename, m, r, stride)) {
+    return 1;
+  }
+  if (pack_filename && (use_double ? !pack.holds<double>() : !pack.holds<float>())) {
+    cout << "Error: Filter pack holds " << pack.precision() << " filters; run with -P "
+         << pack.precision() << "." << endl;
+    return 1;
   }
   ifstream file;
-  file.open(argv[1]);
-  int K, C, H, W;
-  file >> K >> C >> H >> W;
+  file.open(argv[optind]);
+  // the header is "K C H W", or "K C H W N" for a batch of N images.
+  int K, C, H, W, N = 1;
+  string header;
+  getline(file, header);
+  istringstream header_fields(header);
+  header_fields >> K >> C >> H >> W;
+  if (!(header_fields >> N)) {
+    N = 1;
+  }
 
-  if (H % 2 != 0 || W % 2 != 0) {
-    cout << "Error: Image dimensions must be even." << endl;
+  if (groups < 1 || K % groups != 0 || C % groups != 0) {
+    cout << "Error: The number of groups must divide both K and C." << endl;
+    return 1;
+  }
+  if (pack_filename && (pack.header.K != K || pack.header.C != C ||
+                        pack.header.groups != groups)) {
+    cout << "Error: Filter pack holds " << pack.header.K << " filters of " << pack.header.C
+         << " channels in " << pack.header.groups << " groups, the input " << K << " of "
+         << C << " in " << groups << "." << endl;
     return 1;
   }
 
-  cube* filters = new cube[K]();
-  for (int i = 0; i < K; i++) {
-    filters[i] = cube(3, 3, C);
-    for (int j = 0; j < C; j++) {
-      for (int row = 0; row < 3; row++) {
-        for (int col = 0; col < 3; col ++) {
-          file >> filters[i](row, col, j);
+  // the dilated filter spans extent x extent pixels.
+  int extent = dilation * (r - 1) + 1;
+  if (!backward && (H + 2 * pad < extent || W + 2 * pad < extent)) {
+    cout << "Error: Padded image is smaller than the filter." << endl;
+    return 1;
+  }
+
+  // from here on the filters, images and outputs are read, convolved and
+  // written in the working precision.
+  auto run = [&](auto zero) {
+    typedef decltype(zero) Real;
+    Epilogue<Real> epilogue;
+    epilogue.activation = activation;
+    epilogue.slope = slope;
+
+    // with a filter pack the filters are only read past. Each filter spans
+    // the C / groups channels of its group.
+    Cube<Real>* filters = new Cube<Real>[K]();
+    for (int i = 0; i < K; i++) {
+      filters[i] = Cube<Real>(r, r, C / groups);
+      for (int j = 0; j < C / groups; j++) {
+        for (int row = 0; row < r; row++) {
+          for (int col = 0; col < r; col ++) {
+            file >> filters[i](row, col, j);
+          }
         }
       }
     }
-  }
 
-  cube image = cube(H, W, C);
-  for (int c = 0; c < C; c++) {
-    for (int row = 0; row < H; row++) {
-      for (int col = 0; col < W; col++) {
-        file >> image(row, col, c);
+    if (pack_mode) {
+      file.close();
+      bool ok = pack_filters(m, r, stride, K, C, groups, filters, argv[optind + 1]);
+      delete[] filters;
+      if (!ok) {
+        cout << "Error: Cannot write filter pack " << argv[optind + 1] << "." << endl;
+        return 1;
       }
+      return 0;
     }
-  }
-  file.close();
 
-  cube result = cube(H-3+1, W-3+1, K);
-  convolute(K, C, H, W, filters, image, result);
+    // slice n * C + c holds channel c of image n. The backward-data pass
+    // reads the K channels of a gradient of the output instead.
+    int in_C = backward ? K : C, out_C = backward ? C : K;
+    Cube<Real> image = Cube<Real>(H, W, N * in_C);
+    for (int i = 0; i < N * in_C; i++) {
+      for (int row = 0; row < H; row++) {
+        for (int col = 0; col < W; col++) {
+          file >> image(row, col, i);
+        }
+      }
+    }
+    file.close();
 
-  ofstream fileout;
-  fileout.open(argv[2], ofstream::out | ofstream::trunc );
-  fileout << K << " " << C << " " << H << " " << W << endl;
-  for (int i = 0; i < K; i++) {
-    fileout << result.slice(i) << "\n";
-  }
-  fileout.close();
+    int out_H = (H + 2 * pad - extent) / stride + 1, out_W = (W + 2 * pad - extent) / stride + 1;
+    if (backward) {
+      out_H = (H - 1) * stride - 2 * pad + extent + output_padding;
+      out_W = (W - 1) * stride - 2 * pad + extent + output_padding;
+    }
+    if (out_H < 1 || out_W < 1) {
+      cout << "Error: The padding leaves no output." << endl;
+      return 1;
+    }
+    Cube<Real> result = Cube<Real>(out_H, out_W, N * out_C);
 
-  delete[] filters;
-  return 0;
+    if (weights) {
+      // the gradient of the output comes in the format of an output file.
+      Cube<Real> grad = Cube<Real>(out_H, out_W, N * K);
+      file.open(argv[optind + 1]);
+      string grad_header;
+      getline(file, grad_header);
+      for (int i = 0; i < N * K; i++) {
+        for (int row = 0; row < out_H; row++) {
+          for (int col = 0; col < out_W; col++) {
+            file >> grad(row, col, i);
+          }
+        }
+      }
+      file.close();
+
+      Cube<Real>* grad_filters = new Cube<Real>[K]();
+      for (int i = 0; i < K; i++) {
+        grad_filters[i] = Cube<Real>(r, r, C / groups);
+      }
+      convolute<Real>(m, r, stride, BACKWARD_FILTER, N, K, C, H, W, pad, dilation, groups,
+                      filters, image, result, fused, NULL, epilogue, &grad, grad_filters);
+
+      // K x (C / groups) filter slices, under the header of the input.
+      ofstream fileout;
+      fileout.open(argv[optind + 2], ofstream::out | ofstream::trunc );
+      fileout << K << " " << C << " " << H << " " << W;
+      if (N > 1) {
+        fileout << " " << N;
+      }
+      fileout << endl;
+      for (int i = 0; i < K; i++) {
+        for (int j = 0; j < C / groups; j++) {
+          fileout << grad_filters[i].slice(j) << "\n";
+        }
+      }
+      fileout.close();
+
+      delete[] grad_filters;
+      delete[] filters;
+      return 0;
+    }
+
+    // one bias per output channel.
+    vec bias;
+    if (bias_filename) {
+      file.open(bias_filename);
+      bias = vec(out_C);
+      for (int i = 0; i < out_C; i++) {
+        file >> bias(i);
+      }
+      file.close();
+      epilogue.bias = bias.memptr();
+    }
+    // the residual comes in the format of an output file.
+    Cube<Real> residual;
+    if (residual_filename) {
+      residual = Cube<Real>(out_H, out_W, N * out_C);
+      file.open(residual_filename);
+      string residual_header;
+      getline(file, residual_header);
+      for (int i = 0; i < N * out_C; i++) {
+        for (int row = 0; row < out_H; row++) {
+          for (int col = 0; col < out_W; col++) {
+            file >> residual(row, col, i);
+          }
+        }
+      }
+      file.close();
+    }
+    Tensor<Real> R(residual.memptr(), N, out_C, out_H, out_W, (long) out_C * out_H * out_W,
+                   (long) out_H * out_W, 1, out_H);
+    if (residual_filename) {
+      epilogue.residual = &R;
+    }
+
+    convolute<Real>(m, r, stride, backward ? BACKWARD_DATA : FORWARD, N, K, C, H, W, pad,
+                    dilation, groups, filters, image, result, fused,
+                    pack_filename ? &pack : NULL, epilogue, NULL, NULL);
+
+    ofstream fileout;
+    fileout.open(argv[optind + 1], ofstream::out | ofstream::trunc );
+    fileout << K << " " << C << " " << H << " " << W;
+    if (N > 1) {
+      fileout << " " << N;
+    }
+    fileout << endl;
+    for (int i = 0; i < N * out_C; i++) {
+      fileout << result.slice(i) << "\n";
+    }
+    fileout.close();
+
+    delete[] filters;
+    return 0;
+  };
+  return use_double ? run(0.0) : run(0.0f);
 }
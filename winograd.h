@@ -0,0 +1,1244 @@
+#ifndef __WINOGRAD_H
+#define __WINOGRAD_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include "simd.h"
+#include "tensor.h"
+#include "transform_program.h"
+
+// Winograd minimal filtering F(m x m, r x r) from
+// https://arxiv.org/abs/1509.09308.
+//
+// Rather than typing G, B and A in by hand for every tile size, they are
+// generated at compile time with the Cook-Toom construction: the product
+// of two polynomials is evaluated at alpha - 1 finite points plus the point
+// at infinity and interpolated back. Transposing that linear convolution
+// gives the correlation y = A^T [(G g G^T) .* (B^T d B)] A.
+
+// The i-th finite interpolation point: 0, 1, -1, 2, -2, 1/2, -1/2, 3, -3,
+// 1/3, -1/3, ... Small magnitudes keep the transforms well conditioned.
+constexpr double cook_toom_point(int i) {
+  if (i == 0) {
+    return 0.0;
+  }
+  int q = (i - 1) / 2;
+  double sign = (i - 1) % 2 == 0 ? 1.0 : -1.0;
+  if (q == 0) {
+    return sign;
+  }
+  double n = (q + 1) / 2 + 1;
+  return q % 2 == 1 ? sign * n : sign / n;
+}
+
+// G is alpha x r, BT is alpha x alpha (= B^T) and AT is m x alpha (= A^T).
+// The finite points a_0 .. a_{alpha-2} fill the first alpha - 1 rows and
+// the point at infinity the last one:
+//   AT[j][i] = a_i^j
+//   G[i][j]  = a_i^j / prod_{k != i} (a_i - a_k)
+//   BT[i]    = coefficients of prod_{k != i} (x - a_k)
+// For m = 4, r = 3 this reproduces the matrices printed in the paper.
+// A (alpha x m) is kept as well, for the gradient of the output transform,
+// and GT (r x alpha, = G^T) for that of the filter transform.
+template <int m, int r>
+struct CookToom {
+  static constexpr int alpha = m + r - 1;
+  double G[alpha][r];
+  double BT[alpha][alpha];
+  double AT[m][alpha];
+  double A[alpha][m];
+  double GT[r][alpha];
+
+  constexpr CookToom() : G(), BT(), AT(), A(), GT() {
+    const int n = alpha - 1;
+    double a[alpha] = {};
+    for (int i = 0; i < n; i++) {
+      a[i] = cook_toom_point(i);
+    }
+
+    for (int j = 0; j < m; j++) {
+      for (int i = 0; i < n; i++) {
+        double p = 1.0;
+        for (int e = 0; e < j; e++) {
+          p *= a[i];
+        }
+        AT[j][i] = p;
+      }
+      AT[j][n] = j == m - 1 ? 1.0 : 0.0;
+    }
+
+    for (int i = 0; i < n; i++) {
+      double f = 1.0;
+      for (int k = 0; k < n; k++) {
+        if (k != i) {
+          f *= a[i] - a[k];
+        }
+      }
+      double p = 1.0;
+      for (int j = 0; j < r; j++) {
+        G[i][j] = p / f;
+        p *= a[i];
+      }
+    }
+    for (int j = 0; j < r; j++) {
+      G[n][j] = j == r - 1 ? 1.0 : 0.0;
+    }
+
+    // row n is the full product over every finite point.
+    for (int i = 0; i <= n; i++) {
+      double poly[alpha] = {};
+      poly[0] = 1.0;
+      int degree = 0;
+      for (int k = 0; k < n; k++) {
+        if (k == i) {
+          continue;
+        }
+        // poly *= (x - a_k)
+        degree++;
+        for (int j = degree; j > 0; j--) {
+          poly[j] = poly[j - 1] - a[k] * poly[j];
+        }
+        poly[0] = -a[k] * poly[0];
+      }
+      for (int j = 0; j < alpha; j++) {
+        BT[i][j] = poly[j];
+      }
+    }
+
+    for (int i = 0; i < alpha; i++) {
+      for (int j = 0; j < m; j++) {
+        A[i][j] = AT[j][i];
+      }
+      for (int j = 0; j < r; j++) {
+        GT[j][i] = G[i][j];
+      }
+    }
+  }
+};
+
+// The transforms of F(m x m, r x r) as straight-line programs (see
+// transform_program.h), each applied along one axis at a time: G to the
+// filters, B^T to the input tiles, A^T to the output tiles, A to the
+// tiles of the gradient of the output and G^T to the gradient of U.
+template <int m, int r>
+struct TransformPrograms {
+  static constexpr int alpha = m + r - 1;
+  static constexpr CookToom<m, r> T = CookToom<m, r>();
+  static constexpr TransformProgram<alpha, r> G = TransformProgram<alpha, r>(T.G);
+  static constexpr TransformProgram<alpha, alpha> BT = TransformProgram<alpha, alpha>(T.BT);
+  static constexpr TransformProgram<m, alpha> AT = TransformProgram<m, alpha>(T.AT);
+  static constexpr TransformProgram<alpha, m> A = TransformProgram<alpha, m>(T.A);
+  static constexpr TransformProgram<r, alpha> GT = TransformProgram<r, alpha>(T.GT);
+
+  // Flops of the 2-D transforms of one filter (G g G^T), input tile
+  // (B^T d B), output tile (A^T M A) and output gradient tile (A dY A^T).
+  static constexpr long filter_flops() { return (r + alpha) * G.flops(); }
+  static constexpr long input_flops() { return 2 * alpha * BT.flops(); }
+  static constexpr long output_flops() { return (alpha + m) * AT.flops(); }
+  static constexpr long gradient_flops() { return (m + alpha) * A.flops(); }
+  static constexpr long filter_gradient_flops() { return (alpha + r) * GT.flops(); }
+};
+
+template <int m, int r>
+constexpr CookToom<m, r> TransformPrograms<m, r>::T;
+template <int m, int r>
+constexpr TransformProgram<TransformPrograms<m, r>::alpha, r> TransformPrograms<m, r>::G;
+template <int m, int r>
+constexpr TransformProgram<TransformPrograms<m, r>::alpha, TransformPrograms<m, r>::alpha>
+    TransformPrograms<m, r>::BT;
+template <int m, int r>
+constexpr TransformProgram<m, TransformPrograms<m, r>::alpha> TransformPrograms<m, r>::AT;
+template <int m, int r>
+constexpr TransformProgram<TransformPrograms<m, r>::alpha, m> TransformPrograms<m, r>::A;
+template <int m, int r>
+constexpr TransformProgram<r, TransformPrograms<m, r>::alpha> TransformPrograms<m, r>::GT;
+
+// Size of the cache the fused pipeline blocks for (per core). Haswell has
+// 256 KB of L2; build with -DL2_CACHE_BYTES=... for other parts.
+#ifndef L2_CACHE_BYTES
+#define L2_CACHE_BYTES (256 * 1024)
+#endif
+
+// Zero padding added around each side of the input: pad_h rows above and
+// below, pad_w columns left and right. It is never materialised; the input
+// transform reads zeros wherever a tile reaches into it.
+// "valid" is no padding and "same" keeps the output the size of the input
+// for odd r; any other argument is an explicit padding width. Returns
+// false if arg is none of these.
+inline bool parse_padding(const char* arg, int r, int& pad) {
+  if (strcmp(arg, "valid") == 0) {
+    pad = 0;
+  } else if (strcmp(arg, "same") == 0) {
+    pad = (r - 1) / 2;
+  } else {
+    char* end;
+    long value = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || value < 0) {
+      return false;
+    }
+    pad = (int) value;
+  }
+  return true;
+}
+
+// Activations the output transform can apply; winograd.cl uses the same
+// numbers.
+enum Activation {
+  ACTIVATION_NONE = 0,
+  ACTIVATION_RELU = 1,
+  ACTIVATION_RELU6 = 2,
+  ACTIVATION_LEAKY_RELU = 3
+};
+
+// What the output transform does to every output value of channel k while
+// its tile is still in registers, instead of another pass over the output:
+//   y = activation(scale[k] * y + bias[k] + residual(n, k, row, col))
+// scale and bias (one value per output channel) and residual (shaped like
+// the output) are optional. scale requantises the integer products of the
+// int8 path. Leaky ReLU scales negative values by slope, 0 <= slope <= 1.
+// Real is the working precision of the engine, and so of the residual.
+template <typename Real>
+struct Epilogue {
+  const double* scale;
+  const double* bias;
+  const Tensor<Real>* residual;
+  Activation activation;
+  double slope;
+
+  Epilogue()
+      : scale(NULL), bias(NULL), residual(NULL), activation(ACTIVATION_NONE), slope(0.01) {}
+
+  // on every lane of a Simd vector.
+  template <typename S>
+  typename S::type activate(typename S::type y) const {
+    switch (activation) {
+      case ACTIVATION_RELU: return S::max(y, S::zero());
+      case ACTIVATION_RELU6: return S::min(S::max(y, S::zero()), S::set1(6.0));
+      case ACTIVATION_LEAKY_RELU: return S::max(y, S::mul(S::set1(slope), y));
+      default: return y;
+    }
+  }
+
+  Real activate(Real y) const {
+    switch (activation) {
+      case ACTIVATION_RELU: return std::max(y, Real(0));
+      case ACTIVATION_RELU6: return std::min(std::max(y, Real(0)), Real(6));
+      case ACTIVATION_LEAKY_RELU: return std::max(y, Real(slope) * y);
+      default: return y;
+    }
+  }
+};
+
+// "none", "relu", "relu6", "leaky" or "leaky:slope". Returns false if arg
+// is none of these.
+inline bool parse_activation(const char* arg, Activation& activation, double& slope) {
+  if (strcmp(arg, "none") == 0) {
+    activation = ACTIVATION_NONE;
+  } else if (strcmp(arg, "relu") == 0) {
+    activation = ACTIVATION_RELU;
+  } else if (strcmp(arg, "relu6") == 0) {
+    activation = ACTIVATION_RELU6;
+  } else if (strncmp(arg, "leaky", 5) == 0) {
+    activation = ACTIVATION_LEAKY_RELU;
+    if (arg[5] == ':') {
+      char* end;
+      slope = strtod(arg + 6, &end);
+      if (arg[6] == '\0' || *end != '\0' || slope < 0 || slope > 1) {
+        return false;
+      }
+    } else if (arg[5] != '\0') {
+      return false;
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// How the engines store the transformed filters U, tiles V and products M:
+// in their working precision (float or double on the CPU, see
+// parse_precision, and float in OpenCL), or in
+// half precision, which halves the memory traffic of the GEMMs. With half
+// storage the transforms and the sums of the GEMMs still run in float or
+// better; only the stored values are rounded. int8 quantises the images and
+// filters to int8, keeps U and V in int16 and sums M exactly in int32 (see
+// convolute_quantized in winograd_openmp.cpp). bf16 keeps U and V in
+// bfloat16 and M in float, for GEMMs that widen them and sum in float.
+enum Storage {
+  STORAGE_FULL = 0,
+  STORAGE_HALF = 1,
+  STORAGE_INT8 = 2,
+  STORAGE_BF16 = 3
+};
+
+// "full", "half", "int8" or "bf16". Returns false if arg is none of these.
+inline bool parse_storage(const char* arg, Storage& storage) {
+  if (strcmp(arg, "full") == 0) {
+    storage = STORAGE_FULL;
+  } else if (strcmp(arg, "half") == 0) {
+    storage = STORAGE_HALF;
+  } else if (strcmp(arg, "int8") == 0) {
+    storage = STORAGE_INT8;
+  } else if (strcmp(arg, "bf16") == 0) {
+    storage = STORAGE_BF16;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// The working precision of the CPU engines, "float" or "double": the type
+// the images, filters and outputs are read and written in and the
+// transforms run in, and the type of U, V and M with full storage. float
+// halves the memory traffic of every phase and doubles the SIMD lanes;
+// double is there for reference-quality results. Returns false if arg is
+// neither.
+inline bool parse_precision(const char* arg, bool& use_double) {
+  if (strcmp(arg, "float") == 0) {
+    use_double = false;
+  } else if (strcmp(arg, "double") == 0) {
+    use_double = true;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Size of the polyphase sub-filters of an r x r filter applied at the given
+// stride, of the pieces they are cut into and the number of pieces along
+// each axis.
+constexpr int polyphase_size(int r, int stride) {
+  return (r + stride - 1) / stride;
+}
+
+constexpr int piece_size(int r, int stride) {
+  return polyphase_size(r, stride) < 3 ? polyphase_size(r, stride) : 3;
+}
+
+constexpr int piece_splits(int r, int stride) {
+  return (polyphase_size(r, stride) + piece_size(r, stride) - 1) / piece_size(r, stride);
+}
+
+// An H x W input padded by (pad_h, pad_w) and convolved with an r x r
+// filter at the given stride and dilation gives an out_H x out_W output,
+// covered by num_h_tiles x num_w_tiles tiles of m x m numbered row by row.
+// The tiles of the N images of a batch follow one another, so the 1-D tile
+// index b runs over P = N * tiles and every image shares the same GEMMs.
+// The output need not divide evenly into tiles, so the last row and column
+// of tiles may only be partially inside the image.
+//
+// A strided convolution is split into stride^2 polyphase sub-problems:
+// with phase (py, px), sub-image x_p(i, j) = x(stride * i + py,
+// stride * j + px) and sub-filter g_p(a, b) = g(stride * a + py,
+// stride * b + px), the output is the sum over phases of the stride-1
+// convolutions of x_p with g_p. Sub-filters larger than 3 x 3 (from 5 x 5
+// and 7 x 7 filters) are in turn cut into splits x splits zero-padded
+// 3 x 3 pieces; piece (pa, pb) is a 3 x 3 convolution of the sub-image
+// shifted by (3 pa, 3 pb). The (phase, piece) sub-problems are treated as
+// extra input channels, so their sum happens inside the GEMM and each
+// output tile is inverse transformed once.
+//
+// A dilated convolution is split the other way round, by output phase:
+// output rows dilation * i + dy only ever read input rows dilation * t + dy,
+// so each of the dilation^2 output phases is an ordinary stride-1
+// convolution of a subsampled image. The tiles of the phases are stacked
+// phase-major along each axis, band_h = num_h_tiles / dilation * m rows of
+// tile origins per phase; input_pos and output_pos map a tile element back
+// to the image. Stride and dilation are not combined.
+//
+// A transposed convolution (the backward-data pass of a convolution with
+// the given stride and padding) is split by output phase as well: output
+// pixel u = up * o + qy - crop, with up the forward stride, only receives
+// taps qy, qy + up, ... of the filter, so output phase (qy, qx) is a
+// stride-1 convolution of the input with the rotated R x R sub-filter of
+// those taps, R = ceil(r / up). The phases are extra output channels
+// (filter k * up^2 + q of M) that output_pos interleaves back into the
+// image; see transposed().
+struct TileGrid {
+  int m, H, W, pad_h, pad_w, stride, dilation;
+  int rs, splits;
+  int out_H, out_W;
+  int band_h, band_w;
+  int num_h_tiles, num_w_tiles, tiles;
+  int N, P;
+  int up, crop;
+
+  TileGrid(int m, int r, int H, int W, int N, int pad_h, int pad_w, int stride, int dilation)
+      : m(m), H(H), W(W), pad_h(pad_h), pad_w(pad_w), stride(stride), dilation(dilation),
+        rs(piece_size(r, stride)), splits(piece_splits(r, stride)),
+        out_H((H + 2 * pad_h - dilation * (r - 1) - 1) / stride + 1),
+        out_W((W + 2 * pad_w - dilation * (r - 1) - 1) / stride + 1),
+        band_h(((out_H + dilation - 1) / dilation + m - 1) / m * m),
+        band_w(((out_W + dilation - 1) / dilation + m - 1) / m * m),
+        num_h_tiles(dilation * band_h / m), num_w_tiles(dilation * band_w / m),
+        tiles(num_h_tiles * num_w_tiles), N(N), P(N * tiles), up(1), crop(0) {}
+
+  // The grid of the transposed convolution of an H x W input (a gradient
+  // of the output of the forward convolution) into an out_H x out_W
+  // result. Sub-output o of every phase reads input rows o - sub_pad ..
+  // o - sub_pad + dilation * (R - 1); with sub_pad = dilation * (R - 1) -
+  // pad / stride the sub-outputs cover every output pixel of every phase,
+  // and output_pos drops the few that fall outside.
+  static TileGrid transposed(int m, int r, int H, int W, int N, int pad, int stride,
+                             int dilation, int out_H, int out_W) {
+    int R = polyphase_size(r, stride);
+    int sub_pad = dilation * (R - 1) - pad / stride;
+    TileGrid grid(m, R, H, W, N, sub_pad, sub_pad, 1, dilation);
+    grid.up = stride;
+    grid.crop = pad % stride;
+    grid.out_H = out_H;
+    grid.out_W = out_W;
+    return grid;
+  }
+
+  // (phase, piece) sub-problems per input channel.
+  int phases() const {
+    return stride * stride * splits * splits;
+  }
+
+  // image n of tile b and its top left corner in the stacked output phases.
+  void origin(int b, int& n, int& row, int& col) const {
+    n = b / tiles;
+    b %= tiles;
+    row = b / num_w_tiles * m;
+    col = b % num_w_tiles * m;
+  }
+
+  // Where element (i, j) of the input tile at (row, col) lies in the
+  // unpadded image, for the given sub-problem.
+  void input_pos(int phase, int row, int col, int i, int j, int& y, int& x) const {
+    int poly = phase / (splits * splits), piece = phase % (splits * splits);
+    int step = stride * dilation;
+    y = step * (row % band_h + i + rs * (piece / splits)) + poly / stride + row / band_h - pad_h;
+    x = step * (col % band_w + j + rs * (piece % splits)) + poly % stride + col / band_w - pad_w;
+  }
+
+  // Where element (i, j) of the output tile at (row, col) lies in the
+  // output, for output phase q (always 0 unless transposed); it is only
+  // part of the output if 0 <= y < out_H and 0 <= x < out_W.
+  void output_pos(int q, int row, int col, int i, int j, int& y, int& x) const {
+    y = up * (dilation * (row % band_h + i) + row / band_h) + q / up - crop;
+    x = up * (dilation * (col % band_w + j) + col / band_w) + q % up - crop;
+  }
+};
+
+// Filter size rs of the sub-problems of an r x r filter applied at the
+// given stride, and their number per input channel.
+template <int r, int stride>
+struct Polyphase {
+  static const int rs = piece_size(r, stride);
+  static const int splits = piece_splits(r, stride);
+  static const int phases = stride * stride * splits * splits;
+};
+
+// Filter of sub-problem phase (see TileGrid) of an r x r filter at the
+// given stride, zero-padded to rs x rs, row-major. g(i, j) = g[i * rows +
+// j * cols].
+template <typename T>
+void polyphase_filter(const T* g, int rows, int cols, int r, int stride, int phase, T* sub) {
+  int rs = piece_size(r, stride), splits = piece_splits(r, stride);
+  int poly = phase / (splits * splits), piece = phase % (splits * splits);
+  int py = poly / stride, px = poly % stride;
+  int oy = rs * (piece / splits), ox = rs * (piece % splits);
+  for (int a = 0; a < rs; a++) {
+    for (int b = 0; b < rs; b++) {
+      int i = stride * (oy + a) + py, j = stride * (ox + b) + px;
+      sub[a * rs + b] = i < r && j < r ? g[i * rows + j * cols] : 0;
+    }
+  }
+}
+
+// The inverse of polyphase_filter for gradients: adds the rs x rs gradient
+// of the filter of sub-problem phase to the gradient of the r x r filter,
+// at the same places. The zero padding of the piece has no gradient.
+template <typename T>
+void polyphase_scatter(const T* sub, int rows, int cols, int r, int stride, int phase, T* g) {
+  int rs = piece_size(r, stride), splits = piece_splits(r, stride);
+  int poly = phase / (splits * splits), piece = phase % (splits * splits);
+  int py = poly / stride, px = poly % stride;
+  int oy = rs * (piece / splits), ox = rs * (piece % splits);
+  for (int a = 0; a < rs; a++) {
+    for (int b = 0; b < rs; b++) {
+      int i = stride * (oy + a) + py, j = stride * (ox + b) + px;
+      if (i < r && j < r) {
+        g[i * rows + j * cols] += sub[a * rs + b];
+      }
+    }
+  }
+}
+
+// Filter of sub-problem (q, phase) of the transposed convolution with an
+// r x r filter at the given stride (see TileGrid): piece phase of the
+// sub-filter of output phase q, rotated by 180 degrees, zero-padded to
+// rs x rs, row-major. It is read straight out of g, g(i, j) = g[i * rows +
+// j * cols]; no flipped copy of the filter is made.
+template <typename T>
+void transposed_filter(const T* g, int rows, int cols, int r, int stride, int q, int phase,
+                       T* sub) {
+  int R = polyphase_size(r, stride);
+  int rs = piece_size(R, 1), splits = piece_splits(R, 1);
+  int qy = q / stride, qx = q % stride;
+  int oy = rs * (phase / splits), ox = rs * (phase % splits);
+  for (int a = 0; a < rs; a++) {
+    for (int b = 0; b < rs; b++) {
+      int ha = oy + a, hb = ox + b;
+      int i = stride * (R - 1 - ha) + qy, j = stride * (R - 1 - hb) + qx;
+      bool inside = ha < R && hb < R && i < r && j < r;
+      sub[a * rs + b] = inside ? g[i * rows + j * cols] : 0;
+    }
+  }
+}
+
+// Number of tiles the fused pipeline pushes through at once: the block's
+// slice of V (points x C per tile) and of M (points x K per tile) should
+// fit in L2 together, where points is the number of transform points of a
+// tile (alpha^2, or alpha in 1-D). Rounded to a multiple of 8 tiles, and
+// never fewer.
+inline int fused_block_size(int points, int K, int C, int elem_size) {
+  long per_tile = (long) points * (C + K) * elem_size;
+  long tiles = L2_CACHE_BYTES / per_tile / 8 * 8;
+  return (int) std::max(tiles, 8L);
+}
+
+// Per-tile kernels of F(m x m, r x r). All sizes are compile-time constants
+// so the transforms below unroll into the constant programs of TransformPrograms.
+// Tiles are row-major alpha x alpha arrays; images are addressed with an
+// explicit row and column stride so Armadillo's column-major storage
+// (row stride 1, column stride n_rows) can be used in place. Real is the
+// working precision (see parse_precision); the filter transforms sum in
+// double either way.
+template <int m, int r, typename Real>
+struct WinogradConv {
+  static constexpr int alpha = m + r - 1;
+  typedef TransformPrograms<m, r> P;
+
+  // u = G g G^T, where g(i, j) = g[i * rs + j * cs].
+  static void filter_transform(const Real* g, int rs, int cs, Real* u) {
+    double in[r * r], temp[alpha * r], out[alpha * alpha];
+    for (int i = 0; i < r; i++) {
+      for (int j = 0; j < r; j++) {
+        in[i * r + j] = g[i * rs + j * cs];
+      }
+    }
+    for (int j = 0; j < r; j++) {
+      run_transform<ScalarOps>(P::G, in + j, r, temp + j, r);
+    }
+    for (int xi = 0; xi < alpha; xi++) {
+      run_transform<ScalarOps>(P::G, temp + xi * r, 1, out + xi * alpha, 1);
+    }
+    for (int e = 0; e < alpha * alpha; e++) {
+      u[e] = out[e];
+    }
+  }
+
+  // The gradient of the filter transform: dg = G^T du G, where du is the
+  // alpha x alpha gradient of u and dg is r x r, both row-major: the G^T
+  // program down each column of du, then along each row of the result.
+  static void filter_gradient(const Real* du, Real* dg) {
+    double in[alpha * alpha], temp[r * alpha], out[r * r];
+    for (int e = 0; e < alpha * alpha; e++) {
+      in[e] = du[e];
+    }
+    for (int nu = 0; nu < alpha; nu++) {
+      run_transform<ScalarOps>(P::GT, in + nu, alpha, temp + nu, alpha);
+    }
+    for (int i = 0; i < r; i++) {
+      run_transform<ScalarOps>(P::GT, temp + i * alpha, 1, out + i * r, 1);
+    }
+    for (int e = 0; e < r * r; e++) {
+      dg[e] = out[e];
+    }
+  }
+
+  // The input and output transforms work on Simd<Real>::width tiles at
+  // once, one tile per lane, so every step of B^T d B and A^T M A is a
+  // vector add, subtract or (for the scaled coefficients of the larger
+  // tiles) FMA on whole registers. Tile element (i, j) of all lanes is
+  // element i * alpha + j of an array of vectors.
+  typedef Simd<Real> S;
+  typedef typename S::type vec;
+  static const int lanes = S::width;
+
+  // v = B^T d B on every lane: the B^T program down each column of d, then
+  // along each row of the result.
+  static inline __attribute__((always_inline))
+  void input_transform(const vec* d, vec* v) {
+    vec temp[alpha * alpha];
+    #pragma GCC unroll 16
+    for (int j = 0; j < alpha; j++) {
+      run_transform<S>(P::BT, d + j, alpha, temp + j, alpha);
+    }
+    #pragma GCC unroll 16
+    for (int xi = 0; xi < alpha; xi++) {
+      run_transform<S>(P::BT, temp + xi * alpha, 1, v + xi * alpha, 1);
+    }
+  }
+
+  // y = A^T mm A on every lane, where y is an m x m tile.
+  static inline __attribute__((always_inline))
+  void output_transform(const vec* mm, vec* y) {
+    vec temp[m * alpha];
+    #pragma GCC unroll 16
+    for (int j = 0; j < alpha; j++) {
+      run_transform<S>(P::AT, mm + j, alpha, temp + j, alpha);
+    }
+    #pragma GCC unroll 16
+    for (int i = 0; i < m; i++) {
+      run_transform<S>(P::AT, temp + i * alpha, 1, y + i * m, 1);
+    }
+  }
+
+  // The gradient of the output transform, on every lane: t = A dy A^T for
+  // an m x m tile dy of the gradient of Y gives the gradient of M.
+  static inline __attribute__((always_inline))
+  void gradient_transform(const vec* dy, vec* t) {
+    vec temp[alpha * m];
+    #pragma GCC unroll 16
+    for (int j = 0; j < m; j++) {
+      run_transform<S>(P::A, dy + j, m, temp + j, m);
+    }
+    #pragma GCC unroll 16
+    for (int xi = 0; xi < alpha; xi++) {
+      run_transform<S>(P::A, temp + xi * m, 1, t + xi * alpha, 1);
+    }
+  }
+
+  // A group of lanes from or to consecutive elements of V or M, which may
+  // be stored in the working precision, as half, as bfloat16 (V) and float
+  // (M), or as integers on the int8 path (where the transforms are exact).
+  static vec load_lanes(const double* p) { return S::loadd(p); }
+  static vec load_lanes(const float* p) { return S::loadf(p); }
+  static vec load_lanes(const half* p) { return S::loadh(p); }
+  static vec load_lanes(const int32_t* p) { return S::loadi32(p); }
+  static void store_lanes(double* p, vec a) { S::stored(p, a); }
+  static void store_lanes(float* p, vec a) { S::storef(p, a); }
+  static void store_lanes(half* p, vec a) { S::storeh(p, a); }
+  static void store_lanes(bfloat16* p, vec a) { S::storeb(p, a); }
+  static void store_lanes(int16_t* p, vec a) { S::storei16(p, a); }
+
+  // Tile b of channel c and polyphase phase of D into buf[(i * alpha + j)
+  // * lanes], zero where it hangs over the padding or past the bottom or
+  // right edge of the image, and all zero unless used (the spare lanes of
+  // the last group). input_pos is affine in (i, j), so only the corner is
+  // worked out, and tiles wholly inside the image skip the bounds checks.
+  template <typename TD, typename TB>
+  static inline void gather_tile(const Tensor<TD>& D, int c, int phase, const TileGrid& grid,
+                                 int b, bool used, TB* buf, int lanes) {
+    int n = 0, row = 0, col = 0, y0 = 0, x0 = 0;
+    if (used) {
+      grid.origin(b, n, row, col);
+      grid.input_pos(phase, row, col, 0, 0, y0, x0);
+    }
+    int H = D.dim[2], W = D.dim[3];
+    int step = grid.stride * grid.dilation, last = step * (alpha - 1);
+    const TD* image = D.ptr(n, c);
+    long rs = D.stride[2], cs = D.stride[3];
+    if (used && y0 >= 0 && x0 >= 0 && y0 + last < H && x0 + last < W) {
+      const TD* corner = image + y0 * rs + x0 * cs;
+      for (int i = 0; i < alpha; i++) {
+        for (int j = 0; j < alpha; j++) {
+          buf[(i * alpha + j) * lanes] = (TB) corner[step * (i * rs + j * cs)];
+        }
+      }
+      return;
+    }
+    for (int i = 0; i < alpha; i++) {
+      for (int j = 0; j < alpha; j++) {
+        int y = y0 + step * i, x = x0 + step * j;
+        bool inside = used && y >= 0 && y < H && x >= 0 && x < W;
+        buf[(i * alpha + j) * lanes] = inside ? (TB) image[y * rs + x * cs] : 0;
+      }
+    }
+  }
+
+  // Input stage for the nb consecutive tiles b0 .. b0 + nb - 1 of channel c
+  // and polyphase phase of the batch D (n, c, row, col): transforms them and
+  // writes them to columns j0 .. j0 + nb - 1 of V (xi, nu, c * phases +
+  // phase, j). Since j is the unit-stride dimension of V, a full group of
+  // lanes is stored with one vector store. The lanes of a group may come
+  // from different images, which may be quantised (int8_t).
+  template <typename TD, typename TV>
+  static void input_tiles(const Tensor<TD>& D, int c, int phase, const TileGrid& grid,
+                          int b0, int nb, Tensor<TV>& V, int j0) {
+    alignas(TENSOR_ALIGNMENT) Real buf[alpha * alpha * lanes];
+    vec d[alpha * alpha], v[alpha * alpha];
+    int vc = c * grid.phases() + phase;
+    for (int g = 0; g < nb; g += lanes) {
+      int count = std::min(lanes, nb - g);
+      for (int l = 0; l < lanes; l++) {
+        gather_tile(D, c, phase, grid, b0 + g + l, l < count, buf + l, lanes);
+      }
+      for (int e = 0; e < alpha * alpha; e++) {
+        d[e] = S::load(buf + e * lanes);
+      }
+      // flop: C * P * P::input_flops()
+      input_transform(d, v);
+      if (count == lanes && V.stride[3] == 1) {
+        for (int xi = 0; xi < alpha; xi++) {
+          for (int nu = 0; nu < alpha; nu++) {
+            store_lanes(&V(xi, nu, vc, j0 + g), v[xi * alpha + nu]);
+          }
+        }
+      } else {
+        for (int e = 0; e < alpha * alpha; e++) {
+          S::store(buf + e * lanes, v[e]);
+        }
+        for (int xi = 0; xi < alpha; xi++) {
+          for (int nu = 0; nu < alpha; nu++) {
+            for (int l = 0; l < count; l++) {
+              V(xi, nu, vc, j0 + g + l) = TV(buf[(xi * alpha + nu) * lanes + l]);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // input_tiles for the int8 path: its images are gathered and transformed
+  // in int16, Simd<int16_t>::width tiles at a time, which is exact since
+  // the B^T of its tiles only holds 0 and +-1, and V is stored as it
+  // comes out.
+  static void input_tiles(const Tensor<int8_t>& D, int c, int phase, const TileGrid& grid,
+                          int b0, int nb, Tensor<int16_t>& V, int j0) {
+    typedef Simd<int16_t> SI;
+    const int wide = SI::width;
+    alignas(TENSOR_ALIGNMENT) int16_t buf[alpha * alpha * wide];
+    typename SI::type d[alpha * alpha], temp[alpha * alpha], v[alpha * alpha];
+    int vc = c * grid.phases() + phase;
+    for (int g = 0; g < nb; g += wide) {
+      int count = std::min(wide, nb - g);
+      for (int l = 0; l < wide; l++) {
+        gather_tile(D, c, phase, grid, b0 + g + l, l < count, buf + l, wide);
+      }
+      for (int e = 0; e < alpha * alpha; e++) {
+        d[e] = SI::load(buf + e * wide);
+      }
+      // flop: C * P * P::input_flops()
+      #pragma GCC unroll 16
+      for (int j = 0; j < alpha; j++) {
+        run_transform<SI>(P::BT, d + j, alpha, temp + j, alpha);
+      }
+      #pragma GCC unroll 16
+      for (int xi = 0; xi < alpha; xi++) {
+        run_transform<SI>(P::BT, temp + xi * alpha, 1, v + xi * alpha, 1);
+      }
+      if (count == wide && V.stride[3] == 1) {
+        for (int e = 0; e < alpha * alpha; e++) {
+          SI::storeu(&V(e / alpha, e % alpha, vc, j0 + g), v[e]);
+        }
+      } else {
+        for (int e = 0; e < alpha * alpha; e++) {
+          SI::store(buf + e * wide, v[e]);
+        }
+        for (int e = 0; e < alpha * alpha; e++) {
+          for (int l = 0; l < count; l++) {
+            V(e / alpha, e % alpha, vc, j0 + g + l) = buf[e * wide + l];
+          }
+        }
+      }
+    }
+  }
+
+  // Output stage for columns j0 .. j0 + nb - 1 of filter k in M (xi, nu, k, j):
+  // inverse transforms them, applies the epilogue and writes them to tiles
+  // b0 .. b0 + nb - 1 of the batch Y (n, k, row, col). In a transposed
+  // convolution filter k is output phase k % up^2 of channel k / up^2 of Y.
+  template <typename TM>
+  static void output_tiles(const Tensor<TM>& M, int k, int j0, const TileGrid& grid,
+                           int b0, int nb, Tensor<Real>& Y,
+                           const Epilogue<Real>& epilogue = Epilogue<Real>()) {
+    alignas(TENSOR_ALIGNMENT) Real buf[alpha * alpha * lanes];
+    vec mm[alpha * alpha], y[m * m];
+    long rs = Y.stride[2], cs = Y.stride[3];
+    int phases = grid.up * grid.up;
+    const Tensor<Real>* residual = epilogue.residual;
+    for (int g = 0; g < nb; g += lanes) {
+      int count = std::min(lanes, nb - g);
+      if (count == lanes && M.stride[3] == 1) {
+        for (int xi = 0; xi < alpha; xi++) {
+          for (int nu = 0; nu < alpha; nu++) {
+            mm[xi * alpha + nu] = load_lanes(&M(xi, nu, k, j0 + g));
+          }
+        }
+      } else {
+        for (int xi = 0; xi < alpha; xi++) {
+          for (int nu = 0; nu < alpha; nu++) {
+            for (int l = 0; l < lanes; l++) {
+              buf[(xi * alpha + nu) * lanes + l] =
+                  l < count ? (Real) M(xi, nu, k, j0 + g + l) : 0;
+            }
+          }
+        }
+        for (int e = 0; e < alpha * alpha; e++) {
+          mm[e] = S::load(buf + e * lanes);
+        }
+      }
+      // flop: K * P * P::output_flops()
+      output_transform(mm, y);
+      if (epilogue.scale) {
+        vec scale = S::set1(epilogue.scale[k / phases]);
+        for (int e = 0; e < m * m; e++) {
+          y[e] = S::mul(y[e], scale);
+        }
+      }
+      // the residual is scattered like the output, so with one the
+      // activation waits for the element-wise loop below.
+      if (epilogue.bias) {
+        vec bias = S::set1(epilogue.bias[k / phases]);
+        for (int e = 0; e < m * m; e++) {
+          y[e] = S::add(y[e], bias);
+        }
+      }
+      if (epilogue.activation != ACTIVATION_NONE && !residual) {
+        for (int e = 0; e < m * m; e++) {
+          y[e] = epilogue.template activate<S>(y[e]);
+        }
+      }
+      for (int e = 0; e < m * m; e++) {
+        S::store(buf + e * lanes, y[e]);
+      }
+      // only the part of a partial tile that lies inside the output is kept.
+      for (int l = 0; l < count; l++) {
+        int n, row, col;
+        grid.origin(b0 + g + l, n, row, col);
+        Real* result = Y.ptr(n, k / phases);
+        const Real* res = residual ? residual->ptr(n, k / phases) : NULL;
+        for (int i = 0; i < m; i++) {
+          for (int j = 0; j < m; j++) {
+            int y, x;
+            grid.output_pos(k % phases, row, col, i, j, y, x);
+            if (y >= 0 && y < grid.out_H && x >= 0 && x < grid.out_W) {
+              Real value = buf[(i * m + j) * lanes + l];
+              if (res) {
+                value = epilogue.activate(
+                    value + res[y * residual->stride[2] + x * residual->stride[3]]);
+              }
+              result[y * rs + x * cs] = value;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Backward-filter stage for tiles b0 .. b0 + nb - 1 of channel k of the
+  // gradient DY (n, k, row, col) of the output: gathers them as output_tiles
+  // scatters, transforms them by the gradient of the output transform and
+  // writes them as columns j0 .. j0 + nb - 1 of row k of dM (xi, nu, k, j),
+  // packed into BatchedGemm panels for a grouped convolution with Kg filters
+  // per group (see BatchedGemm::packed, with the tiles as the reduction).
+  template <typename Gemm>
+  static void gradient_tiles(const Tensor<Real>& DY, int k, const TileGrid& grid, int b0,
+                             int nb, Tensor<Real>& dM, int j0, int Kg) {
+    alignas(TENSOR_ALIGNMENT) Real buf[alpha * alpha * lanes];
+    vec dy[m * m], t[alpha * alpha];
+    long rs = DY.stride[2], cs = DY.stride[3];
+    for (int g = 0; g < nb; g += lanes) {
+      int count = std::min(lanes, nb - g);
+      // the parts of partial tiles outside the output have no gradient.
+      for (int l = 0; l < lanes; l++) {
+        int n = 0, row = 0, col = 0;
+        if (l < count) {
+          grid.origin(b0 + g + l, n, row, col);
+        }
+        const Real* grad = DY.ptr(n, k);
+        for (int i = 0; i < m; i++) {
+          for (int j = 0; j < m; j++) {
+            int y, x;
+            grid.output_pos(0, row, col, i, j, y, x);
+            bool inside = l < count && y < grid.out_H && x < grid.out_W;
+            buf[(i * m + j) * lanes + l] = inside ? grad[y * rs + x * cs] : 0;
+          }
+        }
+      }
+      for (int e = 0; e < m * m; e++) {
+        dy[e] = S::load(buf + e * lanes);
+      }
+      // flop: K * P * (alpha * m * (2 * m - 1) + alpha * alpha * (2 * m - 1))
+      gradient_transform(dy, t);
+      for (int e = 0; e < alpha * alpha; e++) {
+        S::store(buf + e * lanes, t[e]);
+      }
+      for (int xi = 0; xi < alpha; xi++) {
+        for (int nu = 0; nu < alpha; nu++) {
+          for (int l = 0; l < count; l++) {
+            Gemm::packed(dM, xi, nu, Kg, k, j0 + g + l) =
+                buf[(xi * alpha + nu) * lanes + l];
+          }
+        }
+      }
+    }
+  }
+};
+
+// The 1-D engine convolves every row of an (N, C, rows, L) batch with a
+// 1 x r filter running along its length L, padded by pad zeros at both
+// ends. Each of these sequences is covered by num_tiles tiles of m outputs,
+// the last one possibly partial. Tiles are numbered sequence by sequence,
+// so the tile index b runs over P = N * rows * num_tiles and a run of
+// consecutive tiles is a contiguous stretch of one sequence. A 3 x 1 layer
+// is the same problem on the transposed view of the images.
+struct SequenceGrid {
+  int m, L, pad, out_L;
+  int num_tiles, rows, tiles;
+  int N, P;
+
+  SequenceGrid(int m, int r, int L, int rows, int N, int pad)
+      : m(m), L(L), pad(pad), out_L(L + 2 * pad - r + 1),
+        num_tiles((out_L + m - 1) / m), rows(rows), tiles(rows * num_tiles),
+        N(N), P(N * tiles) {}
+
+  // image n and row of tile b, and the output position t of its first
+  // element; the tile reads input positions t - pad .. t - pad + alpha - 1.
+  void origin(int b, int& n, int& row, int& t) const {
+    n = b / tiles;
+    b %= tiles;
+    row = b / num_tiles;
+    t = b % num_tiles * m;
+  }
+};
+
+// Per-tile kernels of the 1-D F(m, r): a tile of alpha = m + r - 1
+// consecutive samples gives m outputs, y = A^T [(G g) .* (B^T d)], with the
+// same Cook-Toom matrices as the 2-D transforms. U, V and M keep the
+// (xi, nu, row, col) layout of the 2-D engines with a single nu, so the
+// transform-domain products are alpha BatchedGemm products of K x C by
+// C x P. Real is the working precision, as in WinogradConv.
+template <int m, int r, typename Real>
+struct WinogradConv1D {
+  static constexpr int alpha = m + r - 1;
+  typedef TransformPrograms<m, r> P;
+
+  // u = G g, where g(i) = g[i * step].
+  static void filter_transform(const Real* g, int step, Real* u) {
+    double in[r], out[alpha];
+    for (int i = 0; i < r; i++) {
+      in[i] = g[i * step];
+    }
+    run_transform<ScalarOps>(P::G, in, 1, out, 1);
+    for (int xi = 0; xi < alpha; xi++) {
+      u[xi] = out[xi];
+    }
+  }
+
+  // One tile per SIMD lane, as in WinogradConv.
+  typedef Simd<Real> S;
+  typedef typename S::type vec;
+  static const int lanes = S::width;
+
+  // v = B^T d on every lane.
+  static inline __attribute__((always_inline))
+  void input_transform(const vec* d, vec* v) {
+    run_transform<S>(P::BT, d, 1, v, 1);
+  }
+
+  // y = A^T mm on every lane.
+  static inline __attribute__((always_inline))
+  void output_transform(const vec* mm, vec* y) {
+    run_transform<S>(P::AT, mm, 1, y, 1);
+  }
+
+  // Input stage for the nb consecutive tiles b0 .. b0 + nb - 1 of channel c
+  // of the batch D (n, c, row, t): transforms them and writes them to
+  // columns j0 .. j0 + nb - 1 of V (xi, 0, c, j).
+  static void input_tiles(const Tensor<Real>& D, int c, const SequenceGrid& grid,
+                          int b0, int nb, Tensor<Real>& V, int j0) {
+    alignas(TENSOR_ALIGNMENT) Real buf[alpha * lanes];
+    vec d[alpha], v[alpha];
+    long ts = D.stride[3];
+    for (int g = 0; g < nb; g += lanes) {
+      int count = std::min(lanes, nb - g);
+      // the padding, the end of the last tile and the unused lanes of the
+      // last group read as zeros.
+      for (int l = 0; l < lanes; l++) {
+        int n = 0, row = 0, t = 0;
+        if (l < count) {
+          grid.origin(b0 + g + l, n, row, t);
+        }
+        const Real* seq = D.ptr(n, c) + row * D.stride[2];
+        for (int i = 0; i < alpha; i++) {
+          int x = t + i - grid.pad;
+          bool inside = l < count && x >= 0 && x < grid.L;
+          buf[i * lanes + l] = inside ? seq[x * ts] : 0;
+        }
+      }
+      for (int i = 0; i < alpha; i++) {
+        d[i] = S::load(buf + i * lanes);
+      }
+      // flop: C * P * P::BT.flops()
+      input_transform(d, v);
+      if (count == lanes && V.stride[3] == 1) {
+        for (int xi = 0; xi < alpha; xi++) {
+          S::storeu(&V(xi, 0, c, j0 + g), v[xi]);
+        }
+      } else {
+        for (int xi = 0; xi < alpha; xi++) {
+          S::store(buf + xi * lanes, v[xi]);
+          for (int l = 0; l < count; l++) {
+            V(xi, 0, c, j0 + g + l) = buf[xi * lanes + l];
+          }
+        }
+      }
+    }
+  }
+
+  // Output stage for columns j0 .. j0 + nb - 1 of filter k in M (xi, 0, k, j):
+  // inverse transforms them and writes them to tiles b0 .. b0 + nb - 1 of
+  // the batch Y (n, k, row, t).
+  static void output_tiles(const Tensor<Real>& M, int k, int j0, const SequenceGrid& grid,
+                           int b0, int nb, Tensor<Real>& Y) {
+    alignas(TENSOR_ALIGNMENT) Real buf[alpha * lanes];
+    vec mm[alpha], y[m];
+    long ts = Y.stride[3];
+    for (int g = 0; g < nb; g += lanes) {
+      int count = std::min(lanes, nb - g);
+      if (count == lanes && M.stride[3] == 1) {
+        for (int xi = 0; xi < alpha; xi++) {
+          mm[xi] = S::loadu(&M(xi, 0, k, j0 + g));
+        }
+      } else {
+        for (int xi = 0; xi < alpha; xi++) {
+          for (int l = 0; l < lanes; l++) {
+            buf[xi * lanes + l] = l < count ? M(xi, 0, k, j0 + g + l) : 0;
+          }
+          mm[xi] = S::load(buf + xi * lanes);
+        }
+      }
+      // flop: K * P * P::AT.flops()
+      output_transform(mm, y);
+      for (int i = 0; i < m; i++) {
+        S::store(buf + i * lanes, y[i]);
+      }
+      // only the part of the last tile of a sequence inside the output is kept.
+      for (int l = 0; l < count; l++) {
+        int n, row, t;
+        grid.origin(b0 + g + l, n, row, t);
+        Real* seq = Y.ptr(n, k) + row * Y.stride[2];
+        for (int i = 0; i < m && t + i < grid.out_L; i++) {
+          seq[(t + i) * ts] = buf[i * lanes + l];
+        }
+      }
+    }
+  }
+};
+
+// A D x H x W volume padded by pad zeros on every side and convolved with an
+// r x r x r filter gives an out_D x out_H x out_W output, covered by
+// num_d_tiles x num_h_tiles x num_w_tiles tiles of m x m x m. Tiles are
+// numbered depth-major, so the slab of num_h_tiles * num_w_tiles tiles at
+// one depth is a contiguous run of tile indices b, and the slabs of the N
+// volumes of a batch follow one another along P.
+struct VolumeGrid {
+  int m, D, H, W, pad;
+  int out_D, out_H, out_W;
+  int num_d_tiles, num_h_tiles, num_w_tiles, slab, tiles;
+  int N, P;
+
+  VolumeGrid(int m, int r, int D, int H, int W, int N, int pad)
+      : m(m), D(D), H(H), W(W), pad(pad),
+        out_D(D + 2 * pad - r + 1), out_H(H + 2 * pad - r + 1), out_W(W + 2 * pad - r + 1),
+        num_d_tiles((out_D + m - 1) / m), num_h_tiles((out_H + m - 1) / m),
+        num_w_tiles((out_W + m - 1) / m), slab(num_h_tiles * num_w_tiles),
+        tiles(num_d_tiles * slab), N(N), P(N * tiles) {}
+
+  // volume n of tile b and the output position of its first element; the
+  // tile reads the input from (z - pad, y - pad, x - pad).
+  void origin(int b, int& n, int& z, int& y, int& x) const {
+    n = b / tiles;
+    b %= tiles;
+    z = b / slab * m;
+    b %= slab;
+    y = b / num_w_tiles * m;
+    x = b % num_w_tiles * m;
+  }
+};
+
+// Per-tile kernels of F(m x m x m, r x r x r): the 2-D transforms applied
+// along each of the three axes, y = A^T [(G g) .* (B^T d)] A with every
+// product taken along every axis, over alpha^3 transform points. Tiles are
+// row-major alpha x alpha x alpha arrays. U, V and M are indexed
+// (xi * alpha + nu, tau, row, col), so every transform point still owns
+// one aligned matrix of the Tensor and the products are alpha^3
+// BatchedGemm products. Real is the working precision, as in WinogradConv.
+template <int m, int r, typename Real>
+struct WinogradConv3D {
+  static constexpr int alpha = m + r - 1;
+  typedef TransformPrograms<m, r> P;
+
+  // u = g transformed by G along each axis, where g(i, j, l) = g[i * ds +
+  // j * rs + l * cs]: the G program along i for each (j, l), then along j
+  // and along l.
+  static void filter_transform(const Real* g, long ds, long rs, long cs, Real* u) {
+    double in[r * r * r], t1[alpha * r * r], t2[alpha * alpha * r];
+    double out[alpha * alpha * alpha];
+    for (int i = 0; i < r; i++) {
+      for (int j = 0; j < r; j++) {
+        for (int l = 0; l < r; l++) {
+          in[(i * r + j) * r + l] = g[i * ds + j * rs + l * cs];
+        }
+      }
+    }
+    for (int e = 0; e < r * r; e++) {
+      run_transform<ScalarOps>(P::G, in + e, r * r, t1 + e, r * r);
+    }
+    for (int xi = 0; xi < alpha; xi++) {
+      for (int l = 0; l < r; l++) {
+        run_transform<ScalarOps>(P::G, t1 + xi * r * r + l, r, t2 + xi * alpha * r + l, r);
+      }
+    }
+    for (int e = 0; e < alpha * alpha; e++) {
+      run_transform<ScalarOps>(P::G, t2 + e * r, 1, out + e * alpha, 1);
+    }
+    for (int e = 0; e < alpha * alpha * alpha; e++) {
+      u[e] = out[e];
+    }
+  }
+
+  // One tile per SIMD lane, as in WinogradConv.
+  typedef Simd<Real> S;
+  typedef typename S::type vec;
+  static const int lanes = S::width;
+
+  // v = B^T d along every axis, on every lane.
+  static inline __attribute__((always_inline))
+  void input_transform(const vec* d, vec* v) {
+    const int a2 = alpha * alpha;
+    vec t1[alpha * a2], t2[alpha * a2];
+    #pragma GCC unroll 64
+    for (int e = 0; e < a2; e++) {
+      run_transform<S>(P::BT, d + e, a2, t1 + e, a2);
+    }
+    #pragma GCC unroll 16
+    for (int xi = 0; xi < alpha; xi++) {
+      #pragma GCC unroll 16
+      for (int l = 0; l < alpha; l++) {
+        run_transform<S>(P::BT, t1 + xi * a2 + l, alpha, t2 + xi * a2 + l, alpha);
+      }
+    }
+    #pragma GCC unroll 64
+    for (int e = 0; e < a2; e++) {
+      run_transform<S>(P::BT, t2 + e * alpha, 1, v + e * alpha, 1);
+    }
+  }
+
+  // y = A^T mm A along every axis, on every lane; y is m x m x m.
+  static inline __attribute__((always_inline))
+  void output_transform(const vec* mm, vec* y) {
+    const int a2 = alpha * alpha;
+    vec t1[m * a2], t2[m * m * alpha];
+    #pragma GCC unroll 64
+    for (int e = 0; e < a2; e++) {
+      run_transform<S>(P::AT, mm + e, a2, t1 + e, a2);
+    }
+    #pragma GCC unroll 16
+    for (int i = 0; i < m; i++) {
+      #pragma GCC unroll 16
+      for (int l = 0; l < alpha; l++) {
+        run_transform<S>(P::AT, t1 + i * a2 + l, alpha, t2 + i * m * alpha + l, alpha);
+      }
+    }
+    #pragma GCC unroll 64
+    for (int e = 0; e < m * m; e++) {
+      run_transform<S>(P::AT, t2 + e * alpha, 1, y + e * m, 1);
+    }
+  }
+
+  // Input stage for the nb consecutive tiles b0 .. b0 + nb - 1 of channel c
+  // of the volumes X (n * C + c, z, y, x): transforms them and writes them
+  // to columns j0 .. j0 + nb - 1 of V (xi * alpha + nu, tau, c, j).
+  static void input_tiles(const Tensor<Real>& X, int C, int c, const VolumeGrid& grid,
+                          int b0, int nb, Tensor<Real>& V, int j0) {
+    const int a3 = alpha * alpha * alpha;
+    alignas(TENSOR_ALIGNMENT) Real buf[a3 * lanes];
+    vec d[a3], v[a3];
+    for (int g = 0; g < nb; g += lanes) {
+      int count = std::min(lanes, nb - g);
+      // the padding, the parts of partial tiles past the far faces of the
+      // volume and the unused lanes of the last group read as zeros.
+      for (int l = 0; l < lanes; l++) {
+        int n = 0, z = 0, y = 0, x = 0;
+        if (l < count) {
+          grid.origin(b0 + g + l, n, z, y, x);
+        }
+        const Real* volume = X.ptr(n * C + c, 0);
+        for (int i = 0; i < alpha; i++) {
+          int iz = z + i - grid.pad;
+          for (int j = 0; j < alpha; j++) {
+            int iy = y + j - grid.pad;
+            for (int k = 0; k < alpha; k++) {
+              int ix = x + k - grid.pad;
+              bool inside = l < count && iz >= 0 && iz < grid.D && iy >= 0 && iy < grid.H &&
+                            ix >= 0 && ix < grid.W;
+              buf[((i * alpha + j) * alpha + k) * lanes + l] =
+                  inside ? volume[iz * X.stride[1] + iy * X.stride[2] + ix * X.stride[3]] : 0;
+            }
+          }
+        }
+      }
+      for (int e = 0; e < a3; e++) {
+        d[e] = S::load(buf + e * lanes);
+      }
+      // flop: C * P * alpha^2 * P::BT.flops() * 3
+      input_transform(d, v);
+      if (count == lanes && V.stride[3] == 1) {
+        for (int e = 0; e < a3; e++) {
+          S::storeu(&V(e / alpha, e % alpha, c, j0 + g), v[e]);
+        }
+      } else {
+        for (int e = 0; e < a3; e++) {
+          S::store(buf + e * lanes, v[e]);
+          for (int l = 0; l < count; l++) {
+            V(e / alpha, e % alpha, c, j0 + g + l) = buf[e * lanes + l];
+          }
+        }
+      }
+    }
+  }
+
+  // Output stage for columns j0 .. j0 + nb - 1 of filter k in M (xi * alpha
+  // + nu, tau, k, j): inverse transforms them and writes them to tiles b0
+  // .. b0 + nb - 1 of the volumes Y (n * K + k, z, y, x).
+  static void output_tiles(const Tensor<Real>& M, int K, int k, int j0,
+                           const VolumeGrid& grid, int b0, int nb, Tensor<Real>& Y) {
+    const int a3 = alpha * alpha * alpha;
+    alignas(TENSOR_ALIGNMENT) Real buf[a3 * lanes];
+    vec mm[a3], y[m * m * m];
+    for (int g = 0; g < nb; g += lanes) {
+      int count = std::min(lanes, nb - g);
+      if (count == lanes && M.stride[3] == 1) {
+        for (int e = 0; e < a3; e++) {
+          mm[e] = S::loadu(&M(e / alpha, e % alpha, k, j0 + g));
+        }
+      } else {
+        for (int e = 0; e < a3; e++) {
+          for (int l = 0; l < lanes; l++) {
+            buf[e * lanes + l] = l < count ? M(e / alpha, e % alpha, k, j0 + g + l) : 0;
+          }
+          mm[e] = S::load(buf + e * lanes);
+        }
+      }
+      // flop: K * P * (alpha^2 + m * alpha + m^2) * P::AT.flops()
+      output_transform(mm, y);
+      for (int e = 0; e < m * m * m; e++) {
+        S::store(buf + e * lanes, y[e]);
+      }
+      // only the part of a partial tile that lies inside the output is kept.
+      for (int l = 0; l < count; l++) {
+        int n, z, yy, x;
+        grid.origin(b0 + g + l, n, z, yy, x);
+        Real* volume = Y.ptr(n * K + k, 0);
+        for (int i = 0; i < m && z + i < grid.out_D; i++) {
+          for (int j = 0; j < m && yy + j < grid.out_H; j++) {
+            for (int h = 0; h < m && x + h < grid.out_W; h++) {
+              volume[(z + i) * Y.stride[1] + (yy + j) * Y.stride[2] + (x + h) * Y.stride[3]] =
+                  buf[((i * m + j) * m + h) * lanes + l];
+            }
+          }
+        }
+      }
+    }
+  }
+};
+
+#endif
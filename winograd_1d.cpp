@@ -0,0 +1,292 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <armadillo>
+#include <math.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "gemm.h"
+#include "tensor.h"
+#include "winograd.h"
+
+using namespace std;
+using namespace arma;
+
+// 1-D winograd convolution F(m, 3) for sequences, and for the separable
+// 1 x 3 and 3 x 1 layers of 2-D networks, parallelised with OpenMP like
+// winograd_openmp.cpp. Every row (or, along the height, every column) of
+// every channel is a sequence; the tiles of all of them share one set of
+// alpha transform-domain GEMMs over (K, C).
+
+double timestamp();
+template <int m, int r>
+void report_winograd_statistics(int K, int C, int P, double time);
+
+// input: K filters of r taps over C channels (filters[k](i, c)), the images
+// viewed as (N, C, rows, L) sequences and the result as (N, K, rows, out_L),
+// all in the working precision Real. Modifies result. The transforms come
+// from WinogradConv1D<m, r, Real> and the products from BatchedGemm, with U
+// packed into its panels as it is transformed.
+//
+// By default V and M are materialised for every tile of every sequence,
+// which for a sequence of a million samples is several times the size of
+// the input. In streaming mode each thread instead walks along the
+// sequences a cache-sized block of tiles at a time, through the input
+// transform, the GEMMs and the output transform, so only one block of V
+// and M per thread is ever live.
+template <int m, int r, typename Real>
+void convolute(int K, int C, int pad, Mat<Real>* filters, const Tensor<Real>& D,
+               Tensor<Real>& Y, bool streaming) {
+  typedef WinogradConv1D<m, r, Real> Conv;
+  typedef BatchedGemm<Real> Gemm;
+  const int alpha = Conv::alpha;
+  SequenceGrid grid(m, r, D.dim[3], D.dim[2], D.dim[0], pad);
+  int P = grid.P;
+
+  // factoring out malloc'ing before measuring runtime. In streaming mode
+  // every thread allocates its own block of V and M instead.
+  Tensor<Real> U(alpha, 1, Gemm::panels(K), C * Gemm::MR);
+  Tensor<Real> V(alpha, 1, C, streaming ? 0 : P);
+  Tensor<Real> M(alpha, 1, K, streaming ? 0 : P);
+
+  // work split as in winograd_openmp.cpp: V by (channel, block of tiles),
+  // M by (xi, block of rows of U, block of tiles), the output by (k, block
+  // of tiles).
+  const int tile_block = 4 * Conv::lanes;
+  const int k_block = 8 * Gemm::MR;
+  const int p_block = 16 * Gemm::NR;
+  int num_tile_blocks = (P + tile_block - 1) / tile_block;
+  int num_k_blocks = (K + k_block - 1) / k_block;
+  int num_p_blocks = (P + p_block - 1) / p_block;
+  int block = min(P, fused_block_size(alpha, K, C, sizeof(Real)));
+  int num_blocks = (P + block - 1) / block;
+
+  double time = timestamp();
+  #pragma omp parallel
+  {
+    #pragma omp for collapse(2)
+    for (int k = 0; k < K; k++) {
+      for (int c = 0; c < C; c++) {
+        Real u[alpha];
+        // flop: K * C * P::G.flops()
+        Conv::filter_transform(filters[k].colptr(c), 1, u);
+        for (int xi = 0; xi < alpha; xi++) {
+          U(xi, 0, k / Gemm::MR, c * Gemm::MR + k % Gemm::MR) = u[xi];
+        }
+      }
+    }
+
+    if (streaming) {
+      Tensor<Real> V_block(alpha, 1, C, block);
+      Tensor<Real> M_block(alpha, 1, K, block);
+      #pragma omp for schedule(dynamic)
+      for (int i = 0; i < num_blocks; i++) {
+        int b0 = i * block;
+        int nb = min(block, P - b0);
+        Tensor<Real> Vb(V_block.data, alpha, 1, C, nb,
+                          V_block.stride[0], V_block.stride[1], nb, 1);
+        Tensor<Real> Mb(M_block.data, alpha, 1, K, nb,
+                          M_block.stride[0], M_block.stride[1], nb, 1);
+        for (int c = 0; c < C; c++) {
+          Conv::input_tiles(D, c, grid, b0, nb, Vb, 0);
+        }
+        for (int xi = 0; xi < alpha; xi++) {
+          Gemm::multiply(U, Vb, Mb, xi, 0);
+        }
+        for (int k = 0; k < K; k++) {
+          Conv::output_tiles(Mb, k, 0, grid, b0, nb, Y);
+        }
+      }
+    } else {
+      #pragma omp for collapse(2)
+      for (int c = 0; c < C; c++) {
+        for (int i = 0; i < num_tile_blocks; i++) {
+          int b = i * tile_block;
+          Conv::input_tiles(D, c, grid, b, min(tile_block, P - b), V, b);
+        }
+      }
+
+      #pragma omp for collapse(3)
+      for (int xi = 0; xi < alpha; xi++) {
+        for (int kb = 0; kb < num_k_blocks; kb++) {
+          for (int pb = 0; pb < num_p_blocks; pb++) {
+            int k0 = kb * k_block, j0 = pb * p_block;
+            // flop: alpha * K * P * (2C - 1)
+            Gemm::multiply_block(U, V, M, xi, 0, k0, min(k_block, K - k0),
+                                 j0, min(p_block, P - j0));
+          }
+        }
+      }
+
+      #pragma omp for collapse(2)
+      for (int k = 0; k < K; k++) {
+        for (int i = 0; i < num_tile_blocks; i++) {
+          int b = i * tile_block;
+          Conv::output_tiles(M, k, b, grid, b, min(tile_block, P - b), Y);
+        }
+      }
+    }
+  }
+
+  time = timestamp() - time;
+  report_winograd_statistics<m, r>(K, C, P, time);
+}
+
+template <typename Real>
+void convolute(int m, int K, int C, int pad, Mat<Real>* filters, const Tensor<Real>& D,
+               Tensor<Real>& Y, bool streaming) {
+  switch (m) {
+    case 2: convolute<2, 3>(K, C, pad, filters, D, Y, streaming); break;
+    case 4: convolute<4, 3>(K, C, pad, filters, D, Y, streaming); break;
+    case 6: convolute<6, 3>(K, C, pad, filters, D, Y, streaming); break;
+  }
+}
+
+double timestamp()
+{
+  struct timeval tv;
+  gettimeofday (&tv, 0);
+  return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+// The transforms count the flops of their generated programs (see
+// TransformPrograms).
+template <int m, int r>
+void report_winograd_statistics(int K, int C, int P, double time) {
+  typedef TransformPrograms<m, r> Programs;
+  long int alpha = m + r - 1;
+  long int flop = ((long) K * C * Programs::G.flops() +
+                   (long) C * P * Programs::BT.flops() +
+                   alpha * K * P * (2 * C - 1) +
+                   (long) K * P * Programs::AT.flops());
+  double mflops = flop / (1024.0 * 1024.0 * time);
+  cout << "Floating point operations: " << flop << "\n";
+  cout << "Time Elapsed: " << time << "\n";
+  cout << "MFlop/s: " << mflops << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+  // -m picks the output tile size, -a the axis the 3-tap filters run along
+  // (w for 1 x 3 filters along the rows, the default, or h for 3 x 1
+  // filters down the columns), -p the zero padding along that axis (valid,
+  // same or a width), -f streams the sequences through the pipeline a
+  // block of tiles at a time and -P picks the working precision (float by
+  // default, see parse_precision). A 1-D problem is a "K C 1 L" file, one
+  // row per channel.
+  int m = 2;
+  const int r = 3;
+  const char* axis = "w";
+  const char* pad_arg = "valid";
+  int pad = 0;
+  bool streaming = false;
+  const char* precision_arg = "float";
+  bool bad_usage = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "m:a:p:fP:")) != -1) {
+    switch (opt) {
+      case 'm': m = atoi(optarg); break;
+      case 'a': axis = optarg; break;
+      case 'p': pad_arg = optarg; break;
+      case 'f': streaming = true; break;
+      case 'P': precision_arg = optarg; break;
+      default: bad_usage = true;
+    }
+  }
+  if (!parse_padding(pad_arg, r, pad)) {
+    bad_usage = true;
+  }
+  bool use_double;
+  if (!parse_precision(precision_arg, use_double)) {
+    bad_usage = true;
+  }
+  bool along_h = strcmp(axis, "h") == 0;
+  if (!along_h && strcmp(axis, "w") != 0) {
+    bad_usage = true;
+  }
+  if (bad_usage || argc - optind != 2) {
+    cout << "Usage: ./winograd_1d [-m tile size (2, 4 or 6)] [-a w|h] [-p valid|same|padding] [-f] [-P float|double] <input filename> <output filename>\n";
+    return 1;
+  }
+  if (m != 2 && m != 4 && m != 6) {
+    cout << "Error: Output tile size must be 2, 4 or 6." << endl;
+    return 1;
+  }
+  ifstream file;
+  file.open(argv[optind]);
+  // the header is "K C H W", or "K C H W N" for a batch of N images.
+  int K, C, H, W, N = 1;
+  string header;
+  getline(file, header);
+  istringstream header_fields(header);
+  header_fields >> K >> C >> H >> W;
+  if (!(header_fields >> N)) {
+    N = 1;
+  }
+
+  // the length of the sequences and the number of them per channel.
+  int L = along_h ? H : W, rows = along_h ? W : H;
+  if (L + 2 * pad < r) {
+    cout << "Error: Padded sequence is shorter than the filter." << endl;
+    return 1;
+  }
+
+  // from here on the filters, sequences and outputs are read, convolved
+  // and written in the working precision.
+  auto run = [&](auto zero) {
+    typedef decltype(zero) Real;
+
+    // a 1 x 3 and a 3 x 1 filter both list their three taps in order.
+    Mat<Real>* filters = new Mat<Real>[K]();
+    for (int i = 0; i < K; i++) {
+      filters[i] = Mat<Real>(r, C);
+      for (int j = 0; j < C; j++) {
+        for (int tap = 0; tap < r; tap++) {
+          file >> filters[i](tap, j);
+        }
+      }
+    }
+
+    // slice n * C + c holds channel c of image n.
+    Cube<Real> image = Cube<Real>(H, W, N * C);
+    for (int i = 0; i < N * C; i++) {
+      for (int row = 0; row < H; row++) {
+        for (int col = 0; col < W; col++) {
+          file >> image(row, col, i);
+        }
+      }
+    }
+    file.close();
+
+    int out_L = L + 2 * pad - r + 1;
+    int out_H = along_h ? out_L : H, out_W = along_h ? W : out_L;
+    Cube<Real> result = Cube<Real>(out_H, out_W, N * K);
+    // views of the image and result cubes as (n, channel, sequence, position).
+    // Armadillo stores each slice column-major, so the columns are the unit
+    // stride sequences of a 3 x 1 layer and the rows those of a 1 x 3 layer.
+    long in_rs = along_h ? H : 1, in_ts = along_h ? 1 : H;
+    long out_rs = along_h ? out_H : 1, out_ts = along_h ? 1 : out_H;
+    Tensor<Real> D(image.memptr(), N, C, rows, L, (long) C * H * W, (long) H * W, in_rs, in_ts);
+    Tensor<Real> Y(result.memptr(), N, K, rows, out_L, (long) K * out_H * out_W,
+                   (long) out_H * out_W, out_rs, out_ts);
+    convolute(m, K, C, pad, filters, D, Y, streaming);
+
+    ofstream fileout;
+    fileout.open(argv[optind + 1], ofstream::out | ofstream::trunc );
+    fileout << K << " " << C << " " << H << " " << W;
+    if (N > 1) {
+      fileout << " " << N;
+    }
+    fileout << endl;
+    for (int i = 0; i < N * K; i++) {
+      fileout << result.slice(i) << "\n";
+    }
+    fileout.close();
+
+    delete[] filters;
+    return 0;
+  };
+  return use_double ? run(0.0) : run(0.0f);
+}
@@ -0,0 +1,274 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <armadillo>
+#include <math.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "gemm.h"
+#include "tensor.h"
+#include "winograd.h"
+
+using namespace std;
+using namespace arma;
+
+// 3-D winograd convolution F(m x m x m, 3 x 3 x 3) for volumes, parallelised
+// with OpenMP like winograd_openmp.cpp. See comments in winograd.cpp.
+
+double timestamp();
+template <int m, int r>
+void report_winograd_statistics(int K, int C, int P, double time);
+
+// U(xi * alpha + nu, tau)(k, c) for all transform points, written straight
+// into the packed GEMM panels. Slice c * r + i of filters[k] is depth i of
+// the filter's channel c.
+template <int m, int r, typename Real>
+void filter_transform(Cube<Real>* filters, int k, int c, Tensor<Real>& U) {
+  typedef WinogradConv3D<m, r, Real> Conv;
+  typedef BatchedGemm<Real> Gemm;
+  const int alpha = Conv::alpha;
+  Real u[alpha * alpha * alpha];
+  // flop: K * C * (r^2 + alpha * r + alpha^2) * P::G.flops()
+  Conv::filter_transform(filters[k].slice_memptr(c * r), r * r, 1, r, u);
+  for (int e = 0; e < alpha * alpha * alpha; e++) {
+    U(e / alpha, e % alpha, k / Gemm::MR, c * Gemm::MR + k % Gemm::MR) = u[e];
+  }
+}
+
+// input: K filters, C channels, N volumes X (n * C + c, z, y, x) and the
+// result Y (n * K + k, z, y, x), all in the working precision Real.
+// Modifies result. The transforms come from WinogradConv3D<m, r, Real> and
+// the alpha^3 transform-domain products from BatchedGemm.
+//
+// By default V and M are materialised for the whole batch. When streaming
+// over depth the threads instead work through the volumes one slab of
+// tiles (m output planes) at a time, and V and M only ever hold one slab:
+// for a 256^3 volume that is 1/128th of the whole.
+template <int m, int r, typename Real>
+void convolute(int K, int C, int pad, Cube<Real>* filters, const Tensor<Real>& X,
+               Tensor<Real>& Y, bool streaming) {
+  typedef WinogradConv3D<m, r, Real> Conv;
+  typedef BatchedGemm<Real> Gemm;
+  const int alpha = Conv::alpha;
+  const int points = alpha * alpha * alpha;
+  VolumeGrid grid(m, r, X.dim[1], X.dim[2], X.dim[3], X.dim[0] / C, pad);
+  int P = grid.P;
+  int block = streaming ? grid.slab : P;
+
+  // factoring out malloc'ing before measuring runtime.
+  Tensor<Real> U(alpha * alpha, alpha, Gemm::panels(K), C * Gemm::MR);
+  Tensor<Real> V(alpha * alpha, alpha, C, block);
+  Tensor<Real> M(alpha * alpha, alpha, K, block);
+
+  // work split as in winograd_openmp.cpp, within each block: V by
+  // (channel, group of tiles), M by (transform point, block of rows of U,
+  // block of tiles) and the output by (k, group of tiles).
+  const int tile_block = Conv::lanes;
+  const int k_block = 8 * Gemm::MR;
+  const int p_block = 16 * Gemm::NR;
+  int num_tile_blocks = (block + tile_block - 1) / tile_block;
+  int num_k_blocks = (K + k_block - 1) / k_block;
+  int num_p_blocks = (block + p_block - 1) / p_block;
+
+  double time = timestamp();
+  // one parallel region for the whole convolution; all threads walk
+  // through the blocks together and split each phase of a block.
+  #pragma omp parallel
+  {
+    #pragma omp for collapse(2)
+    for (int k = 0; k < K; k++) {
+      for (int c = 0; c < C; c++) {
+        filter_transform<m, r>(filters, k, c, U);
+      }
+    }
+
+    for (int b0 = 0; b0 < P; b0 += block) {
+      int nb = min(block, P - b0);
+      Tensor<Real> Vb(V.data, alpha * alpha, alpha, C, nb, V.stride[0], V.stride[1], nb, 1);
+      Tensor<Real> Mb(M.data, alpha * alpha, alpha, K, nb, M.stride[0], M.stride[1], nb, 1);
+
+      #pragma omp for collapse(2)
+      for (int c = 0; c < C; c++) {
+        for (int i = 0; i < num_tile_blocks; i++) {
+          int j = i * tile_block;
+          if (j < nb) {
+            Conv::input_tiles(X, C, c, grid, b0 + j, min(tile_block, nb - j), Vb, j);
+          }
+        }
+      }
+
+      #pragma omp for collapse(3)
+      for (int e = 0; e < points; e++) {
+        for (int kb = 0; kb < num_k_blocks; kb++) {
+          for (int pb = 0; pb < num_p_blocks; pb++) {
+            int k0 = kb * k_block, j0 = pb * p_block;
+            if (j0 < nb) {
+              // flop: alpha^3 * K * P * (2C - 1)
+              Gemm::multiply_block(U, Vb, Mb, e / alpha, e % alpha, k0, min(k_block, K - k0),
+                                   j0, min(p_block, nb - j0));
+            }
+          }
+        }
+      }
+
+      #pragma omp for collapse(2)
+      for (int k = 0; k < K; k++) {
+        for (int i = 0; i < num_tile_blocks; i++) {
+          int j = i * tile_block;
+          if (j < nb) {
+            Conv::output_tiles(Mb, K, k, j, grid, b0 + j, min(tile_block, nb - j), Y);
+          }
+        }
+      }
+    }
+  }
+
+  time = timestamp() - time;
+  report_winograd_statistics<m, r>(K, C, P, time);
+}
+
+template <typename Real>
+void convolute(int m, int K, int C, int pad, Cube<Real>* filters, const Tensor<Real>& X,
+               Tensor<Real>& Y, bool streaming) {
+  switch (m) {
+    case 2: convolute<2, 3>(K, C, pad, filters, X, Y, streaming); break;
+    case 4: convolute<4, 3>(K, C, pad, filters, X, Y, streaming); break;
+  }
+}
+
+double timestamp()
+{
+  struct timeval tv;
+  gettimeofday (&tv, 0);
+  return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+// The transforms count the flops of their generated programs (see
+// TransformPrograms), applied r^2, alpha r and alpha^2 times along the axes
+// of a filter, alpha^2 times along each axis of an input tile and alpha^2,
+// m alpha and m^2 times along those of an output tile.
+template <int m, int r>
+void report_winograd_statistics(int K, int C, int P, double time) {
+  typedef TransformPrograms<m, r> Programs;
+  long int alpha = m + r - 1;
+  long int flop = ((long) K * C * (r * r + alpha * r + alpha * alpha) * Programs::G.flops() +
+                   (long) C * P * alpha * alpha * Programs::BT.flops() * 3 +
+                   alpha * alpha * alpha * K * P * (2 * C - 1) +
+                   (long) K * P * (alpha * alpha + m * alpha + m * m) * Programs::AT.flops());
+  double mflops = flop / (1024.0 * 1024.0 * time);
+  cout << "Floating point operations: " << flop << "\n";
+  cout << "Time Elapsed: " << time << "\n";
+  cout << "MFlop/s: " << mflops << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+  // -m picks the output tile size (2 for F(2x2x2, 3x3x3), alpha^3 = 64
+  // transform points, or 4), -p the zero padding on every face (valid,
+  // same or a width), -f streams over depth and -P picks the working
+  // precision (float by default, see parse_precision).
+  int m = 2;
+  const int r = 3;
+  const char* pad_arg = "valid";
+  int pad = 0;
+  bool streaming = false;
+  const char* precision_arg = "float";
+  bool bad_usage = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "m:p:fP:")) != -1) {
+    switch (opt) {
+      case 'm': m = atoi(optarg); break;
+      case 'p': pad_arg = optarg; break;
+      case 'f': streaming = true; break;
+      case 'P': precision_arg = optarg; break;
+      default: bad_usage = true;
+    }
+  }
+  if (!parse_padding(pad_arg, r, pad)) {
+    bad_usage = true;
+  }
+  bool use_double;
+  if (!parse_precision(precision_arg, use_double)) {
+    bad_usage = true;
+  }
+  if (bad_usage || argc - optind != 2) {
+    cout << "Usage: ./winograd_3d [-m tile size (2 or 4)] [-p valid|same|padding] [-f] [-P float|double] <input filename> <output filename>\n";
+    return 1;
+  }
+  if (m != 2 && m != 4) {
+    cout << "Error: Output tile size must be 2 or 4." << endl;
+    return 1;
+  }
+  ifstream file;
+  file.open(argv[optind]);
+  // the header of a volume problem is "K C D H W", or "K C D H W N" for a
+  // batch of N volumes (see gen_volume.py).
+  int K, C, D, H, W, N = 1;
+  string header;
+  getline(file, header);
+  istringstream header_fields(header);
+  header_fields >> K >> C >> D >> H >> W;
+  if (!(header_fields >> N)) {
+    N = 1;
+  }
+  if (D + 2 * pad < r || H + 2 * pad < r || W + 2 * pad < r) {
+    cout << "Error: Padded volume is smaller than the filter." << endl;
+    return 1;
+  }
+
+  // from here on the filters, volumes and outputs are read, convolved and
+  // written in the working precision.
+  auto run = [&](auto zero) {
+    typedef decltype(zero) Real;
+
+    // each filter is C channels of r planes of r x r.
+    Cube<Real>* filters = new Cube<Real>[K]();
+    for (int i = 0; i < K; i++) {
+      filters[i] = Cube<Real>(r, r, C * r);
+      for (int j = 0; j < C * r; j++) {
+        for (int row = 0; row < r; row++) {
+          for (int col = 0; col < r; col ++) {
+            file >> filters[i](row, col, j);
+          }
+        }
+      }
+    }
+
+    // slice (n * C + c) * D + z holds plane z of channel c of volume n.
+    Cube<Real> volume = Cube<Real>(H, W, N * C * D);
+    for (int i = 0; i < N * C * D; i++) {
+      for (int row = 0; row < H; row++) {
+        for (int col = 0; col < W; col++) {
+          file >> volume(row, col, i);
+        }
+      }
+    }
+    file.close();
+
+    int out_D = D + 2 * pad - r + 1, out_H = H + 2 * pad - r + 1, out_W = W + 2 * pad - r + 1;
+    Cube<Real> result = Cube<Real>(out_H, out_W, N * K * out_D);
+    // views of the volume and result cubes as (volume, plane, row, col);
+    // Armadillo stores each slice column-major.
+    Tensor<Real> X(volume.memptr(), N * C, D, H, W, (long) D * H * W, (long) H * W, 1, H);
+    Tensor<Real> Y(result.memptr(), N * K, out_D, out_H, out_W,
+                   (long) out_D * out_H * out_W, (long) out_H * out_W, 1, out_H);
+    convolute(m, K, C, pad, filters, X, Y, streaming);
+
+    ofstream fileout;
+    fileout.open(argv[optind + 1], ofstream::out | ofstream::trunc );
+    fileout << K << " " << C << " " << D << " " << H << " " << W;
+    if (N > 1) {
+      fileout << " " << N;
+    }
+    fileout << endl;
+    for (int i = 0; i < N * K * out_D; i++) {
+      fileout << result.slice(i) << "\n";
+    }
+    fileout.close();
+
+    delete[] filters;
+    return 0;
+  };
+  return use_double ? run(0.0) : run(0.0f);
+}
@@ -11,346 +11,828 @@
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <sstream>
 #include <math.h>
 #include <sys/time.h>
+#include <unistd.h>
 #include "clhelp.h"
+#include "filter_pack.h"
+#include "network.h"
+#include "winograd.h"
 
 using namespace std;
 
-/* We are using 3 x 3 filters and an output tile size of 2 x 2. 
- * alpha = m + r - 1 = 4 */
-#define m 2
-#define r 3
-#define alpha 4
-
 /* Returns the next number greater than or equal to global_size that is a 
  * multiple of local_size.*/
-int gws(int global_size, int local_size) {
+size_t gws(size_t global_size, size_t local_size) {
   if (global_size % local_size != 0)    
     return (global_size + local_size) / local_size * local_size;
   else
     return global_size;
 }
 
-void report_winograd_statistics(int K, int C, int P, double time) {
-  int flop = (K * C * (4 * 3 * 5) * 2 +
-              C * P * (4 * 4 * 7) * 2 + 
-              16 * K * P * (2 * C - 1) + 
-              K * P * (2 * 4 * 7) * 2);
+/* The transforms of F(m x m, r x r) generated as straight-line programs
+ * (TransformPrograms in winograd.h): their OpenCL source, which goes in
+ * front of winograd.cl, and the flops of one filter, input tile and output
+ * tile. */
+struct GeneratedTransforms {
+  std::string source;
+  long int filter_flops, input_flops, output_flops;
+};
+
+template <int m, int r>
+GeneratedTransforms generate_transforms() {
+  typedef TransformPrograms<m, r> Programs;
+  GeneratedTransforms t;
+  t.source = Programs::G.opencl_source("transform_G") +
+             Programs::BT.opencl_source("transform_BT") +
+             Programs::AT.opencl_source("transform_AT");
+  t.filter_flops = Programs::filter_flops();
+  t.input_flops = Programs::input_flops();
+  t.output_flops = Programs::output_flops();
+  return t;
+}
+
+/* C input channels split into the given number of groups; the filter
+ * transform only counts when U was not kept (taken from a filter pack). */
+long int winograd_flop(const GeneratedTransforms &t, int m, int r, int K, int C, int groups,
+                       int P, bool kept_U) {
+  long int alpha = m + r - 1;
+  long int Cg = C / groups;
+  return ((kept_U ? 0 : K * Cg * t.filter_flops) +
+          C * P * t.input_flops +
+          alpha * alpha * K * P * (2 * Cg - 1) +
+          K * P * t.output_flops);
+}
+
+void report_flop(long int flop, double time) {
   double mflops = flop / (1024.0 * 1024.0 * time);
   cout << "Floating point operations: " << flop << "\n";
   cout << "Time Elapsed: " << time << "\n";
   cout << "MFlop/s: " << mflops << "\n";
 }
 
+void report_winograd_statistics(const GeneratedTransforms &t, int m, int r, int K, int C,
+                                int groups, int P, bool kept_U, double time) {
+  report_flop(winograd_flop(t, m, r, K, C, groups, P, kept_U), time);
+}
+
+/* The launches of the kernels of winograd.cl, shared by main and every
+ * layer of run_network: each sets the arguments of its kernel and
+ * enqueues it with its work sizes. */
+
+/* filter_transform: U from the K x Cg filters of filter_r x filter_r,
+ * each channel of which is split into the phases = stride^2 * splits^2
+ * sub-filters of the kernels' r x r (see TileGrid in winograd.h). */
+void enqueue_filter_transform(cl_vars_t &cv, cl_kernel kern, cl_mem filters, cl_mem U, int K,
+                              int Cg, int filter_r, int stride, int splits)
+{
+  int sub_Cg = Cg * stride * stride * splits * splits;
+  size_t global_work_size[2] = {gws(K, 8), gws(sub_Cg, 4)};
+  size_t local_work_size[2] = {8, 4};
+  cl_int err = clSetKernelArg(kern, 0, sizeof(cl_mem), &filters);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 1, sizeof(cl_mem), &U);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 2, sizeof(int), &K);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 3, sizeof(int), &sub_Cg);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 4, sizeof(int), &filter_r);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 5, sizeof(int), &stride);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 6, sizeof(int), &splits);
+  CHK_ERR(err);
+  err = clEnqueueNDRangeKernel(cv.commands, kern, 2, NULL,
+         global_work_size, local_work_size, 0, NULL, NULL);
+  CHK_ERR(err);
+}
+
+/* data_transform: V from the N x C channels of H x W in data, cut into
+ * the P = N x num_h_tiles x num_w_tiles tiles. Every channel gives the
+ * phases = stride^2 * splits^2 channels of V of its sub-problems. */
+void enqueue_data_transform(cl_vars_t &cv, cl_kernel kern, cl_mem data, cl_mem V, int C,
+                            int P, int H, int W, int num_h_tiles, int num_w_tiles, int pad,
+                            int dilation, int stride, int splits)
+{
+  int N = P / (num_h_tiles * num_w_tiles);
+  int phases = stride * stride * splits * splits;
+  size_t global_work_size[3] = {gws(N*C*phases, 4), gws(num_h_tiles, 4), gws(num_w_tiles, 4)};
+  size_t local_work_size[3] = {4, 4, 4};
+  cl_int err = clSetKernelArg(kern, 0, sizeof(cl_mem), &data);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 1, sizeof(cl_mem), &V);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 2, sizeof(int), &C);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 3, sizeof(int), &P);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 4, sizeof(int), &H);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 5, sizeof(int), &W);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 6, sizeof(int), &num_h_tiles);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 7, sizeof(int), &num_w_tiles);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 8, sizeof(int), &pad);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 9, sizeof(int), &pad);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 10, sizeof(int), &dilation);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 11, sizeof(int), &stride);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 12, sizeof(int), &splits);
+  CHK_ERR(err);
+  err = clEnqueueNDRangeKernel(cv.commands, kern, 3, NULL,
+         global_work_size, local_work_size, 0, NULL, NULL);
+  CHK_ERR(err);
+}
+
+/* calc_M, or calc_M_depthwise for groups of a few channels, which skips
+ * the reduction and runs one work item per element of M, tiles first. */
+void enqueue_calc_M(cl_vars_t &cv, cl_kernel kern, bool depthwise, cl_mem U, cl_mem V,
+                    cl_mem M, int K, int P, int C, int groups, int alpha)
+{
+  size_t global_work_size[2] = {gws(K, 8), gws(P, 8)};
+  size_t local_work_size[2] = {8, 8};
+  if (depthwise) {
+    global_work_size[0] = gws(P, 32);
+    global_work_size[1] = gws(alpha*alpha*K, 2);
+    local_work_size[0] = 32;
+    local_work_size[1] = 2;
+  }
+  cl_int err = clSetKernelArg(kern, 0, sizeof(cl_mem), &U);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 1, sizeof(cl_mem), &V);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 2, sizeof(cl_mem), &M);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 3, sizeof(int), &K);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 4, sizeof(int), &P);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 5, sizeof(int), &C);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 6, sizeof(int), &groups);
+  CHK_ERR(err);
+  err = clEnqueueNDRangeKernel(cv.commands, kern, 2, NULL,
+         global_work_size, local_work_size, 0, NULL, NULL);
+  CHK_ERR(err);
+}
+
+/* calc_Y: the inverse transform of M and the epilogue, into the N x K
+ * channels of out_H x out_W in Y. bias and residual may be NULL. */
+void enqueue_calc_Y(cl_vars_t &cv, cl_kernel kern, cl_mem M, cl_mem Y, int out_H,
+                    int out_W, int K, int P, int num_h_tiles, int num_w_tiles, int dilation,
+                    cl_mem bias, cl_mem residual, Activation activation, float slope)
+{
+  int N = P / (num_h_tiles * num_w_tiles);
+  size_t global_work_size[3] = {gws(N*K, 2), gws(num_h_tiles, 8), gws(num_w_tiles, 8)};
+  size_t local_work_size[3] = {2, 8, 8};
+  cl_int err = clSetKernelArg(kern, 0, sizeof(cl_mem), &M);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 1, sizeof(cl_mem), &Y);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 2, sizeof(int), &out_H);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 3, sizeof(int), &out_W);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 4, sizeof(int), &K);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 5, sizeof(int), &P);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 6, sizeof(int), &num_h_tiles);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 7, sizeof(int), &num_w_tiles);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 8, sizeof(int), &dilation);
+  CHK_ERR(err);
+  /* A NULL buffer reaches the kernel as a NULL pointer. */
+  err = clSetKernelArg(kern, 9, sizeof(cl_mem), bias ? &bias : NULL);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 10, sizeof(cl_mem), residual ? &residual : NULL);
+  CHK_ERR(err);
+  int activation_id = activation;
+  err = clSetKernelArg(kern, 11, sizeof(int), &activation_id);
+  CHK_ERR(err);
+  err = clSetKernelArg(kern, 12, sizeof(float), &slope);
+  CHK_ERR(err);
+  err = clEnqueueNDRangeKernel(cv.commands, kern, 3, NULL,
+         global_work_size, local_work_size, 0, NULL, NULL);
+  CHK_ERR(err);
+}
+
+/* Device buffers for the activations between the layers of a network. A
+ * buffer is handed out again once the last layer that reads it has run,
+ * as ActivationPool does in winograd_openmp.cpp. */
+struct DeviceBufferPool {
+  cl_context context;
+  std::vector<cl_mem> buffers;
+  std::vector<size_t> sizes;
+  std::vector<bool> in_use;
+
+  DeviceBufferPool(cl_context context) : context(context) {}
+
+  ~DeviceBufferPool() {
+    clear();
+  }
+
+  /* Releases every buffer; the context must still be alive. */
+  void clear() {
+    for (size_t i = 0; i < buffers.size(); i++)
+      clReleaseMemObject(buffers[i]);
+    buffers.clear();
+    sizes.clear();
+    in_use.clear();
+  }
+
+  cl_mem acquire(size_t size) {
+    for (size_t i = 0; i < buffers.size(); i++) {
+      if (!in_use[i] && sizes[i] >= size) {
+        in_use[i] = true;
+        return buffers[i];
+      }
+    }
+    cl_int err = CL_SUCCESS;
+    cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float)*size, NULL, &err);
+    CHK_ERR(err);
+    buffers.push_back(buffer);
+    sizes.push_back(size);
+    in_use.push_back(true);
+    return buffer;
+  }
+
+  void release(cl_mem buffer) {
+    for (size_t i = 0; i < buffers.size(); i++) {
+      if (buffers[i] == buffer)
+        in_use[i] = false;
+    }
+  }
+};
+
+/* The kernels and generated transforms of one filter size rs of the
+ * sub-problems of a layer: main builds one, and the layers of a network
+ * whose filters and strides cut into rs x rs pieces share one. */
+struct KernelSet {
+  GeneratedTransforms transforms;
+  std::map<std::string, cl_kernel> kernels;
+  cl_program program;
+};
+
+/* Builds the kernels of winograd.cl for F(m x m, rs x rs), with U, V and
+ * M stored as the storage option says, in front of the straight-line
+ * transforms generated for it. */
+void build_kernel_set(cl_vars_t &cv, int m, int rs, Storage storage, KernelSet &set)
+{
+  int alpha = m + rs - 1;
+  switch (m * 10 + rs) {
+    case 23: set.transforms = generate_transforms<2, 3>(); break;
+    case 43: set.transforms = generate_transforms<4, 3>(); break;
+    case 63: set.transforms = generate_transforms<6, 3>(); break;
+    case 22: set.transforms = generate_transforms<2, 2>(); break;
+    case 42: set.transforms = generate_transforms<4, 2>(); break;
+    case 62: set.transforms = generate_transforms<6, 2>(); break;
+  }
+
+  /* Both GEMM kernels: main and each layer of a network pick theirs. */
+  std::string kernel_source_str;
+  std::string kernel_file = std::string("winograd.cl");
+  std::list<std::string> kernel_names;
+  kernel_names.push_back("filter_transform");
+  kernel_names.push_back("data_transform");
+  kernel_names.push_back("calc_M");
+  kernel_names.push_back("calc_M_depthwise");
+  kernel_names.push_back("calc_Y");
+  readFile(kernel_file, kernel_source_str);
+  kernel_source_str = set.transforms.source + kernel_source_str;
+  std::ostringstream build_options;
+  build_options << "-D m=" << m << " -D r=" << rs << " -D alpha=" << alpha;
+  if (storage == STORAGE_HALF)
+    build_options << " -D HALF_STORAGE";
+  compile_ocl_program(set.kernels, cv, kernel_source_str.c_str(), kernel_names,
+          build_options.str().c_str());
+  set.program = cv.main_program;
+}
+
+/* Runs the layers of a network file (see network.h) back to back with all
+ * activations on the device: the images are uploaded once, every calc_Y
+ * writes the buffer the next data_transform reads (and later residuals
+ * add), and only the output of the last layer is read back. As in main,
+ * strided layers and 5 x 5 and 7 x 7 filters run as sub-problems of
+ * rs x rs pieces (2 or 3); the kernels are built once for each rs the
+ * layers need. Padding, dilation, groups and epilogues may differ from
+ * layer to layer. U, V and M are stored as the storage option says.
+ * Returns the exit status of the program. */
+int run_network(int m, Storage storage, const char *input_filename,
+                const char *output_filename)
+{
+  ifstream file;
+  file.open(input_filename);
+  Network net;
+  if (!read_network(file, net)) {
+    file.close();
+    return 1;
+  }
+  int L = net.layers.size();
+  int N = net.N;
+  size_t store_size = storage == STORAGE_HALF ? sizeof(cl_half) : sizeof(float);
+
+  /* Read in the images, data[n][c][i][j]. */
+  float *data = new float[N*net.C*net.H*net.W];
+  for (int i = 0; i < N*net.C*net.H*net.W; i++)
+    file >> data[i];
+  file.close();
+
+  /* The sub-problems and tile grid of every layer, as in main, and the
+   * largest V and M of them all: one pair of buffers serves every
+   * layer. */
+  std::vector<int> rs(L), splits(L), phases(L), alpha(L);
+  std::vector<int> num_h_tiles(L), num_w_tiles(L), P(L);
+  size_t V_size = 0, M_size = 0;
+  for (int l = 0; l < L; l++) {
+    const NetworkLayer &layer = net.layers[l];
+    int d = layer.dilation;
+    rs[l] = piece_size(layer.r, layer.stride);
+    splits[l] = piece_splits(layer.r, layer.stride);
+    phases[l] = layer.stride * layer.stride * splits[l] * splits[l];
+    alpha[l] = m + rs[l] - 1;
+    num_h_tiles[l] = d * (((layer.out_H + d - 1) / d + m - 1) / m);
+    num_w_tiles[l] = d * (((layer.out_W + d - 1) / d + m - 1) / m);
+    P[l] = N * num_h_tiles[l] * num_w_tiles[l];
+    V_size = max(V_size, (size_t) layer.C*phases[l]*P[l]*alpha[l]*alpha[l]);
+    M_size = max(M_size, (size_t) layer.K*P[l]*alpha[l]*alpha[l]);
+  }
+
+  /* OpenCL setup: a kernel set for each piece size in use. */
+  cl_vars_t cv;
+  initialize_ocl(cv);
+  std::map<int, KernelSet> sets;
+  for (int l = 0; l < L; l++) {
+    if (!sets.count(rs[l]))
+      build_kernel_set(cv, m, rs[l], storage, sets[rs[l]]);
+  }
+
+  /* The weights of every layer, uploaded once: filters, biases (NULL if
+   * none) and the transformed filters U. */
+  cl_int err = CL_SUCCESS;
+  std::vector<cl_mem> g_filters(L), g_bias(L, (cl_mem) NULL), g_U(L);
+  for (int l = 0; l < L; l++) {
+    const NetworkLayer &layer = net.layers[l];
+    int Cg = layer.C / layer.groups;
+    int r = layer.r;
+    std::vector<float> filters(layer.filters.begin(), layer.filters.end());
+    g_filters[l] = clCreateBuffer(cv.context,CL_MEM_READ_ONLY,
+             sizeof(float)*layer.K*Cg*r*r,NULL,&err);
+    CHK_ERR(err);
+    err = clEnqueueWriteBuffer(cv.commands, g_filters[l], true, 0,
+             sizeof(float)*layer.K*Cg*r*r, filters.data(), 0, NULL, NULL);
+    CHK_ERR(err);
+    g_U[l] = clCreateBuffer(cv.context,CL_MEM_READ_WRITE,
+             store_size*layer.K*Cg*phases[l]*alpha[l]*alpha[l],NULL,&err);
+    CHK_ERR(err);
+    if (!layer.bias.empty()) {
+      std::vector<float> bias(layer.bias.begin(), layer.bias.end());
+      g_bias[l] = clCreateBuffer(cv.context,CL_MEM_READ_ONLY,
+               sizeof(float)*layer.K,NULL,&err);
+      CHK_ERR(err);
+      err = clEnqueueWriteBuffer(cv.commands, g_bias[l], true, 0,
+               sizeof(float)*layer.K, bias.data(), 0, NULL, NULL);
+      CHK_ERR(err);
+    }
+  }
+
+  cl_mem g_V, g_M;
+  g_V = clCreateBuffer(cv.context,CL_MEM_READ_WRITE,store_size*V_size,NULL,&err);
+  CHK_ERR(err);
+  g_M = clCreateBuffer(cv.context,CL_MEM_READ_WRITE,store_size*M_size,NULL,&err);
+  CHK_ERR(err);
+
+  /* g_act[l] holds activation l: the images, then the output of each
+   * layer, taken from the pool. */
+  DeviceBufferPool pool(cv.context);
+  std::vector<cl_mem> g_act(L + 1, (cl_mem) NULL);
+  g_act[0] = clCreateBuffer(cv.context,CL_MEM_READ_ONLY,
+           sizeof(float)*N*net.C*net.H*net.W,NULL,&err);
+  CHK_ERR(err);
+  err = clEnqueueWriteBuffer(cv.commands, g_act[0], true, 0,
+           sizeof(float)*N*net.C*net.H*net.W, data, 0, NULL, NULL);
+  CHK_ERR(err);
+
+  /* From here on the host only enqueues kernels; the in-order queue
+   * orders each layer after the one it reads. */
+  long int flop = 0;
+  double time = timestamp();
+  for (int l = 0; l < L; l++) {
+    const NetworkLayer &layer = net.layers[l];
+    KernelSet &set = sets[rs[l]];
+    int K = layer.K, C = layer.C, H = layer.H, W = layer.W;
+    int Cg = C / layer.groups;
+    int groups = layer.groups, pad = layer.pad, dilation = layer.dilation;
+    int out_H = layer.out_H, out_W = layer.out_W;
+    g_act[l + 1] = pool.acquire((size_t) N*K*out_H*out_W);
+
+    /* The filter transform of the layer, the data transform of the
+     * previous activation, M, and the output transform and epilogue into
+     * the next activation. */
+    enqueue_filter_transform(cv, set.kernels["filter_transform"], g_filters[l], g_U[l], K, Cg,
+                             layer.r, layer.stride, splits[l]);
+    enqueue_data_transform(cv, set.kernels["data_transform"], g_act[l], g_V, C, P[l], H, W,
+                           num_h_tiles[l], num_w_tiles[l], pad, dilation, layer.stride,
+                           splits[l]);
+    bool depthwise = Cg * phases[l] <= 4;
+    enqueue_calc_M(cv, set.kernels[depthwise ? "calc_M_depthwise" : "calc_M"], depthwise,
+                   g_U[l], g_V, g_M, K, P[l], C * phases[l], groups, alpha[l]);
+    cl_mem residual = layer.residual >= 0 ? g_act[layer.residual] : NULL;
+    enqueue_calc_Y(cv, set.kernels["calc_Y"], g_M, g_act[l + 1], out_H, out_W, K, P[l],
+                   num_h_tiles[l], num_w_tiles[l], dilation, g_bias[l], residual,
+                   layer.activation, layer.slope);
+
+    /* Buffers no later layer reads go back to the pool; the queue runs
+     * in order, so whichever layer reuses one runs after this one. */
+    for (int j = 1; j <= l; j++) {
+      if (g_act[j] && net.last_use(j) == l + 1) {
+        pool.release(g_act[j]);
+        g_act[j] = NULL;
+      }
+    }
+    flop += winograd_flop(set.transforms, m, rs[l], K, C * phases[l], groups, P[l], false);
+  }
+  err = clFinish(cv.commands);
+  CHK_ERR(err);
+  time = timestamp() - time;
+
+  size_t pooled = 0;
+  for (size_t i = 0; i < pool.sizes.size(); i++)
+    pooled += pool.sizes[i];
+  cout << "Network: " << L << " layers, " << pool.buffers.size()
+       << " activation buffers of " << sizeof(float)*pooled / (1024.0 * 1024.0)
+       << " MB in all\n";
+  report_flop(flop, time);
+
+  /* The only read back: the output of the last layer. */
+  const NetworkLayer &last = net.layers[L - 1];
+  int out_size = N*last.K*last.out_H*last.out_W;
+  float *Y = new float[out_size];
+  err = clEnqueueReadBuffer(cv.commands, g_act[L], true, 0, sizeof(float)*out_size,
+           Y, 0, NULL, NULL);
+  CHK_ERR(err);
+
+  ofstream fileout;
+  fileout.open(output_filename, ofstream::out | ofstream::trunc);
+  fileout << last.K << " " << net.C << " " << net.H << " " << net.W;
+  if (N > 1)
+    fileout << " " << N;
+  fileout << endl;
+  for(int k = 0; k < N*last.K; k++) {
+    fileout << "\n";
+    for(int i = 0; i < last.out_H; i++) {
+      for(int j = 0; j < last.out_W; j++) {
+        int index = k*(last.out_H*last.out_W) + i*last.out_W + j;
+        fileout << "   " << std::fixed << std::setw(5) << std::setprecision(4) << Y[index];
+      }
+      fileout << "\n";
+    }
+  }
+  fileout.close();
+
+  for (int l = 0; l < L; l++) {
+    clReleaseMemObject(g_filters[l]);
+    clReleaseMemObject(g_U[l]);
+    if (g_bias[l])
+      clReleaseMemObject(g_bias[l]);
+  }
+  clReleaseMemObject(g_act[0]);
+  clReleaseMemObject(g_V);
+  clReleaseMemObject(g_M);
+  pool.clear();
+  /* uninitialize_ocl releases the kernels of every set and the program
+   * built last; the others are released here. */
+  for (std::map<int, KernelSet>::iterator it = sets.begin(); it != sets.end(); it++) {
+    if (it->second.program != cv.main_program)
+      clReleaseProgram(it->second.program);
+  }
+
+  uninitialize_ocl(cv);
+
+  delete[] data;
+  delete[] Y;
+  return 0;
+}
+
 int main(int argc, char *argv[])
 {
+  /* We are using r x r filters and an output tile size of m x m,
+   * alpha = m + r - 1. -m picks m, -r the filter size (3, 5 or 7, larger
+   * ones run as 3 x 3 pieces), -p the zero padding (valid, same or a
+   * width), -s the stride (1 or 2), -d the dilation, -g the number of
+   * groups (C for depthwise) and -u a filter pack made by
+   * `winograd --pack-filters`, which replaces the filter transform.
+   * -a, -B and -R set the epilogue of calc_Y as in winograd.cpp: an
+   * activation, per-channel biases and a residual in the format of an
+   * output file. -n runs a network file instead (see run_network); only
+   * -m and -t apply to it. -t half stores U, V and M in half precision
+   * (see HALF_STORAGE in winograd.cl). */
+  int m = 2;
+  int r = 3;
+  const char *pad_arg = "valid";
+  int pad = 0;
+  int stride = 1;
+  int dilation = 1;
+  int groups = 1;
+  const char *pack_filename = NULL;
+  const char *activation_arg = "none";
+  const char *bias_filename = NULL;
+  const char *residual_filename = NULL;
+  bool network = false;
+  const char *storage_arg = "full";
+  bool bad_usage = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "m:r:p:s:d:g:u:a:B:R:nt:")) != -1) {
+    switch (opt) {
+      case 'm': m = atoi(optarg); break;
+      case 'r': r = atoi(optarg); break;
+      case 'p': pad_arg = optarg; break;
+      case 's': stride = atoi(optarg); break;
+      case 'd': dilation = atoi(optarg); break;
+      case 'g': groups = atoi(optarg); break;
+      case 'u': pack_filename = optarg; break;
+      case 'a': activation_arg = optarg; break;
+      case 'B': bias_filename = optarg; break;
+      case 'R': residual_filename = optarg; break;
+      case 'n': network = true; break;
+      case 't': storage_arg = optarg; break;
+      default: bad_usage = true;
+    }
+  }
+
+  /* "same" padding depends on the dilated filter extent. */
+  int extent = dilation * (r - 1) + 1;
+  if (!parse_padding(pad_arg, extent, pad))
+    bad_usage = true;
+  Activation activation = ACTIVATION_NONE;
+  double slope = 0.01;
+  if (!parse_activation(activation_arg, activation, slope))
+    bad_usage = true;
+  Storage storage;
+  if (!parse_storage(storage_arg, storage))
+    bad_usage = true;
+
   /* Check that program arguments are properly specified. */
-  if (argc != 3) {
-    cout << "Usage: ./winograd_gpu <input filename> <output filename>\n";
-    return 0;
+  if (bad_usage || argc - optind != 2 ||
+      (network && (pack_filename || bias_filename || residual_filename ||
+                   activation != ACTIVATION_NONE))) {
+    cout << "Usage: ./winograd_gpu [-m tile size (2, 4 or 6)] [-r filter size (3, 5 or 7)] [-p valid|same|padding] [-s stride] [-d dilation] [-g groups] [-u filter pack] [-t full|half] [-a none|relu|relu6|leaky[:slope]] [-B bias file] [-R residual file] <input filename> <output filename>\n";
+    cout << "       ./winograd_gpu -n [-m tile size (2, 4 or 6)] [-t full|half] <network filename> <output filename>\n";
+    return 1;
+  }
+  if (m != 2 && m != 4 && m != 6) {
+    cout << "Output tile size must be 2, 4 or 6.\n";
+    return 1;
+  }
+  if (storage == STORAGE_INT8 || storage == STORAGE_BF16) {
+    cout << "int8 and bf16 run on winograd_openmp only.\n";
+    return 1;
+  }
+  if (network)
+    return run_network(m, storage, argv[optind], argv[optind + 1]);
+  if (r != 3 && r != 5 && r != 7) {
+    cout << "Filter size must be 3, 5 or 7.\n";
+    return 1;
+  }
+  if (stride != 1 && stride != 2) {
+    cout << "Stride must be 1 or 2.\n";
+    return 1;
+  }
+  if (dilation < 1 || (dilation > 1 && stride > 1)) {
+    cout << "Dilation must be at least 1, and 1 with stride 2.\n";
+    return 1;
+  }
+
+  FilterPack pack;
+  bool use_pack = pack_filename != NULL;
+  if (use_pack && !pack.open(pack_filename, m, r, stride)) {
+    return 1;
   }
 
   ifstream file;
-  file.open(argv[1]);
-
-  /* Parse problem size. */
-  int K, C, H, W;
-  file >> K >> C >> H >> W;
-
-  /* Check that sizes are appropriate. */
-  bool valid = true;
-  if(H % 2 != 0)
-    valid = false;
-  if( W % 2 != 0)
-    valid = false;
-  if (!valid) {
-    cout << "Please make sure that:\n";
-    cout << "H (height of image) is even \n";
-    cout << "W (width of image) is even \n";
+  file.open(argv[optind]);
+
+  /* Parse problem size. The header is "K C H W", or "K C H W N" for a
+   * batch of N images. */
+  int K, C, H, W, N = 1;
+  string header;
+  getline(file, header);
+  istringstream header_fields(header);
+  header_fields >> K >> C >> H >> W;
+  if (!(header_fields >> N))
+    N = 1;
+
+  if (groups < 1 || K % groups != 0 || C % groups != 0) {
+    cout << "The number of groups must divide both K and C.\n";
     file.close();
-    return 0;
+    return 1;
   }
+  /* Each filter spans the Cg channels of its group. */
+  int Cg = C / groups;
 
-  int out_H = H - r + 1;
-  int out_W = W - r + 1;
-  int num_h_tiles = ceil(out_H/m);
-  int num_w_tiles = ceil(out_W/m);
-  int P = num_h_tiles * num_w_tiles;
+  if (use_pack && (pack.header.K != K || pack.header.C != C || pack.header.groups != groups)) {
+    cout << "Filter pack does not match the filters, channels and groups of the input.\n";
+    file.close();
+    return 1;
+  }
+
+  /* The padding is applied virtually by data_transform. */
+  if (H + 2 * pad < extent || W + 2 * pad < extent) {
+    cout << "Padded image is smaller than the filter.\n";
+    file.close();
+    return 1;
+  }
+  int out_H = (H + 2 * pad - extent) / stride + 1;
+  int out_W = (W + 2 * pad - extent) / stride + 1;
+  /* The last row and column of tiles may be partially outside the output.
+   * With dilation each of the dilation x dilation output phases gets its
+   * own band of tiles along each axis. */
+  int num_h_tiles = dilation * (((out_H + dilation - 1) / dilation + m - 1) / m);
+  int num_w_tiles = dilation * (((out_W + dilation - 1) / dilation + m - 1) / m);
+  /* The tiles of all N images go through the same GEMMs. */
+  int P = N * num_h_tiles * num_w_tiles;
 
   /* Read in filters. */
-  float *filters = new float[K*C*r*r];
+  float *filters = new float[K*Cg*r*r];
   for (int k = 0; k < K; k++) {
-    for (int c = 0; c < C; c++) {
+    for (int c = 0; c < Cg; c++) {
       for (int i = 0; i < r; i++) {
         for (int j = 0; j < r; j++) {
-          file >> filters[k*(C*r*r) + c*(r*r) + i*r + j];
+          file >> filters[k*(Cg*r*r) + c*(r*r) + i*r + j];
         }
       }
     }
   }
 
-  /* Read in image. */
-  float *data = new float[C*H*W];
-  for (int c = 0; c < C; c++) {
+  /* Read in the images, data[n][c][i][j]. */
+  float *data = new float[N*C*H*W];
+  for (int c = 0; c < N*C; c++) {
     for (int i = 0; i < H; i++) {
       for (int j = 0; j < W; j++) {
-        file >> data[c*(H*W) + i*H + j];
+        file >> data[c*(H*W) + i*W + j];
       }
     }
   }
   file.close();
 
-  /* Filter transform matrix. */
-  float G[12] = {1.0, 0.0, 0.0,
-                 0.5, 0.5, 0.5,
-                 0.5, -0.5, 0.5,
-                 0.0, 0.0, 1.0};
-
-  /* Data transform matrix. */
-  float B[16] = {1.0, 0.0, 0.0, 0.0,
-                 0.0, 1.0, -1.0, 1.0,
-                 -1.0, 1.0, 1.0, 0.0,
-                 0.0, 0.0, 0.0, -1.0};
-
-  /* Inverse transform matrix (to transform the output after it is computed).*/
-  float A[8] = {1.0, 0.0,
-                1.0, 1.0,
-                1.0, -1.0,
-                0.0, -1.0};
-  
-  /* Array to hold the output. */
-  float *Y = new float[K*out_H*out_W];
+  /* The epilogue: one bias per filter, and a residual in the format of an
+   * output file. */
+  float *bias = NULL;
+  if (bias_filename) {
+    bias = new float[K];
+    file.open(bias_filename);
+    for (int k = 0; k < K; k++)
+      file >> bias[k];
+    file.close();
+  }
+  float *residual = NULL;
+  if (residual_filename) {
+    residual = new float[N*K*out_H*out_W];
+    file.open(residual_filename);
+    string residual_header;
+    getline(file, residual_header);
+    for (int i = 0; i < N*K*out_H*out_W; i++)
+      file >> residual[i];
+    file.close();
+  }
 
+  /* A strided convolution becomes a stride-1 one over the stride^2
+   * polyphase sub-images and sub-filters (see TileGrid in winograd.h), and
+   * filters larger than 3 x 3 are cut into 3 x 3 pieces applied to shifted
+   * images. These sub-problems enter the GEMMs as extra channels.
+   * filter_transform and data_transform gather them from the uploaded
+   * filters and images, and the kernels are built for rs x rs filters. */
+  int splits = piece_splits(r, stride);
+  int phases = stride * stride * splits * splits;
+  int rs = piece_size(r, stride);
+  int sub_C = C * phases, sub_Cg = Cg * phases;
+  int alpha = m + rs - 1;
+  /* Bytes per element of U, V and M. */
+  size_t store_size = storage == STORAGE_HALF ? sizeof(cl_half) : sizeof(float);
+
+  /* Unpack U[xi][nu][k][c] from the GEMM panels of the filter pack, as
+   * it is stored on the device. */
+  float *U = NULL;
+  half *U_half = NULL;
+  if (use_pack) {
+    U = new float[alpha*alpha*K*sub_Cg];
+    U_half = new half[alpha*alpha*K*sub_Cg];
+    for (int xi = 0; xi < alpha; xi++) {
+      for (int nu = 0; nu < alpha; nu++) {
+        for (int k = 0; k < K; k++) {
+          for (int c = 0; c < sub_Cg; c++) {
+            int index = xi*(alpha*K*sub_Cg) + nu*(K*sub_Cg) + k*sub_Cg + c;
+            U[index] = pack.at(xi, nu, k, c);
+            U_half[index] = half(U[index]);
+          }
+        }
+      }
+    }
+  }
 
-  /* OpenCL setup. */
-  std::string kernel_source_str;
-  
-  /* Provide names of the OpenCL kernels
-   * and cl file that they're kept in. */
-  std::string arraycompact_kernel_file = 
-    std::string("winograd.cl");
+  /* Array to hold the output. */
+  float *Y = new float[N*K*out_H*out_W];
 
-  std::list<std::string> kernel_names;
-  std::string filter_transform_name_str = std::string("filter_transform");
-  std::string data_transform_name_str = std::string("data_transform");
-  std::string calc_M_name_str = std::string("calc_M");
-  std::string calc_Y_name_str = std::string("calc_Y");
-
-  kernel_names.push_back(filter_transform_name_str);
-  kernel_names.push_back(data_transform_name_str);
-  kernel_names.push_back(calc_M_name_str);
-  kernel_names.push_back(calc_Y_name_str);
- 
-  std::map<std::string, cl_kernel> kernel_map;
-  readFile(arraycompact_kernel_file, kernel_source_str);
-
-  /* Intialize OpenCL runtime. */
+  /* Intialize OpenCL runtime, and compile the kernels and their
+   * transforms for the chosen tile size and piece size. */
   cl_vars_t cv;
   initialize_ocl(cv);
-
-  /* Compile kernels. */
-  compile_ocl_program(kernel_map, cv, 
-          kernel_source_str.c_str(),
-          kernel_names);
-
+  KernelSet set;
+  build_kernel_set(cv, m, rs, storage, set);
+  /* Groups of a few channels (depthwise layers) skip the reduction and
+   * multiply elementwise. */
+  bool depthwise = sub_Cg <= 4;
 
   /* Create buffers on GPU. */
-  cl_mem g_filters, g_data, g_G, g_B, g_A, g_U, g_V, g_M, g_Y;
+  cl_mem g_filters, g_data, g_U, g_V, g_M, g_Y;
+  /* NULL unless the epilogue has biases or a residual. */
+  cl_mem g_bias = NULL, g_residual = NULL;
 
   cl_int err = CL_SUCCESS;
   g_filters = clCreateBuffer(cv.context,CL_MEM_READ_WRITE,
-           sizeof(float)*K*C*3*3,NULL,&err);
+           sizeof(float)*K*Cg*r*r,NULL,&err);
   CHK_ERR(err);
   g_data = clCreateBuffer(cv.context,CL_MEM_READ_WRITE,
-           sizeof(float)*C*H*W,NULL,&err);
-  CHK_ERR(err);
-  g_G = clCreateBuffer(cv.context,CL_MEM_READ_ONLY,
-           sizeof(float)*alpha*r,NULL,&err);
-  CHK_ERR(err);
-  g_B = clCreateBuffer(cv.context,CL_MEM_READ_ONLY,
-           sizeof(float)*alpha*alpha,NULL,&err);
-  CHK_ERR(err);
-  g_A = clCreateBuffer(cv.context,CL_MEM_READ_ONLY,
-           sizeof(float)*alpha*m,NULL,&err);
+           sizeof(float)*N*C*H*W,NULL,&err);
   CHK_ERR(err);
   /* Will hold output of the filter transform. */
   g_U = clCreateBuffer(cv.context,CL_MEM_READ_WRITE,
-           sizeof(float)*K*C*alpha*alpha,NULL,&err);
+           store_size*K*sub_Cg*alpha*alpha,NULL,&err);
   CHK_ERR(err);
   /* Will hold output of the data transform. */
   g_V = clCreateBuffer(cv.context,CL_MEM_READ_WRITE,
-           sizeof(float)*C*P*alpha*alpha,NULL,&err);
+           store_size*sub_C*P*alpha*alpha,NULL,&err);
   CHK_ERR(err);
   /* Will hold the pre-transformed output. */
   g_M = clCreateBuffer(cv.context,CL_MEM_READ_WRITE,
-           sizeof(float)*K*P*alpha*alpha,NULL,&err);
+           store_size*K*P*alpha*alpha,NULL,&err);
   CHK_ERR(err);
   /* Will hold the final (transformed) output. */
   g_Y = clCreateBuffer(cv.context,CL_MEM_READ_WRITE,
-           sizeof(float)*K*out_H*out_W,NULL,&err);
+           sizeof(float)*N*K*out_H*out_W,NULL,&err);
   CHK_ERR(err);
+  if (bias) {
+    g_bias = clCreateBuffer(cv.context,CL_MEM_READ_ONLY,
+             sizeof(float)*K,NULL,&err);
+    CHK_ERR(err);
+  }
+  if (residual) {
+    g_residual = clCreateBuffer(cv.context,CL_MEM_READ_ONLY,
+             sizeof(float)*N*K*out_H*out_W,NULL,&err);
+    CHK_ERR(err);
+  }
 
   /* Copy data into buffers. */
   err = clEnqueueWriteBuffer(cv.commands, g_filters, true, 0,
-           sizeof(float)*K*C*r*r, filters, 0, NULL, NULL);
+           sizeof(float)*K*Cg*r*r, filters, 0, NULL, NULL);
   CHK_ERR(err);
+  if (use_pack) {
+    err = clEnqueueWriteBuffer(cv.commands, g_U, true, 0,
+             store_size*K*sub_Cg*alpha*alpha,
+             storage == STORAGE_HALF ? (void *) U_half : (void *) U, 0, NULL, NULL);
+    CHK_ERR(err);
+  }
   err = clEnqueueWriteBuffer(cv.commands, g_data, true, 0,
-           sizeof(float)*C*H*W, data, 0, NULL, NULL);
-  CHK_ERR(err);
-  err = clEnqueueWriteBuffer(cv.commands, g_G, true, 0,
-           sizeof(float)*alpha*r, G, 0, NULL, NULL);
-  CHK_ERR(err);
-  err = clEnqueueWriteBuffer(cv.commands, g_B, true, 0,
-           sizeof(float)*alpha*alpha, B, 0, NULL, NULL);
-  CHK_ERR(err);
-  err = clEnqueueWriteBuffer(cv.commands, g_A, true, 0,
-           sizeof(float)*alpha*m, A, 0, NULL, NULL);
-  CHK_ERR(err);
-
-  /* Compute global and local work sizes for the following: */
-
-
-  /* Filter transform, which calculates U. */
-  size_t global_work_size_U[2] = {gws(K,8), gws(C,4)};
-  size_t local_work_size_U[2] = {8, 4};
-
-  /* Data transform, which calculates V. */
-  size_t global_work_size_V[3] = {gws(C, 4), gws(num_h_tiles, 4), gws(num_w_tiles, 4)};
-  size_t local_work_size_V[3] = {4, 4, 4};
-
-  /* Calculating M. */
-  int local_M = 8;
-  size_t global_work_size_M[2] = {gws(K, local_M), gws(P, local_M)};
-  size_t local_work_size_M[2] = {local_M, local_M};
-
-  /* Calculating Y. */
-  size_t global_work_size_Y[3] = {gws(K, 2), gws(num_h_tiles, 8), gws(num_w_tiles, 8)};
-  size_t local_work_size_Y[3] = {2, 8, 8};
-
-  /* Get the compiled kernels. */
-  cl_kernel filter_transform_kern = kernel_map[filter_transform_name_str];
-  cl_kernel data_transform_kern = kernel_map[data_transform_name_str];
-  cl_kernel calc_M_kern = kernel_map[calc_M_name_str];
-  cl_kernel calc_Y_kern = kernel_map[calc_Y_name_str];
-
-  /* Set the arguments for each kernel. */
-  err = clSetKernelArg(filter_transform_kern, 0, sizeof(cl_mem), &g_filters);
-  CHK_ERR(err);
-  err = clSetKernelArg(filter_transform_kern, 1, sizeof(cl_mem), &g_G);
-  CHK_ERR(err);
-  err = clSetKernelArg(filter_transform_kern, 2, sizeof(cl_mem), &g_U);
-  CHK_ERR(err);
-  err = clSetKernelArg(filter_transform_kern, 3, sizeof(int), &K);
-  CHK_ERR(err);
-  err = clSetKernelArg(filter_transform_kern, 4, sizeof(int), &C);
-  CHK_ERR(err);
-
-  err = clSetKernelArg(data_transform_kern, 0, sizeof(cl_mem), &g_data);
-  CHK_ERR(err);
-  err = clSetKernelArg(data_transform_kern, 1, sizeof(cl_mem), &g_B);
-  CHK_ERR(err);
-  err = clSetKernelArg(data_transform_kern, 2, sizeof(cl_mem), &g_V);
-  CHK_ERR(err);
-  err = clSetKernelArg(data_transform_kern, 3, sizeof(int), &C);
-  CHK_ERR(err);
-  err = clSetKernelArg(data_transform_kern, 4, sizeof(int), &P);
-  CHK_ERR(err);
-  err = clSetKernelArg(data_transform_kern, 5, sizeof(int), &H);
-  CHK_ERR(err);
-  err = clSetKernelArg(data_transform_kern, 6, sizeof(int), &W);
-  CHK_ERR(err);
-  err = clSetKernelArg(data_transform_kern, 7, sizeof(int), &num_h_tiles);
-  CHK_ERR(err);
-  err = clSetKernelArg(data_transform_kern, 8, sizeof(int), &num_w_tiles);
-  CHK_ERR(err);
-
-  err = clSetKernelArg(calc_M_kern, 0, sizeof(cl_mem), &g_U);
-  CHK_ERR(err);
-  err = clSetKernelArg(calc_M_kern, 1, sizeof(cl_mem), &g_V);
-  CHK_ERR(err);
-  err = clSetKernelArg(calc_M_kern, 2, sizeof(cl_mem), &g_M);
-  CHK_ERR(err);
-  err = clSetKernelArg(calc_M_kern, 3, sizeof(int), &K);
-  CHK_ERR(err);
-  err = clSetKernelArg(calc_M_kern, 4, sizeof(int), &P);
-  CHK_ERR(err);
-  err = clSetKernelArg(calc_M_kern, 5, sizeof(int), &C);
-  CHK_ERR(err);
-
-  err = clSetKernelArg(calc_Y_kern, 0, sizeof(cl_mem), &g_M);
-  CHK_ERR(err);
-  err = clSetKernelArg(calc_Y_kern, 1, sizeof(cl_mem), &g_A);
-  CHK_ERR(err);
-  err = clSetKernelArg(calc_Y_kern, 2, sizeof(cl_mem), &g_Y);
-  CHK_ERR(err);
-  err = clSetKernelArg(calc_Y_kern, 3, sizeof(int), &out_H);
-  CHK_ERR(err);
-  err = clSetKernelArg(calc_Y_kern, 4, sizeof(int), &out_W);
-  CHK_ERR(err);
-  err = clSetKernelArg(calc_Y_kern, 5, sizeof(int), &K);
-  CHK_ERR(err);
-  err = clSetKernelArg(calc_Y_kern, 6, sizeof(int), &P);
-  CHK_ERR(err);
-  err = clSetKernelArg(calc_Y_kern, 7, sizeof(int), &num_h_tiles);
-  CHK_ERR(err);
-  err = clSetKernelArg(calc_Y_kern, 8, sizeof(int), &num_w_tiles);
+           sizeof(float)*N*C*H*W, data, 0, NULL, NULL);
   CHK_ERR(err);
+  if (bias) {
+    err = clEnqueueWriteBuffer(cv.commands, g_bias, true, 0,
+             sizeof(float)*K, bias, 0, NULL, NULL);
+    CHK_ERR(err);
+  }
+  if (residual) {
+    err = clEnqueueWriteBuffer(cv.commands, g_residual, true, 0,
+             sizeof(float)*N*K*out_H*out_W, residual, 0, NULL, NULL);
+    CHK_ERR(err);
+  }
 
   /* Start recording time for benchmarking. */
   double time = timestamp();
 
-  /* Compute filter transform. */
-  err = clEnqueueNDRangeKernel(cv.commands,
-         filter_transform_kern,
-         2,//work_dim,
-         NULL, //global_work_offset
-         global_work_size_U, //global_work_size
-         local_work_size_U, //local_work_size
-         0, //num_events_in_wait_list
-         NULL, //event_wait_list
-         NULL //
-         );
-  CHK_ERR(err);
+  /* Compute filter transform, unless U came from a filter pack. */
+  if (!use_pack)
+    enqueue_filter_transform(cv, set.kernels["filter_transform"], g_filters, g_U, K, Cg, r,
+                             stride, splits);
 
   /* Compute data transform. */
-  err = clEnqueueNDRangeKernel(cv.commands,
-         data_transform_kern,
-         3,//work_dim,
-         NULL, //global_work_offset
-         global_work_size_V, //global_work_size
-         local_work_size_V, //local_work_size
-         0, //num_events_in_wait_list
-         NULL, //event_wait_list
-         NULL //
-         );
-  CHK_ERR(err);
+  enqueue_data_transform(cv, set.kernels["data_transform"], g_data, g_V, C, P, H, W,
+                         num_h_tiles, num_w_tiles, pad, dilation, stride, splits);
 
   /* Compute the pre-transformed output. */
-  err = clEnqueueNDRangeKernel(cv.commands,
-         calc_M_kern,
-         2,//work_dim,
-         NULL, //global_work_offset
-         global_work_size_M, //global_work_size
-         local_work_size_M, //local_work_size
-         0, //num_events_in_wait_list
-         NULL, //event_wait_list
-         NULL //
-         );
-  CHK_ERR(err);
+  enqueue_calc_M(cv, set.kernels[depthwise ? "calc_M_depthwise" : "calc_M"], depthwise, g_U,
+                 g_V, g_M, K, P, sub_C, groups, alpha);
 
   /* Transform the output. */
-  err = clEnqueueNDRangeKernel(cv.commands,
-         calc_Y_kern,
-         3,//work_dim,
-         NULL, //global_work_offset
-         global_work_size_Y, //global_work_size
-         local_work_size_Y, //local_work_size
-         0, //num_events_in_wait_list
-         NULL, //event_wait_list
-         NULL //
-         );
-  CHK_ERR(err);
+  enqueue_calc_Y(cv, set.kernels["calc_Y"], g_M, g_Y, out_H, out_W, K, P, num_h_tiles,
+                 num_w_tiles, dilation, g_bias, g_residual, activation, slope);
 
   err = clFinish(cv.commands);
   CHK_ERR(err);
@@ -358,17 +840,20 @@ int main(int argc, char *argv[])
   time = timestamp() - time;
 
   /* Report timing and Mflop/s */
-  report_winograd_statistics(K, C, P, time);
+  report_winograd_statistics(set.transforms, m, rs, K, sub_C, groups, P, use_pack, time);
 
-  err = clEnqueueReadBuffer(cv.commands, g_Y, true, 0, sizeof(float)*K*out_H*out_W,
+  err = clEnqueueReadBuffer(cv.commands, g_Y, true, 0, sizeof(float)*N*K*out_H*out_W,
            Y, 0, NULL, NULL);
   CHK_ERR(err);
 
   /* Write output Y to the specified file. */
   ofstream fileout;
-  fileout.open(argv[2], ofstream::out | ofstream::trunc);
-  fileout << K << " " << C << " " << H << " " << W << endl;
-  for(int k = 0; k < K; k++) {
+  fileout.open(argv[optind + 1], ofstream::out | ofstream::trunc);
+  fileout << K << " " << C << " " << H << " " << W;
+  if (N > 1)
+    fileout << " " << N;
+  fileout << endl;
+  for(int k = 0; k < N*K; k++) {
     fileout << "\n";
     for(int i = 0; i < out_H; i++) {
       for(int j = 0; j < out_W; j++) {
@@ -382,19 +867,24 @@ int main(int argc, char *argv[])
 
   clReleaseMemObject(g_filters); 
   clReleaseMemObject(g_data);
-  clReleaseMemObject(g_G);
-  clReleaseMemObject(g_B);
-  clReleaseMemObject(g_A);
   clReleaseMemObject(g_U);
   clReleaseMemObject(g_V);
   clReleaseMemObject(g_M);
   clReleaseMemObject(g_Y);
+  if (bias)
+    clReleaseMemObject(g_bias);
+  if (residual)
+    clReleaseMemObject(g_residual);
 
   uninitialize_ocl(cv);
 
   delete[] filters;
+  delete[] U;
+  delete[] U_half;
   delete[] data;
   delete[] Y;
+  delete[] bias;
+  delete[] residual;
 
   return 0;
 }
@@ -18,14 +18,15 @@
 #include <math.h>
 #include <sys/time.h>
 #include "clhelp_version2.h"
+#include "winograd.h"
 
 using namespace std;
 
 /* We are using 3 x 3 filters and an output tile size of 2 x 2. 
- * alpha = m + r - 1 = 4 */
-#define m 2
-#define r 3
-#define alpha 4
+ * alpha = m + r - 1 = 4, which is also winograd.cl's default. */
+const int m = 2;
+const int r = 3;
+const int alpha = m + r - 1;
 
 /* Returns the next number greater than or equal to global_size that is a 
  * multiple of local_size.*/
@@ -61,24 +62,11 @@ int main(int argc, char *argv[]) {
   int K, C, H, W;
   file >> K >> C >> H >> W;
 
-  /* Check that sizes are appropriate. */
-  bool valid = true;
-  if(H % 2 != 0)
-    valid = false;
-  if( W % 2 != 0)
-    valid = false;
-  if (!valid) {
-    cout << "Please make sure that:\n";
-    cout << "H (height of image) is even \n";
-    cout << "W (width of image) is even \n";
-    file.close();
-    return 0;
-  }
-
   int out_H = H - r + 1;
   int out_W = W - r + 1;
-  int num_h_tiles = ceil(out_H/m);
-  int num_w_tiles = ceil(out_W/m);
+  /* The last row and column of tiles may be partially outside the output. */
+  int num_h_tiles = (out_H + m - 1) / m;
+  int num_w_tiles = (out_W + m - 1) / m;
   int P = num_h_tiles * num_w_tiles;
 
   /* Read in filters. */
@@ -98,30 +86,12 @@ int main(int argc, char *argv[]) {
   for (int c = 0; c < C; c++) {
     for (int i = 0; i < H; i++) {
       for (int j = 0; j < W; j++) {
-        file >> data[c*(H*W) + i*H + j];
+        file >> data[c*(H*W) + i*W + j];
       }
     }
   }
   file.close();
 
-  /* Filter transform matrix. */
-  float G[12] = {1.0, 0.0, 0.0,
-                 0.5, 0.5, 0.5,
-                 0.5, -0.5, 0.5,
-                 0.0, 0.0, 1.0};
-
-  /* Data transform matrix. */
-  float B[16] = {1.0, 0.0, 0.0, 0.0,
-                 0.0, 1.0, -1.0, 1.0,
-                 -1.0, 1.0, 1.0, 0.0,
-                 0.0, 0.0, 0.0, -1.0};
-
-  /* Inverse transform matrix (to transform the output after it is computed).*/
-  float A[8] = {1.0, 0.0,
-                1.0, 1.0,
-                1.0, -1.0,
-                0.0, -1.0};
-  
   /* Array to hold the output. */
   float *Y = new float[K*out_H*out_W];
 
@@ -144,6 +114,12 @@ int main(int argc, char *argv[]) {
   std::string kernel_source_str;
   std::map<std::string, cl::Kernel> kernel_map;
   readFile(arraycompact_kernel_file, kernel_source_str);
+  /* The kernels run the transforms generated for F(2x2, 3x3) in
+   * winograd.h, which go in front of them. */
+  typedef TransformPrograms<m, r> Programs;
+  kernel_source_str = Programs::G.opencl_source("transform_G") +
+                      Programs::BT.opencl_source("transform_BT") +
+                      Programs::AT.opencl_source("transform_AT") + kernel_source_str;
 
   /* Intialize OpenCL runtime. */
   cl_vars_t cv;
@@ -153,12 +129,9 @@ int main(int argc, char *argv[]) {
   compile_ocl_program(kernel_map, cv, kernel_source_str, kernel_names);
     
   // /* Create buffers on GPU. */
-  // cl_mem g_filters, g_data, g_G, g_B, g_A, g_U, g_V, g_M, g_Y;
+  // cl_mem g_filters, g_data, g_U, g_V, g_M, g_Y;
   cl::Buffer g_filters(cv.context, CL_MEM_READ_WRITE, sizeof(float)*K*C*3*3);
   cl::Buffer g_data(cv.context, CL_MEM_READ_WRITE, sizeof(float)*C*H*W);
-  cl::Buffer g_G(cv.context, CL_MEM_READ_ONLY, sizeof(float)*alpha*r);
-  cl::Buffer g_B(cv.context, CL_MEM_READ_ONLY, sizeof(float)*alpha*alpha);
-  cl::Buffer g_A(cv.context, CL_MEM_READ_ONLY, sizeof(float)*alpha*m,NULL);
   
   // /* Will hold output of the filter transform. */
   cl::Buffer g_U(cv.context, CL_MEM_READ_WRITE, sizeof(float)*K*C*alpha*alpha);
@@ -172,9 +145,6 @@ int main(int argc, char *argv[]) {
   // /* Copy data into buffers. */
   cv.command.enqueueWriteBuffer(g_filters, CL_TRUE, 0, sizeof(float)*K*C*r*r, filters);
   cv.command.enqueueWriteBuffer(g_data, CL_TRUE, 0, sizeof(float)*C*H*W, data);
-  cv.command.enqueueWriteBuffer(g_G, CL_TRUE, 0, sizeof(float)*alpha*r, G);
-  cv.command.enqueueWriteBuffer(g_B, CL_TRUE, 0, sizeof(float)*alpha*alpha, B);
-  cv.command.enqueueWriteBuffer(g_A, CL_TRUE, 0, sizeof(float)*alpha*m, A);
 
   /* Compute global and local work sizes for the following: */
 
@@ -203,20 +173,29 @@ int main(int argc, char *argv[]) {
 
   // /* Set the arguments for each kernel. */
   filter_transform_kern.setArg(0, g_filters);
-  filter_transform_kern.setArg(1, g_G);
-  filter_transform_kern.setArg(2, g_U);
-  filter_transform_kern.setArg(3, K);
-  filter_transform_kern.setArg(4, C);
+  filter_transform_kern.setArg(1, g_U);
+  filter_transform_kern.setArg(2, K);
+  filter_transform_kern.setArg(3, C);
+  /* 3 x 3 filters at stride 1: each channel is its own sub-filter. */
+  filter_transform_kern.setArg(4, 3);
+  filter_transform_kern.setArg(5, 1);
+  filter_transform_kern.setArg(6, 1);
 
   data_transform_kern.setArg(0, g_data);
-  data_transform_kern.setArg(1, g_B);
-  data_transform_kern.setArg(2, g_V);
-  data_transform_kern.setArg(3, C);
-  data_transform_kern.setArg(4, P);
-  data_transform_kern.setArg(5, H);
-  data_transform_kern.setArg(6, W);
-  data_transform_kern.setArg(7, num_h_tiles);
-  data_transform_kern.setArg(8, num_w_tiles);
+  data_transform_kern.setArg(1, g_V);
+  data_transform_kern.setArg(2, C);
+  data_transform_kern.setArg(3, P);
+  data_transform_kern.setArg(4, H);
+  data_transform_kern.setArg(5, W);
+  data_transform_kern.setArg(6, num_h_tiles);
+  data_transform_kern.setArg(7, num_w_tiles);
+  /* no padding, dilation or stride: this version computes plain valid
+   * convolutions only. */
+  data_transform_kern.setArg(8, 0);
+  data_transform_kern.setArg(9, 0);
+  data_transform_kern.setArg(10, 1);
+  data_transform_kern.setArg(11, 1);
+  data_transform_kern.setArg(12, 1);
 
   calc_M_kern.setArg(0, g_U);
   calc_M_kern.setArg(1, g_V);
@@ -224,16 +203,22 @@ int main(int argc, char *argv[]) {
   calc_M_kern.setArg(3, K);
   calc_M_kern.setArg(4, P);
   calc_M_kern.setArg(5, C);
+  calc_M_kern.setArg(6, 1);
 
   calc_Y_kern.setArg(0, g_M);
-  calc_Y_kern.setArg(1, g_A);
-  calc_Y_kern.setArg(2, g_Y);
-  calc_Y_kern.setArg(3, out_H);
-  calc_Y_kern.setArg(4, out_W);
-  calc_Y_kern.setArg(5, K);
-  calc_Y_kern.setArg(6, P);
-  calc_Y_kern.setArg(7, num_h_tiles);
-  calc_Y_kern.setArg(8, num_w_tiles);
+  calc_Y_kern.setArg(1, g_Y);
+  calc_Y_kern.setArg(2, out_H);
+  calc_Y_kern.setArg(3, out_W);
+  calc_Y_kern.setArg(4, K);
+  calc_Y_kern.setArg(5, P);
+  calc_Y_kern.setArg(6, num_h_tiles);
+  calc_Y_kern.setArg(7, num_w_tiles);
+  calc_Y_kern.setArg(8, 1);
+  /* no epilogue: NULL bias and residual buffers, no activation. */
+  calc_Y_kern.setArg(9, sizeof(cl_mem), NULL);
+  calc_Y_kern.setArg(10, sizeof(cl_mem), NULL);
+  calc_Y_kern.setArg(11, (int) ACTIVATION_NONE);
+  calc_Y_kern.setArg(12, 0.0f);
 
   /* Start recording time for benchmarking. */
   double time = timestamp();
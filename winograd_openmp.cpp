@@ -1,8 +1,16 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <string>
 #include <armadillo>
 #include <math.h>
 #include <sys/time.h>
+#include <unistd.h>
+#include "filter_pack.h"
+#include "gemm.h"
+#include "network.h"
+#include "tensor.h"
+#include "winograd.h"
 
 using namespace std;
 using namespace arma;
@@ -10,143 +18,744 @@ using namespace arma;
 // OpenMP version of winograd convolution. See comments in winograd.cpp.
 
 double timestamp();
-void report_winograd_statistics(int K, int C, int P, double time);
+template <int m, int r>
+void report_winograd_statistics(int K, int C, int groups, int P, bool kept_U, double time);
+template <int m, int r>
+void report_backward_filter_statistics(int K, int C, int groups, int P, bool kept_V, double time);
+template <typename Real>
+void report_accuracy(const Cube<Real>& result, const Cube<double>& reference);
 
-mat** create_fourd_array(int d1, int d2, int d3, int d4) {
-  mat** array = new mat*[d1]();
-  for (int i = 0; i < d1; i++) {
-    array[i] = new mat[d2]();
-    for (int j = 0; j < d2; j++) {
-      array[i][j] = mat(d3, d4);
+// The passes of winograd.cpp.
+enum Pass { FORWARD, BACKWARD_DATA, BACKWARD_FILTER };
+
+// U[xi][nu](k, c * phases + phase) for all (xi, nu) and polyphase phases,
+// written straight into the packed panels of Gemm, in the working precision
+// Real, half or bfloat16.
+template <int m, int r, int stride, typename Gemm, typename Real>
+void filter_transform(Cube<Real>* filters, int groups, int K, int k, int c,
+                      Tensor<typename Gemm::factor_type>& U) {
+  typedef typename Gemm::factor_type T;
+  typedef Polyphase<r, stride> Split;
+  typedef WinogradConv<m, Split::rs, Real> Conv;
+  const int alpha = Conv::alpha;
+  Real sub[Split::rs * Split::rs];
+  Real u[alpha * alpha];
+  for (int phase = 0; phase < Split::phases; phase++) {
+    polyphase_filter(filters[k].slice_memptr(c), 1, r, r, stride, phase, sub);
+    // flop: K * C * Conv::P::filter_flops()
+    Conv::filter_transform(sub, Split::rs, 1, u);
+    for (int xi = 0; xi < alpha; xi++) {
+      for (int nu = 0; nu < alpha; nu++) {
+        int cp = c * Split::phases + phase;
+        Gemm::packed(U, xi, nu, K / groups, k, cp) = T(u[xi * alpha + nu]);
+      }
     }
   }
-  return array;
 }
 
-void free_fourd_array(mat** array, int d1) {
-  for (int i = 0; i < d1; i++) {
-    delete[] array[i];
+// U of the transposed convolution (see transform_filters_transposed in
+// winograd.cpp) for filter k and its channel c, for all output phases and
+// pieces.
+template <int m, int r, int stride, typename Real>
+void filter_transform_transposed(Cube<Real>* filters, int groups, int K, int C, int k, int c,
+                                 Tensor<Real>& U) {
+  typedef Polyphase<polyphase_size(r, stride), 1> Split;
+  typedef WinogradConv<m, Split::rs, Real> Conv;
+  const int alpha = Conv::alpha;
+  const int up2 = stride * stride;
+  Real sub[Split::rs * Split::rs];
+  Real u[alpha * alpha];
+  int Kg = K / groups, Cg = C / groups;
+  for (int q = 0; q < up2; q++) {
+    for (int phase = 0; phase < Split::phases; phase++) {
+      transposed_filter(filters[k].slice_memptr(c), 1, r, r, stride, q, phase, sub);
+      // flop: C * K * Conv::P::filter_flops()
+      Conv::filter_transform(sub, Split::rs, 1, u);
+      int kt = (k / Kg * Cg + c) * up2 + q;
+      int ct = k % Kg * Split::phases + phase;
+      for (int xi = 0; xi < alpha; xi++) {
+        for (int nu = 0; nu < alpha; nu++) {
+          BatchedGemm<Real>::packed(U, xi, nu, Cg * up2, kt, ct) = u[xi * alpha + nu];
+        }
+      }
+    }
   }
-  delete[] array;
 }
 
-void convolute(int K, int C, int H, int W, cube* filters, cube& image, cube& result) {
-  int m = 2;
-  int r = 3;
-  int alpha = m + r - 1;
-  int out_H = H - r + 1;
-  int out_W = W - r + 1;
-  int num_h_tiles = ceil(out_H/m);
-  int num_w_tiles = ceil(out_W/m);
-  int P = num_h_tiles * num_w_tiles;
-  mat G = { {1.0, 0.0, 0.0},
-            {0.5, 0.5, 0.5},
-            {0.5, -0.5, 0.5},
-            {0.0, 0.0, 1.0} };
-  mat B = { {1, 0, 0, 0},
-            {0, 1, -1, 1},
-            {-1, 1, 1, 0},
-            {0, 0, 0, -1} };
-  mat A = { {1, 0},
-            {1, 1},
-            {1, -1},
-            {0, -1}};
-
-  auto gen_b = [num_h_tiles, num_w_tiles](int y, int x) -> int {
-    return y * num_w_tiles + x;
-  };
+// The quantised filters of the int8 path through the filter transform of
+// F(2 x 2, rs x rs) with G scaled by 2, which is exact in integers:
+// 4 G g G^T, written into the channel-pair panels of QuantizedGemm.
+template <int r, int stride, typename Real>
+void filter_transform_quantized(Cube<Real>* filters, int groups, int K, int k, int c,
+                                Tensor<int16_t>& U) {
+  typedef Polyphase<r, stride> Split;
+  typedef WinogradConv<2, Split::rs, Real> Conv;
+  const int alpha = Conv::alpha;
+  Real sub[Split::rs * Split::rs];
+  Real u[alpha * alpha];
+  for (int phase = 0; phase < Split::phases; phase++) {
+    polyphase_filter(filters[k].slice_memptr(c), 1, r, r, stride, phase, sub);
+    // flop: K * C * Conv::P::filter_flops()
+    Conv::filter_transform(sub, Split::rs, 1, u);
+    for (int xi = 0; xi < alpha; xi++) {
+      for (int nu = 0; nu < alpha; nu++) {
+        int cp = c * Split::phases + phase;
+        QuantizedGemm::packed(U, xi, nu, K / groups, k, cp) =
+            (int16_t) lrint(4 * u[xi * alpha + nu]);
+      }
+    }
+  }
+}
 
-  // factoring out malloc'ing before measuring runtime
-  mat **U = create_fourd_array(alpha, alpha, K, C);
-  mat **V = create_fourd_array(alpha, alpha, C, P);
-  mat**M = new mat*[alpha]();
-  for (int xi = 0; xi < alpha; xi++) {
-    M[xi] = new mat[alpha];
+// Symmetric int8 quantisation: x ~ scale * q, q = round(x / scale) in
+// [-127, 127], with scale = max |x| / 127 over the n values (1 if all are 0).
+template <typename Real>
+double int8_scale(const Real* x, long n) {
+  double largest = 0;
+  for (long i = 0; i < n; i++) {
+    largest = max(largest, fabs((double) x[i]));
   }
-  int num_threads = omp_get_max_threads();
+  return largest > 0 ? largest / 127 : 1;
+}
+
+int8_t quantize_int8(double x, double scale) {
+  return (int8_t) max(-127.0, min(127.0, nearbyint(x / scale)));
+}
 
-  // we keep an array of m_hold values since otherwise this value would
-  // get overwritten by each different thread.
-  mat* m_hold = new mat[num_threads]();
-  for (int i = 0; i < num_threads; i++) {
-    m_hold[i] = zeros<mat>(alpha, alpha);
+// The image quantised into D, in the column-major layout of the cube (so
+// it is viewed as in convolute), and its scale, with the threads of the
+// pipeline: it is part of the timed forward pass.
+template <typename Real>
+double quantize_image(const Cube<Real>& image, int8_t* D) {
+  const Real* x = image.memptr();
+  long n = image.n_elem;
+  double largest = 0;
+  #pragma omp parallel for reduction(max : largest)
+  for (long i = 0; i < n; i++) {
+    largest = max(largest, fabs((double) x[i]));
   }
+  double scale = largest > 0 ? largest / 127 : 1;
+  #pragma omp parallel for
+  for (long i = 0; i < n; i++) {
+    D[i] = quantize_int8(x[i], scale);
+  }
+  return scale;
+}
 
-  double time = timestamp();
-  omp_set_num_threads(num_threads);
+// The F(m x m, rs x rs) pipeline over the tiles of grid, as run_pipeline in
+// winograd.cpp, in one parallel region. transform(k, c) writes the part of
+// U that comes from channel c of filter k, for k < num_filters and c <
+// filter_channels; pass num_filters = 0 when U is already there. The output
+// transform applies the epilogue. Unfused, keep_V receives V for the
+// backward-filter pass. Gemm multiplies U by V into M: BatchedGemm<T> for U,
+// V and M stored in the working precision Real of Y or as half (the GEMMs
+// then sum in float), Bf16Gemm for U and V in bfloat16 and M in float, or
+// QuantizedGemm for the int8 path, whose images D are int8 as well.
+template <int m, int rs, typename Gemm, typename TD, typename Real, typename FilterTransform>
+void run_pipeline(const TileGrid& grid, int K, int C, int groups,
+                  const Tensor<typename Gemm::factor_type>& U, const Tensor<TD>& D,
+                  Tensor<Real>& Y, bool fused, int num_filters, int filter_channels,
+                  FilterTransform transform, const Epilogue<Real>& epilogue,
+                  Tensor<typename Gemm::factor_type>* keep_V = NULL) {
+  typedef WinogradConv<m, rs, Real> Conv;
+  typedef typename Gemm::factor_type T;
+  typedef typename Gemm::product_type TM;
+  const int alpha = Conv::alpha;
+  int P = grid.P;
+  int phases = grid.phases();
+  int CP = C * phases;
+  int Kg = K / groups;
+
+  // in fused mode every thread allocates its own block of V and M instead.
+  Tensor<T> V_own(alpha, alpha, CP, fused || keep_V ? 0 : P);
+  Tensor<T>& V = keep_V ? *keep_V : V_own;
+  Tensor<TM> M(alpha, alpha, K, fused ? 0 : P);
+
+  // work split for the unfused phases: V by (channel and polyphase phase,
+  // block of tiles), M by
+  // (xi, nu, block of rows of a group of K, block of tiles), the output by
+  // (k, block of tiles). Blocks are whole SIMD lane groups and whole GEMM panels, so
+  // there are enough independent pieces to occupy far more than alpha^2
+  // threads even when K and C are small.
+  const int tile_block = 4 * Conv::lanes;
+  const int k_block = 8 * Gemm::MR;
+  const int p_block = 16 * Gemm::NR;
+  int num_tile_blocks = (P + tile_block - 1) / tile_block;
+  int group_k_blocks = (Kg + k_block - 1) / k_block;
+  int num_k_blocks = groups * group_k_blocks;
+  int num_p_blocks = (P + p_block - 1) / p_block;
+  int block = min(P, fused_block_size(alpha * alpha, K, CP, sizeof(TM)));
+  int num_blocks = (P + block - 1) / block;
+
+  // one parallel region for the whole convolution; the threads only meet at
+  // the barriers between phases that depend on each other. The per-tile
+  // scratch arrays are declared inside the loops, so each thread works on
+  // its own copy.
   #pragma omp parallel
   {
-    #pragma omp for collapse(2) 
-    for (int k = 0; k < K; k++) {
-      for (int c = 0; c < C; c++) {
-        // flop: K * C * (4 * 3 * 5) * 2 
-        mat u = G * filters[k].slice(c) * G.t();
+    // the input transform does not read U, so in unfused mode threads go
+    // straight on to V without waiting for the filter transform to finish.
+    #pragma omp for collapse(2) nowait
+    for (int k = 0; k < num_filters; k++) {
+      for (int c = 0; c < filter_channels; c++) {
+        transform(k, c);
+      }
+    }
+
+    if (fused) {
+      // every block multiplies by all of U.
+      #pragma omp barrier
+      // each thread pushes whole blocks of tiles through the pipeline, with
+      // its block of V and M staying in its own L2.
+      Tensor<T> V_block(alpha, alpha, CP, block);
+      Tensor<TM> M_block(alpha, alpha, K, block);
+      #pragma omp for schedule(dynamic)
+      for (int i = 0; i < num_blocks; i++) {
+        int b0 = i * block;
+        int nb = min(block, P - b0);
+        Tensor<T> Vb(V_block.data, alpha, alpha, CP, nb,
+                     V_block.stride[0], V_block.stride[1], nb, 1);
+        Tensor<TM> Mb(M_block.data, alpha, alpha, K, nb,
+                      M_block.stride[0], M_block.stride[1], nb, 1);
+        for (int c = 0; c < C; c++) {
+          for (int phase = 0; phase < phases; phase++) {
+            Conv::input_tiles(D, c, phase, grid, b0, nb, Vb, 0);
+          }
+        }
         for (int xi = 0; xi < alpha; xi++) {
           for (int nu = 0; nu < alpha; nu++) {
-            U[xi][nu](k, c) = u(xi, nu);
+            Gemm::multiply_grouped(U, Vb, Mb, xi, nu, groups);
           }
         }
+        for (int k = 0; k < K; k++) {
+          Conv::output_tiles(Mb, k, 0, grid, b0, nb, Y, epilogue);
+        }
       }
-    }
-  }
-
-  // since we're considering 3x3, optimizing omp for inner loop
-  for (int c = 0; c < C; c++) {
-    mat channel = image.slice(c);
-    #pragma omp parallel
-    {
+    } else {
       #pragma omp for collapse(2)
-      for (int y = 0; y < num_h_tiles; y++) {
-        for (int x = 0; x < num_w_tiles; x++) {
-          mat d = channel(span(y * m, y * m + alpha - 1), span(x * m, x * m + alpha - 1));
-          // flop: C * P * (4 * 4 * 7) * 2
-          mat v = B.t() * d * B;
-          int b = gen_b(y, x);
-          for (int xi = 0; xi < alpha; xi++) {
-            for (int nu = 0; nu < alpha; nu++) {
-              V[xi][nu](c, b) = v(xi, nu);
+      for (int cp = 0; cp < CP; cp++) {
+        for (int i = 0; i < num_tile_blocks; i++) {
+          int b = i * tile_block;
+          Conv::input_tiles(D, cp / phases, cp % phases, grid, b, min(tile_block, P - b), V, b);
+        }
+      }
+      // the barrier above also covers the nowait filter transform.
+
+      #pragma omp for collapse(4)
+      for (int xi = 0; xi < alpha; xi++) {
+        for (int nu = 0; nu < alpha; nu++) {
+          for (int kb = 0; kb < num_k_blocks; kb++) {
+            for (int pb = 0; pb < num_p_blocks; pb++) {
+              int g = kb / group_k_blocks;
+              int k0 = kb % group_k_blocks * k_block, j0 = pb * p_block;
+              // flop: alpha * alpha * K * P * (2C / groups - 1)
+              Gemm::multiply_group_block(U, V, M, xi, nu, groups, g, k0, min(k_block, Kg - k0),
+                                         j0, min(p_block, P - j0));
             }
           }
         }
       }
+
+      #pragma omp for collapse(2)
+      for (int k = 0; k < K; k++) {
+        for (int i = 0; i < num_tile_blocks; i++) {
+          int b = i * tile_block;
+          Conv::output_tiles(M, k, b, grid, b, min(tile_block, P - b), Y, epilogue);
+        }
+      }
+    }
+  }
+}
+
+// With a filter pack, packed_U is U in place in the mapped file (see
+// FilterPack::tensor, taken over here) and the filter transform phase is
+// skipped. Strided, dilated and grouped convolutions run as in
+// winograd.cpp, and so does the epilogue. keep_V, if given, receives V.
+// Gemm picks how U, V and M are stored: BatchedGemm<Real>,
+// BatchedGemm<half> or Bf16Gemm.
+template <int m, int r, int stride, typename Gemm, typename Real>
+void convolute(int N, int K, int C, int H, int W, int pad, int dilation, int groups,
+               Cube<Real>* filters, Cube<Real>& image, Cube<Real>& result, bool fused,
+               Tensor<typename Gemm::factor_type>* packed_U, const Epilogue<Real>& epilogue,
+               Tensor<typename Gemm::factor_type>* keep_V = NULL) {
+  typedef typename Gemm::factor_type T;
+  typedef Polyphase<r, stride> Split;
+  const int alpha = m + Split::rs - 1;
+  TileGrid grid(m, r, H, W, N, pad, pad, stride, dilation);
+  int CP = C * Split::phases;
+  int Kg = K / groups;
+
+  // factoring out malloc'ing of U before measuring runtime.
+  Tensor<T>* U = packed_U ? packed_U
+                          : new Tensor<T>(alpha, alpha, groups * Gemm::panels(Kg),
+                                          Gemm::panel_width(CP / groups));
+  // with a pack, the filter transform loop has nothing to do.
+  int num_filter_transforms = packed_U ? 0 : K;
+  Tensor<Real> D(image.memptr(), N, C, H, W, (long) C * H * W, (long) H * W, 1, H);
+  Tensor<Real> Y(result.memptr(), N, K, grid.out_H, grid.out_W,
+                 (long) K * grid.out_H * grid.out_W, (long) grid.out_H * grid.out_W,
+                 1, grid.out_H);
+  int num_threads = omp_get_max_threads();
+
+  double time = timestamp();
+  omp_set_num_threads(num_threads);
+  run_pipeline<m, Split::rs, Gemm>(grid, K, C, groups, *U, D, Y, fused, num_filter_transforms,
+                                   C / groups, [&](int k, int c) {
+    filter_transform<m, r, stride, Gemm>(filters, groups, K, k, c, *U);
+  }, epilogue, keep_V);
+
+  time = timestamp() - time;
+  report_winograd_statistics<m, Split::rs>(K, CP, groups, grid.P, packed_U != NULL, time);
+  delete U;
+}
+
+// The forward pass in int8 (-t int8), always with F(2 x 2, 3 x 3), whose
+// transforms only hold 0 and +-1 once G is scaled by 2, and so do those of
+// F(2 x 2, 2 x 2) of the polyphase parts. The images are quantised with one
+// scale for the batch and every filter with its own. V (at most 4 * 127 in
+// magnitude) and U (9 * 127) then hold exact integers in int16, and
+// QuantizedGemm sums M exactly in int32, for up to 3698 channels (C /
+// groups times the polyphase phases) in the worst case. The input tiles
+// are gathered and transformed in int16 (see WinogradConv::input_tiles);
+// the output transform stays in Real, since A^T M A sums up to nine
+// elements of M, which int32 does not hold near that bound. The output
+// transform requantises M to real values, multiplying channel k by
+// image_scale * filter_scale[k] / 4 (the 4 undoes the scaling of G) before
+// the rest of the epilogue.
+template <int r, int stride, typename Real>
+void convolute_quantized(int N, int K, int C, int H, int W, int pad, int dilation, int groups,
+                         Cube<Real>* filters, Cube<Real>& image, Cube<Real>& result, bool fused,
+                         const Epilogue<Real>& epilogue) {
+  typedef Polyphase<r, stride> Split;
+  typedef QuantizedGemm Gemm;
+  const int m = 2;
+  const int alpha = m + Split::rs - 1;
+  TileGrid grid(m, r, H, W, N, pad, pad, stride, dilation);
+  int CP = C * Split::phases;
+  int Kg = K / groups, Cg = C / groups;
+
+  Tensor<int8_t> quantized_image(1, 1, 1, image.n_elem);
+  Tensor<int8_t> D(quantized_image.data, N, C, H, W, (long) C * H * W, (long) H * W, 1, H);
+  Cube<Real>* quantized = new Cube<Real>[K]();
+  for (int k = 0; k < K; k++) {
+    quantized[k] = Cube<Real>(r, r, Cg);
+  }
+  vector<double> scale(K);
+  Tensor<int16_t>* U = new Tensor<int16_t>(alpha, alpha, groups * Gemm::panels(Kg),
+                                           Gemm::panel_width(CP / groups));
+  Tensor<Real> Y(result.memptr(), N, K, grid.out_H, grid.out_W,
+                 (long) K * grid.out_H * grid.out_W, (long) grid.out_H * grid.out_W,
+                 1, grid.out_H);
+
+  // quantising the image and the filters is timed, as the float path
+  // reads its image and transforms its filters inside the timed region.
+  double time = timestamp();
+  double image_scale = quantize_image(image, D.data);
+  #pragma omp parallel for
+  for (int k = 0; k < K; k++) {
+    double filter_scale = int8_scale(filters[k].memptr(), filters[k].n_elem);
+    for (uword i = 0; i < quantized[k].n_elem; i++) {
+      quantized[k].memptr()[i] = quantize_int8(filters[k].memptr()[i], filter_scale);
     }
+    scale[k] = image_scale * filter_scale / 4;
   }
+  Epilogue<Real> requantize = epilogue;
+  requantize.scale = scale.data();
+
+  run_pipeline<m, Split::rs, Gemm>(grid, K, C, groups, *U, D, Y, fused, K, Cg,
+                                   [&](int k, int c) {
+    filter_transform_quantized<r, stride>(quantized, groups, K, k, c, *U);
+  }, requantize);
+
+  time = timestamp() - time;
+  report_winograd_statistics<m, Split::rs>(K, CP, groups, grid.P, false, time);
+  delete U;
+  delete[] quantized;
+}
+
+// The backward-data pass (transposed convolution) of winograd.cpp: the N x K
+// channels of image go to the N x C channels of result.
+template <int m, int r, int stride, typename Real>
+void convolute_backward_data(int N, int K, int C, int H, int W, int pad, int dilation,
+                             int groups, Cube<Real>* filters, Cube<Real>& image,
+                             Cube<Real>& result, bool fused, const Epilogue<Real>& epilogue) {
+  typedef Polyphase<polyphase_size(r, stride), 1> Split;
+  typedef BatchedGemm<Real> Gemm;
+  const int alpha = m + Split::rs - 1;
+  int out_H = result.n_rows, out_W = result.n_cols;
+  TileGrid grid = TileGrid::transposed(m, r, H, W, N, pad, stride, dilation, out_H, out_W);
+  int KP = K * Split::phases;
+  int CQ = C * stride * stride;
+
+  Tensor<Real> U(alpha, alpha, groups * Gemm::panels(CQ / groups), KP / groups * Gemm::MR);
+  Tensor<Real> D(image.memptr(), N, K, H, W, (long) K * H * W, (long) H * W, 1, H);
+  Tensor<Real> Y(result.memptr(), N, C, out_H, out_W, (long) C * out_H * out_W,
+                 (long) out_H * out_W, 1, out_H);
+
+  double time = timestamp();
+  run_pipeline<m, Split::rs, Gemm>(grid, CQ, K, groups, U, D, Y, fused, K, C / groups,
+                                   [&](int k, int c) {
+    filter_transform_transposed<m, r, stride>(filters, groups, K, C, k, c, U);
+  }, epilogue);
+
+  time = timestamp() - time;
+  report_winograd_statistics<m, Split::rs>(CQ, KP, groups, grid.P, false, time);
+}
+
+// The backward-filter pass of winograd.cpp (see convolute_backward_filter
+// there) in one parallel region: the gradient tiles are split by (k, block
+// of tiles), dU = dM V^T by (xi, nu, block of rows of a group of K, block of
+// its channels), each block reducing over all the tiles, and the filter
+// gradients by (k, c).
+template <int m, int r, int stride, typename Real>
+void convolute_backward_filter(int N, int K, int C, int H, int W, int pad, int dilation,
+                               int groups, Cube<Real>& image, Cube<Real>& grad,
+                               Cube<Real>* grad_filters, const Tensor<Real>* kept_V) {
+  typedef Polyphase<r, stride> Split;
+  typedef WinogradConv<m, Split::rs, Real> Conv;
+  typedef BatchedGemm<Real> Gemm;
+  const int alpha = Conv::alpha;
+  const int rs = Split::rs;
+  const int phases = Split::phases;
+  TileGrid grid(m, r, H, W, N, pad, pad, stride, dilation);
+  int P = grid.P;
+  int CP = C * phases;
+  int Kg = K / groups, CPg = CP / groups;
+
+  Tensor<Real> V_own(alpha, alpha, CP, kept_V ? 0 : P);
+  const Tensor<Real>& V = kept_V ? *kept_V : V_own;
+  Tensor<Real> dM(alpha, alpha, groups * Gemm::panels(Kg), P * Gemm::MR);
+  Tensor<Real> dU(alpha, alpha, K, CPg);
+  Tensor<Real> D(image.memptr(), N, C, H, W, (long) C * H * W, (long) H * W, 1, H);
+  Tensor<Real> DY(grad.memptr(), N, K, grid.out_H, grid.out_W,
+                  (long) K * grid.out_H * grid.out_W, (long) grid.out_H * grid.out_W,
+                  1, grid.out_H);
+
+  const int tile_block = 4 * Conv::lanes;
+  const int k_block = 8 * Gemm::MR;
+  const int c_block = 16 * Gemm::NR;
+  int num_tile_blocks = (P + tile_block - 1) / tile_block;
+  int group_k_blocks = (Kg + k_block - 1) / k_block;
+  int num_k_blocks = groups * group_k_blocks;
+  int num_c_blocks = (CPg + c_block - 1) / c_block;
+  int num_input_tiles = kept_V ? 0 : CP;
+
+  double time = timestamp();
   #pragma omp parallel
   {
+    // neither transform reads what the other writes.
+    #pragma omp for collapse(2) nowait
+    for (int cp = 0; cp < num_input_tiles; cp++) {
+      for (int i = 0; i < num_tile_blocks; i++) {
+        int b = i * tile_block;
+        Conv::input_tiles(D, cp / phases, cp % phases, grid, b, min(tile_block, P - b),
+                          V_own, b);
+      }
+    }
+
     #pragma omp for collapse(2)
+    for (int k = 0; k < K; k++) {
+      for (int i = 0; i < num_tile_blocks; i++) {
+        int b = i * tile_block;
+        Conv::template gradient_tiles<Gemm>(DY, k, grid, b, min(tile_block, P - b), dM, b, Kg);
+      }
+    }
+
+    #pragma omp for collapse(4)
     for (int xi = 0; xi < alpha; xi++) {
       for (int nu = 0; nu < alpha; nu++) {
-        // flop: 16 * K * P * (2C - 1) 
-        M[xi][nu] = U[xi][nu] * V[xi][nu];
+        for (int kb = 0; kb < num_k_blocks; kb++) {
+          for (int cb = 0; cb < num_c_blocks; cb++) {
+            int g = kb / group_k_blocks;
+            int k0 = kb % group_k_blocks * k_block, j0 = cb * c_block;
+            // flop: alpha * alpha * K * (C / groups) * (2P - 1)
+            Gemm::multiply_nt_group_block(dM, V, dU, xi, nu, groups, g, k0,
+                                          min(k_block, Kg - k0), j0, min(c_block, CPg - j0));
+          }
+        }
       }
     }
-  }
-  #pragma omp parallel 
-  {
-    #pragma omp for collapse(3)
+
+    #pragma omp for collapse(2)
     for (int k = 0; k < K; k++) {
-      for (int y = 0; y < num_h_tiles; y++) {
-        for (int x = 0; x < num_w_tiles; x++) {
-          int b = gen_b(y, x);
+      for (int c = 0; c < C / groups; c++) {
+        Real du[alpha * alpha];
+        Real dg[rs * rs];
+        Real* g = grad_filters[k].slice_memptr(c);
+        for (int i = 0; i < r * r; i++) {
+          g[i] = 0;
+        }
+        for (int phase = 0; phase < phases; phase++) {
           for (int xi = 0; xi < alpha; xi++) {
             for (int nu = 0; nu < alpha; nu++) {
-              m_hold[omp_get_thread_num()](xi, nu) = M[xi][nu](k, b);
+              du[xi * alpha + nu] = dU(xi, nu, k, c * phases + phase);
             }
           }
-          // flop: K * P * (2 * 4 * 7) * 2
-          result.slice(k)(span(y*m, (y+1)*m-1), span(x*m, (x+1)*m-1)) =
-            A.t() * m_hold[omp_get_thread_num()] * A;
+          // flop: K * C * Conv::P::filter_gradient_flops()
+          Conv::filter_gradient(du, dg);
+          polyphase_scatter(dg, 1, r, r, stride, phase, g);
         }
       }
     }
   }
 
   time = timestamp() - time;
-  report_winograd_statistics(K, C, P, time);
+  report_backward_filter_statistics<m, rs>(K, CP, groups, P, kept_V != NULL, time);
+}
+
+// The forward pass, keeping V unless fused, then the backward-filter pass.
+template <int m, int r, int stride, typename Real>
+void convolute_and_backward_filter(int N, int K, int C, int H, int W, int pad, int dilation,
+                                   int groups, Cube<Real>* filters, Cube<Real>& image,
+                                   Cube<Real>& result, bool fused, Cube<Real>& grad,
+                                   Cube<Real>* grad_filters) {
+  typedef Polyphase<r, stride> Split;
+  const int alpha = m + Split::rs - 1;
+  TileGrid grid(m, r, H, W, N, pad, pad, stride, dilation);
+  Tensor<Real> V(alpha, alpha, C * Split::phases, fused ? 0 : grid.P);
+  convolute<m, r, stride, BatchedGemm<Real>>(N, K, C, H, W, pad, dilation, groups, filters,
+                                              image, result, fused, NULL, Epilogue<Real>(),
+                                              fused ? NULL : &V);
+  convolute_backward_filter<m, r, stride>(N, K, C, H, W, pad, dilation, groups, image, grad,
+                                          grad_filters, fused ? NULL : &V);
+}
+
+// Picks the F(m x m, r x r) instantiation for the requested output tile
+// size, filter size and stride, one template parameter at a time, and the
+// pass. The epilogue applies to the forward and backward-data passes, grad
+// and grad_filters are only used by the backward-filter pass. storage only
+// applies to the forward pass, and a pack (holding U as Real) to full
+// storage; int8 implies m = 2.
+template <int m, int r, int stride, typename Real>
+void convolute_pass(Pass pass, int N, int K, int C, int H, int W, int pad, int dilation,
+                    int groups, Cube<Real>* filters, Cube<Real>& image, Cube<Real>& result,
+                    bool fused, Storage storage, const FilterPack* pack,
+                    const Epilogue<Real>& epilogue, Cube<Real>* grad, Cube<Real>* grad_filters) {
+  switch (pass) {
+    case FORWARD:
+      if (storage == STORAGE_INT8) {
+        convolute_quantized<r, stride>(N, K, C, H, W, pad, dilation, groups, filters, image,
+                                       result, fused, epilogue);
+      } else if (storage == STORAGE_BF16) {
+        convolute<m, r, stride, Bf16Gemm>(N, K, C, H, W, pad, dilation, groups, filters, image,
+                                          result, fused, NULL, epilogue);
+      } else if (storage == STORAGE_HALF) {
+        convolute<m, r, stride, BatchedGemm<half>>(N, K, C, H, W, pad, dilation, groups,
+                                                   filters, image, result, fused, NULL,
+                                                   epilogue);
+      } else {
+        convolute<m, r, stride, BatchedGemm<Real>>(N, K, C, H, W, pad, dilation, groups,
+                                                   filters, image, result, fused,
+                                                   pack ? pack->template tensor<Real>() : NULL,
+                                                   epilogue);
+      }
+      break;
+    case BACKWARD_DATA:
+      convolute_backward_data<m, r, stride>(N, K, C, H, W, pad, dilation, groups, filters,
+                                            image, result, fused, epilogue);
+      break;
+    case BACKWARD_FILTER:
+      convolute_and_backward_filter<m, r, stride>(N, K, C, H, W, pad, dilation, groups,
+                                                  filters, image, result, fused, *grad,
+                                                  grad_filters);
+      break;
+  }
+}
+
+template <int m, int r, typename Real>
+void convolute_stride(int stride, Pass pass, int N, int K, int C, int H, int W, int pad,
+                      int dilation, int groups, Cube<Real>* filters, Cube<Real>& image,
+                      Cube<Real>& result, bool fused, Storage storage, const FilterPack* pack,
+                      const Epilogue<Real>& epilogue, Cube<Real>* grad,
+                      Cube<Real>* grad_filters) {
+  if (stride == 1) {
+    convolute_pass<m, r, 1>(pass, N, K, C, H, W, pad, dilation, groups, filters, image, result,
+                            fused, storage, pack, epilogue, grad, grad_filters);
+  } else {
+    convolute_pass<m, r, 2>(pass, N, K, C, H, W, pad, dilation, groups, filters, image, result,
+                            fused, storage, pack, epilogue, grad, grad_filters);
+  }
+}
+
+template <int m, typename Real>
+void convolute_filter(int r, int stride, Pass pass, int N, int K, int C, int H, int W,
+                      int pad, int dilation, int groups, Cube<Real>* filters, Cube<Real>& image,
+                      Cube<Real>& result, bool fused, Storage storage, const FilterPack* pack,
+                      const Epilogue<Real>& epilogue, Cube<Real>* grad,
+                      Cube<Real>* grad_filters) {
+  switch (r) {
+    case 3: convolute_stride<m, 3>(stride, pass, N, K, C, H, W, pad, dilation, groups,
+                                   filters, image, result, fused, storage, pack, epilogue,
+                                   grad, grad_filters); break;
+    case 5: convolute_stride<m, 5>(stride, pass, N, K, C, H, W, pad, dilation, groups,
+                                   filters, image, result, fused, storage, pack, epilogue,
+                                   grad, grad_filters); break;
+    case 7: convolute_stride<m, 7>(stride, pass, N, K, C, H, W, pad, dilation, groups,
+                                   filters, image, result, fused, storage, pack, epilogue,
+                                   grad, grad_filters); break;
+  }
+}
+
+template <typename Real>
+void convolute(int m, int r, int stride, Pass pass, int N, int K, int C, int H, int W,
+               int pad, int dilation, int groups, Cube<Real>* filters, Cube<Real>& image,
+               Cube<Real>& result, bool fused, Storage storage, const FilterPack* pack,
+               const Epilogue<Real>& epilogue, Cube<Real>* grad, Cube<Real>* grad_filters) {
+  switch (m) {
+    case 2: convolute_filter<2>(r, stride, pass, N, K, C, H, W, pad, dilation, groups,
+                                filters, image, result, fused, storage, pack, epilogue,
+                                grad, grad_filters); break;
+    case 4: convolute_filter<4>(r, stride, pass, N, K, C, H, W, pad, dilation, groups,
+                                filters, image, result, fused, storage, pack, epilogue,
+                                grad, grad_filters); break;
+    case 6: convolute_filter<6>(r, stride, pass, N, K, C, H, W, pad, dilation, groups,
+                                filters, image, result, fused, storage, pack, epilogue,
+                                grad, grad_filters); break;
+  }
+}
+
+// One layer of a network (see network.h) from activation D into Y,
+// filter transform included.
+template <int m, int r, int stride, typename Real>
+void run_layer(const NetworkLayer& layer, Cube<Real>* filters, const Tensor<Real>& D,
+               Tensor<Real>& Y, bool fused, const Epilogue<Real>& epilogue) {
+  typedef Polyphase<r, stride> Split;
+  typedef BatchedGemm<Real> Gemm;
+  const int alpha = m + Split::rs - 1;
+  int K = layer.K, C = layer.C, groups = layer.groups;
+  TileGrid grid(m, r, layer.H, layer.W, D.dim[0], layer.pad, layer.pad, stride,
+                layer.dilation);
+  int CP = C * Split::phases;
+  Tensor<Real> U(alpha, alpha, groups * Gemm::panels(K / groups),
+                 Gemm::panel_width(CP / groups));
+
+  double time = timestamp();
+  run_pipeline<m, Split::rs, Gemm>(grid, K, C, groups, U, D, Y, fused, K, C / groups,
+                                   [&](int k, int c) {
+    filter_transform<m, r, stride, Gemm>(filters, groups, K, k, c, U);
+  }, epilogue);
+
+  time = timestamp() - time;
+  report_winograd_statistics<m, Split::rs>(K, CP, groups, grid.P, false, time);
+}
+
+template <int m, int r, typename Real>
+void run_layer_stride(const NetworkLayer& layer, Cube<Real>* filters, const Tensor<Real>& D,
+                      Tensor<Real>& Y, bool fused, const Epilogue<Real>& epilogue) {
+  if (layer.stride == 1) {
+    run_layer<m, r, 1>(layer, filters, D, Y, fused, epilogue);
+  } else {
+    run_layer<m, r, 2>(layer, filters, D, Y, fused, epilogue);
+  }
+}
+
+template <int m, typename Real>
+void run_layer_filter(const NetworkLayer& layer, Cube<Real>* filters, const Tensor<Real>& D,
+                      Tensor<Real>& Y, bool fused, const Epilogue<Real>& epilogue) {
+  switch (layer.r) {
+    case 3: run_layer_stride<m, 3>(layer, filters, D, Y, fused, epilogue); break;
+    case 5: run_layer_stride<m, 5>(layer, filters, D, Y, fused, epilogue); break;
+    case 7: run_layer_stride<m, 7>(layer, filters, D, Y, fused, epilogue); break;
+  }
+}
+
+template <typename Real>
+void run_layer(int m, const NetworkLayer& layer, Cube<Real>* filters, const Tensor<Real>& D,
+               Tensor<Real>& Y, bool fused, const Epilogue<Real>& epilogue) {
+  switch (m) {
+    case 2: run_layer_filter<2>(layer, filters, D, Y, fused, epilogue); break;
+    case 4: run_layer_filter<4>(layer, filters, D, Y, fused, epilogue); break;
+    case 6: run_layer_filter<6>(layer, filters, D, Y, fused, epilogue); break;
+  }
+}
 
-  free_fourd_array(U, alpha);
-  free_fourd_array(V, alpha);
-  free_fourd_array(M, alpha);
+// Buffers for the activations between the layers of a network. A buffer
+// goes back to the pool once the last layer that reads it has run, and is
+// handed out again to the next activation that fits, so a plain chain of
+// layers only ever holds two.
+template <typename Real>
+struct ActivationPool {
+  vector<Tensor<Real>*> buffers;
+  vector<bool> in_use;
+
+  ~ActivationPool() {
+    for (size_t i = 0; i < buffers.size(); i++) {
+      delete buffers[i];
+    }
+  }
+
+  Real* acquire(long size) {
+    for (size_t i = 0; i < buffers.size(); i++) {
+      if (!in_use[i] && buffers[i]->dim[3] >= size) {
+        in_use[i] = true;
+        return buffers[i]->data;
+      }
+    }
+    buffers.push_back(new Tensor<Real>(1, 1, 1, size));
+    in_use.push_back(true);
+    return buffers.back()->data;
+  }
+
+  void release(const Real* data) {
+    for (size_t i = 0; i < buffers.size(); i++) {
+      if (buffers[i]->data == data) {
+        in_use[i] = false;
+      }
+    }
+  }
+};
+
+// Runs the layers of net back to back from the input images X to the
+// output Y. The activations in between stay in the engine's (n, c, row,
+// col) layout in pooled buffers, so they are never converted or copied;
+// only X and Y are views of the caller's cubes.
+template <typename Real>
+void run_network(int m, bool fused, const Network& net, Cube<Real>** filters,
+                 ActivationPool<Real>& pool, const Tensor<Real>& X, Tensor<Real>& Y) {
+  int L = net.layers.size();
+  int N = net.N;
+  vector<const Tensor<Real>*> activations(L + 1, NULL);
+  activations[0] = &X;
+
+  double time = timestamp();
+  for (int l = 0; l < L; l++) {
+    const NetworkLayer& layer = net.layers[l];
+    Tensor<Real>* out = &Y;
+    if (l + 1 < L) {
+      long size = (long) N * layer.K * layer.out_H * layer.out_W;
+      out = new Tensor<Real>(pool.acquire(size), N, layer.K, layer.out_H, layer.out_W,
+                             (long) layer.K * layer.out_H * layer.out_W,
+                             (long) layer.out_H * layer.out_W, layer.out_W, 1);
+    }
+    Epilogue<Real> epilogue;
+    epilogue.bias = layer.bias.empty() ? NULL : layer.bias.data();
+    epilogue.residual = layer.residual >= 0 ? activations[layer.residual] : NULL;
+    epilogue.activation = layer.activation;
+    epilogue.slope = layer.slope;
+
+    cout << "Layer " << l + 1 << ":\n";
+    run_layer(m, layer, filters[l], *activations[l], *out, fused, epilogue);
+    activations[l + 1] = out;
+
+    // neither the input images nor the output of the network are pooled.
+    for (int j = 1; j <= l; j++) {
+      if (activations[j] && net.last_use(j) == l + 1) {
+        pool.release(activations[j]->data);
+        delete activations[j];
+        activations[j] = NULL;
+      }
+    }
+  }
+
+  time = timestamp() - time;
+  long pooled = 0;
+  for (size_t i = 0; i < pool.buffers.size(); i++) {
+    pooled += pool.buffers[i]->dim[3];
+  }
+  cout << "Network: " << L << " layers, " << pool.buffers.size()
+       << " activation buffers of " << pooled * sizeof(Real) / (1024.0 * 1024.0)
+       << " MB in all\n";
+  cout << "Time Elapsed: " << time << "\n";
 }
 
 double timestamp()
@@ -156,65 +765,470 @@ double timestamp()
   return tv.tv_sec + 1e-6*tv.tv_usec;
 }
 
-void report_winograd_statistics(int K, int C, int P, double time) {
-  int flop = (K * C * (4 * 3 * 5) * 2 +
-              C * P * (4 * 4 * 7) * 2 + 
-              16 * K * P * (2 * C - 1) + 
-              K * P * (2 * 4 * 7) * 2);
+// C input channels split into the given number of groups; the filter
+// transform only counts when U was not kept (taken from a filter pack).
+// The transforms count the flops of their generated programs (see
+// TransformPrograms).
+template <int m, int r>
+void report_winograd_statistics(int K, int C, int groups, int P, bool kept_U, double time) {
+  typedef TransformPrograms<m, r> Programs;
+  long int alpha = m + r - 1;
+  long int Cg = C / groups;
+  long int flop = ((kept_U ? 0 : K * Cg * Programs::filter_flops()) +
+                   C * P * Programs::input_flops() +
+                   alpha * alpha * K * P * (2 * Cg - 1) +
+                   K * P * Programs::output_flops());
   double mflops = flop / (1024.0 * 1024.0 * time);
   cout << "Floating point operations: " << flop << "\n";
   cout << "Time Elapsed: " << time << "\n";
   cout << "MFlop/s: " << mflops << "\n";
 }
 
-int main(int argc, char* argv[])
-{
-  if (argc != 3) {
-    cout << "Usage: ./winograd <input filename> <output filename>\n";
+// The backward-filter pass over C input channels (with their phases) in
+// groups; the input transform only counts when V was not kept.
+template <int m, int r>
+void report_backward_filter_statistics(int K, int C, int groups, int P, bool kept_V, double time) {
+  typedef TransformPrograms<m, r> Programs;
+  long int alpha = m + r - 1;
+  long int Cg = C / groups;
+  long int flop = ((kept_V ? 0 : C * P * Programs::input_flops()) +
+                   K * P * Programs::gradient_flops() +
+                   alpha * alpha * K * Cg * (2 * P - 1) +
+                   K * Cg * Programs::filter_gradient_flops());
+  double mflops = flop / (1024.0 * 1024.0 * time);
+  cout << "Floating point operations: " << flop << "\n";
+  cout << "Time Elapsed: " << time << "\n";
+  cout << "MFlop/s: " << mflops << "\n";
+}
+
+// A copy of x in double, for the double-precision reference of -e.
+template <typename Real>
+Cube<double> to_double(const Cube<Real>& x) {
+  Cube<double> y(x.n_rows, x.n_cols, x.n_slices);
+  for (uword i = 0; i < x.n_elem; i++) {
+    y.memptr()[i] = x.memptr()[i];
   }
-  ifstream file;
-  file.open(argv[1]);
-  int K, C, H, W;
-  file >> K >> C >> H >> W;
+  return y;
+}
+
+// The error of a result against the result of the double-precision path,
+// as the largest absolute error, that error relative to the largest
+// reference value and the RMS error relative to the RMS of the reference.
+template <typename Real>
+void report_accuracy(const Cube<Real>& result, const Cube<double>& reference) {
+  const Real* y = result.memptr();
+  const double* ref = reference.memptr();
+  double max_error = 0, max_value = 0, square_error = 0, square_value = 0;
+  for (uword i = 0; i < reference.n_elem; i++) {
+    double error = fabs((double) y[i] - ref[i]);
+    max_error = max(max_error, error);
+    max_value = max(max_value, fabs(ref[i]));
+    square_error += error * error;
+    square_value += ref[i] * ref[i];
+  }
+  cout << "Max absolute error: " << max_error << "\n";
+  cout << "Max error / max |y|: " << (max_value > 0 ? max_error / max_value : 0) << "\n";
+  cout << "RMS error / RMS y: "
+       << (square_value > 0 ? sqrt(square_error / square_value) : 0) << "\n";
+}
 
-  if (H % 2 != 0 || W % 2 != 0) {
-    cout << "Error: Image dimensions must be even." << endl;
+// Reads a network file (see network.h), runs its layers on its images and
+// writes the output of the last layer in the format of an output file,
+// under the header of the input with K of the last layer.
+template <typename Real>
+int run_network_file(int m, bool fused, const char* input, const char* output) {
+  ifstream file;
+  file.open(input);
+  Network net;
+  if (!read_network(file, net)) {
     return 1;
   }
+  int L = net.layers.size();
+  int N = net.N, C = net.C, H = net.H, W = net.W;
 
-  cube* filters = new cube[K]();
-  for (int i = 0; i < K; i++) {
-    filters[i] = cube(3, 3, C);
-    for (int j = 0; j < C; j++) {
-      for (int row = 0; row < 3; row++) {
-        for (int col = 0; col < 3; col ++) {
-          file >> filters[i](row, col, j);
+  Cube<Real>** filters = new Cube<Real>*[L];
+  for (int l = 0; l < L; l++) {
+    const NetworkLayer& layer = net.layers[l];
+    int r = layer.r, Cg = layer.C / layer.groups;
+    filters[l] = new Cube<Real>[layer.K]();
+    for (int k = 0; k < layer.K; k++) {
+      filters[l][k] = Cube<Real>(r, r, Cg);
+      for (int c = 0; c < Cg; c++) {
+        for (int row = 0; row < r; row++) {
+          for (int col = 0; col < r; col++) {
+            filters[l][k](row, col, c) = layer.filters[((k * Cg + c) * r + row) * r + col];
+          }
         }
       }
     }
   }
 
-  cube image = cube(H, W, C);
-  for (int c = 0; c < C; c++) {
+  Cube<Real> image = Cube<Real>(H, W, N * C);
+  for (int i = 0; i < N * C; i++) {
     for (int row = 0; row < H; row++) {
       for (int col = 0; col < W; col++) {
-        file >> image(row, col, c);
+        file >> image(row, col, i);
       }
     }
   }
   file.close();
 
-  cube result = cube(H-3+1, W-3+1, K);
-  convolute(K, C, H, W, filters, image, result);
+  const NetworkLayer& last = net.layers[L - 1];
+  int out_H = last.out_H, out_W = last.out_W;
+  Cube<Real> result = Cube<Real>(out_H, out_W, N * last.K);
+  Tensor<Real> X(image.memptr(), N, C, H, W, (long) C * H * W, (long) H * W, 1, H);
+  Tensor<Real> Y(result.memptr(), N, last.K, out_H, out_W, (long) last.K * out_H * out_W,
+                 (long) out_H * out_W, 1, out_H);
+  ActivationPool<Real> pool;
+  run_network(m, fused, net, filters, pool, X, Y);
 
   ofstream fileout;
-  fileout.open(argv[2], ofstream::out | ofstream::trunc );
-  fileout << K << " " << C << " " << H << " " << W << endl;
-  for (int i = 0; i < K; i++) {
+  fileout.open(output, ofstream::out | ofstream::trunc );
+  fileout << last.K << " " << C << " " << H << " " << W;
+  if (N > 1) {
+    fileout << " " << N;
+  }
+  fileout << endl;
+  for (int i = 0; i < N * last.K; i++) {
     fileout << result.slice(i) << "\n";
   }
   fileout.close();
 
+  for (int l = 0; l < L; l++) {
+    delete[] filters[l];
+  }
   delete[] filters;
   return 0;
 }
+
+int main(int argc, char* argv[])
+{
+  // -m picks the output tile size, -r the filter size (3, 5 or 7), -f the
+  // fused (cache-blocked) pipeline, -p the zero padding (valid, same or a
+  // width), -s the stride (1 or 2), -d the dilation, -g the number of
+  // groups (C for depthwise) and -u a filter pack made by
+  // `winograd --pack-filters`. -b runs the backward-data pass (a transposed
+  // convolution) with -o rows and columns of output padding and -w the
+  // forward pass followed by the backward-filter pass, as in winograd.cpp.
+  // -a, -B and -R set the epilogue as there. -n runs a network file
+  // instead, whose layers bring their own filter sizes, strides, padding
+  // and epilogues; only -m, -f and -P apply to it. -t half stores U, V and
+  // M of the forward pass in half precision, with the GEMMs summing in
+  // float, -t bf16 stores U and V in bfloat16 and M in float, and -t int8
+  // runs it quantised (see convolute_quantized). -e runs the forward pass a
+  // second time with full storage in double and reports how far the result
+  // is from it. Everything runs in float unless -P double asks for double (see
+  // parse_precision); a filter pack must have been written in the same
+  // precision.
+  int m = 2;
+  bool fused = false;
+  const char* pad_arg = "valid";
+  int pad = 0;
+  int stride = 1;
+  int dilation = 1;
+  int groups = 1;
+  int r = 3;
+  const char* pack_filename = NULL;
+  bool backward = false;
+  bool weights = false;
+  bool network = false;
+  const char* storage_arg = "full";
+  const char* precision_arg = "float";
+  bool accuracy = false;
+  const char* activation_arg = "none";
+  const char* bias_filename = NULL;
+  const char* residual_filename = NULL;
+  int output_padding = 0;
+  bool bad_usage = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "m:r:fp:s:d:g:u:bo:wa:B:R:nt:eP:")) != -1) {
+    switch (opt) {
+      case 'm': m = atoi(optarg); break;
+      case 'r': r = atoi(optarg); break;
+      case 'f': fused = true; break;
+      case 'p': pad_arg = optarg; break;
+      case 's': stride = atoi(optarg); break;
+      case 'd': dilation = atoi(optarg); break;
+      case 'g': groups = atoi(optarg); break;
+      case 'u': pack_filename = optarg; break;
+      case 'b': backward = true; break;
+      case 'o': output_padding = atoi(optarg); break;
+      case 'w': weights = true; break;
+      case 'a': activation_arg = optarg; break;
+      case 'B': bias_filename = optarg; break;
+      case 'R': residual_filename = optarg; break;
+      case 'n': network = true; break;
+      case 't': storage_arg = optarg; break;
+      case 'e': accuracy = true; break;
+      case 'P': precision_arg = optarg; break;
+      default: bad_usage = true;
+    }
+  }
+  // "same" padding depends on the dilated filter extent.
+  if (!parse_padding(pad_arg, dilation * (r - 1) + 1, pad)) {
+    bad_usage = true;
+  }
+  Activation activation;
+  double slope = 0.01;
+  if (!parse_activation(activation_arg, activation, slope)) {
+    bad_usage = true;
+  }
+  Storage storage;
+  if (!parse_storage(storage_arg, storage)) {
+    bad_usage = true;
+  }
+  bool use_double;
+  if (!parse_precision(precision_arg, use_double)) {
+    bad_usage = true;
+  }
+  bool has_epilogue = activation != ACTIVATION_NONE || bias_filename || residual_filename;
+  if (bad_usage || argc - optind != (weights ? 3 : 2) ||
+      ((backward || weights) && pack_filename) || (backward && weights) ||
+      (weights && has_epilogue) ||
+      (network && (pack_filename || backward || weights || has_epilogue)) ||
+      (storage != STORAGE_FULL && (pack_filename || backward || weights || network)) ||
+      (accuracy && (backward || weights || network))) {
+    cout << "Usage: ./winograd_openmp [-m tile size (2, 4 or 6)] [-r filter size (3, 5 or 7)] [-f] [-p valid|same|padding] [-s stride] [-d dilation] [-g groups] [-P float|double] [-u filter pack | -t full|half|int8|bf16] [-e] [-a none|relu|relu6|leaky[:slope]] [-B bias file] [-R residual file] <input filename> <output filename>\n";
+    cout << "       ./winograd_openmp -b [-o output padding] [-m tile size (2, 4 or 6)] [-r filter size (3, 5 or 7)] [-f] [-p valid|same|padding] [-s stride] [-d dilation] [-g groups] [-P float|double] [-a none|relu|relu6|leaky[:slope]] [-B bias file] [-R residual file] <input filename> <output filename>\n";
+    cout << "       ./winograd_openmp -w [-m tile size (2, 4 or 6)] [-r filter size (3, 5 or 7)] [-f] [-p valid|same|padding] [-s stride] [-d dilation] [-g groups] [-P float|double] <input filename> <output gradient filename> <filter gradient filename>\n";
+    cout << "       ./winograd_openmp -n [-m tile size (2, 4 or 6)] [-f] [-P float|double] <network filename> <output filename>\n";
+    return 1;
+  }
+  if (m != 2 && m != 4 && m != 6) {
+    cout << "Error: Output tile size must be 2, 4 or 6." << endl;
+    return 1;
+  }
+  if (storage == STORAGE_INT8 && m != 2) {
+    cout << "Error: int8 needs an output tile size of 2." << endl;
+    return 1;
+  }
+  if (network) {
+    return use_double ? run_network_file<double>(m, fused, argv[optind], argv[optind + 1])
+                      : run_network_file<float>(m, fused, argv[optind], argv[optind + 1]);
+  }
+  if (r != 3 && r != 5 && r != 7) {
+    cout << "Error: Filter size must be 3, 5 or 7." << endl;
+    return 1;
+  }
+  if (stride != 1 && stride != 2) {
+    cout << "Error: Stride must be 1 or 2." << endl;
+    return 1;
+  }
+  if (dilation < 1 || (dilation > 1 && stride > 1)) {
+    cout << "Error: Dilation must be at least 1, and 1 with stride 2." << endl;
+    return 1;
+  }
+  if (backward && (output_padding < 0 || output_padding >= stride ||
+                   pad / stride > dilation * (polyphase_size(r, stride) - 1))) {
+    cout << "Error: Output padding must be below the stride, and the padding at most the dilated filter size minus 1." << endl;
+    return 1;
+  }
+  FilterPack pack;
+  if (pack_filename && !pack.open(pack_filename, m, r, stride)) {
+    return 1;
+  }
+  if (pack_filename && (use_double ? !pack.holds<double>() : !pack.holds<float>())) {
+    cout << "Error: Filter pack holds " << pack.precision() << " filters; run with -P "
+         << pack.precision() << "." << endl;
+    return 1;
+  }
+  ifstream file;
+  file.open(argv[optind]);
+  // the header is "K C H W", or "K C H W N" for a batch of N images.
+  int K, C, H, W, N = 1;
+  string header;
+  getline(file, header);
+  istringstream header_fields(header);
+  header_fields >> K >> C >> H >> W;
+  if (!(header_fields >> N)) {
+    N = 1;
+  }
+
+  if (groups < 1 || K % groups != 0 || C % groups != 0) {
+    cout << "Error: The number of groups must divide both K and C." << endl;
+    return 1;
+  }
+  if (pack_filename && (pack.header.K != K || pack.header.C != C ||
+                        pack.header.groups != groups)) {
+    cout << "Error: Filter pack holds " << pack.header.K << " filters of " << pack.header.C
+         << " channels in " << pack.header.groups << " groups, the input " << K << " of "
+         << C << " in " << groups << "." << endl;
+    return 1;
+  }
+
+  // the dilated filter spans extent x extent pixels.
+  int extent = dilation * (r - 1) + 1;
+  if (!backward && (H + 2 * pad < extent || W + 2 * pad < extent)) {
+    cout << "Error: Padded image is smaller than the filter." << endl;
+    return 1;
+  }
+
+  // from here on the filters, images and outputs are read, convolved and
+  // written in the working precision.
+  auto run = [&](auto zero) {
+    typedef decltype(zero) Real;
+    Epilogue<Real> epilogue;
+    epilogue.activation = activation;
+    epilogue.slope = slope;
+
+    // with a filter pack the filters are only read past. Each filter spans
+    // the C / groups channels of its group.
+    Cube<Real>* filters = new Cube<Real>[K]();
+    for (int i = 0; i < K; i++) {
+      filters[i] = Cube<Real>(r, r, C / groups);
+      for (int j = 0; j < C / groups; j++) {
+        for (int row = 0; row < r; row++) {
+          for (int col = 0; col < r; col ++) {
+            file >> filters[i](row, col, j);
+          }
+        }
+      }
+    }
+
+    // slice n * C + c holds channel c of image n; the backward-data pass
+    // reads K channels per image.
+    int in_C = backward ? K : C, out_C = backward ? C : K;
+    Cube<Real> image = Cube<Real>(H, W, N * in_C);
+    for (int i = 0; i < N * in_C; i++) {
+      for (int row = 0; row < H; row++) {
+        for (int col = 0; col < W; col++) {
+          file >> image(row, col, i);
+        }
+      }
+    }
+    file.close();
+
+    int out_H = (H + 2 * pad - extent) / stride + 1, out_W = (W + 2 * pad - extent) / stride + 1;
+    if (backward) {
+      out_H = (H - 1) * stride - 2 * pad + extent + output_padding;
+      out_W = (W - 1) * stride - 2 * pad + extent + output_padding;
+    }
+    if (out_H < 1 || out_W < 1) {
+      cout << "Error: The padding leaves no output." << endl;
+      return 1;
+    }
+    Cube<Real> result = Cube<Real>(out_H, out_W, N * out_C);
+
+    if (weights) {
+      // the gradient of the output comes in the format of an output file.
+      Cube<Real> grad = Cube<Real>(out_H, out_W, N * K);
+      file.open(argv[optind + 1]);
+      string grad_header;
+      getline(file, grad_header);
+      for (int i = 0; i < N * K; i++) {
+        for (int row = 0; row < out_H; row++) {
+          for (int col = 0; col < out_W; col++) {
+            file >> grad(row, col, i);
+          }
+        }
+      }
+      file.close();
+
+      Cube<Real>* grad_filters = new Cube<Real>[K]();
+      for (int i = 0; i < K; i++) {
+        grad_filters[i] = Cube<Real>(r, r, C / groups);
+      }
+      convolute<Real>(m, r, stride, BACKWARD_FILTER, N, K, C, H, W, pad, dilation, groups,
+                      filters, image, result, fused, storage, NULL, epilogue, &grad,
+                      grad_filters);
+
+      // K x (C / groups) filter slices, under the header of the input.
+      ofstream fileout;
+      fileout.open(argv[optind + 2], ofstream::out | ofstream::trunc );
+      fileout << K << " " << C << " " << H << " " << W;
+      if (N > 1) {
+        fileout << " " << N;
+      }
+      fileout << endl;
+      for (int i = 0; i < K; i++) {
+        for (int j = 0; j < C / groups; j++) {
+          fileout << grad_filters[i].slice(j) << "\n";
+        }
+      }
+      fileout.close();
+
+      delete[] grad_filters;
+      delete[] filters;
+      return 0;
+    }
+
+    // one bias per output channel.
+    vec bias;
+    if (bias_filename) {
+      file.open(bias_filename);
+      bias = vec(out_C);
+      for (int i = 0; i < out_C; i++) {
+        file >> bias(i);
+      }
+      file.close();
+      epilogue.bias = bias.memptr();
+    }
+    // the residual comes in the format of an output file.
+    Cube<Real> residual;
+    if (residual_filename) {
+      residual = Cube<Real>(out_H, out_W, N * out_C);
+      file.open(residual_filename);
+      string residual_header;
+      getline(file, residual_header);
+      for (int i = 0; i < N * out_C; i++) {
+        for (int row = 0; row < out_H; row++) {
+          for (int col = 0; col < out_W; col++) {
+            file >> residual(row, col, i);
+          }
+        }
+      }
+      file.close();
+    }
+    Tensor<Real> R(residual.memptr(), N, out_C, out_H, out_W, (long) out_C * out_H * out_W,
+                   (long) out_H * out_W, 1, out_H);
+    if (residual_filename) {
+      epilogue.residual = &R;
+    }
+
+    convolute<Real>(m, r, stride, backward ? BACKWARD_DATA : FORWARD, N, K, C, H, W, pad,
+                    dilation, groups, filters, image, result, fused, storage,
+                    pack_filename ? &pack : NULL, epilogue, NULL, NULL);
+    if (accuracy) {
+      // the reference runs with full storage in double, whatever -P says,
+      // on double copies of the filters, the image and the residual.
+      Cube<double>* ref_filters = new Cube<double>[K]();
+      for (int i = 0; i < K; i++) {
+        ref_filters[i] = to_double(filters[i]);
+      }
+      Cube<double> ref_image = to_double(image);
+      Cube<double> ref_residual = to_double(residual);
+      Tensor<double> ref_R(ref_residual.memptr(), N, out_C, out_H, out_W,
+                           (long) out_C * out_H * out_W, (long) out_H * out_W, 1, out_H);
+      Epilogue<double> ref_epilogue;
+      ref_epilogue.bias = epilogue.bias;
+      ref_epilogue.activation = epilogue.activation;
+      ref_epilogue.slope = epilogue.slope;
+      if (residual_filename) {
+        ref_epilogue.residual = &ref_R;
+      }
+      Cube<double> reference = Cube<double>(out_H, out_W, N * out_C);
+      cout << "Reference (full storage, double):\n";
+      convolute<double>(m, r, stride, FORWARD, N, K, C, H, W, pad, dilation, groups,
+                        ref_filters, ref_image, reference, fused, STORAGE_FULL, NULL,
+                        ref_epilogue, NULL, NULL);
+      report_accuracy(result, reference);
+      delete[] ref_filters;
+    }
+
+    ofstream fileout;
+    fileout.open(argv[optind + 1], ofstream::out | ofstream::trunc );
+    fileout << K << " " << C << " " << H << " " << W;
+    if (N > 1) {
+      fileout << " " << N;
+    }
+    fileout << endl;
+    for (int i = 0; i < N * out_C; i++) {
+      fileout << result.slice(i) << "\n";
+    }
+    fileout.close();
+
+    delete[] filters;
+    return 0;
+  };
+  return use_double ? run(0.0) : run(0.0f);
+}